@@ -0,0 +1,141 @@
+/**
+ * @file bench.cpp
+ * @brief Benchmark driver behind the bench target
+ *
+ * Runs the interpreter on each workload several times, with the workload as
+ * standard input and its output discarded, and prints one JSON object per
+ * workload: the median and fastest wall time, and the interpreter's own
+ * --stats counters (allocations, collections, peak RSS) from the last run.
+ *
+ *     bench <interpreter> <workload dir> [--runs=N] [--engine=tree|vm]
+ *
+ * The parse workload is generated into the current directory, the others are
+ * <name>.scm files in the workload directory.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+static const char *const WORKLOADS[] = {
+    "fib", "tak", "ackermann", "lists", "closures", "letrec", "deep", "display", "parse",
+};
+
+struct Run {
+    bool ok;
+    double seconds;
+    std::string stats;                     ///< The interpreter's --stats line
+};
+
+// Quoted data and definitions, about 4MB of source: reading, analysis and
+// building the quoted lists
+static std::string writeParseWorkload() {
+    const char *path = "parse.scm";
+    std::ofstream out(path);
+    for (int i = 0; i < 20000; i++) {
+        out << "(define (f" << i << " x) (if (< x " << i << ") \"string " << i
+            << "\" (cons x (f" << i << " (- x 1)))))\n";
+        out << "'(" << i << " " << i * 7 << "/3 sym-" << i << " #t #f (nested (list \"of\" items) . tail) "
+            << "123456789012345678901234567890 [bracketed " << i << "])\n";
+    }
+    return path;
+}
+
+static Run runOnce(const std::string &interpreter, const std::string &engine, const std::string &input) {
+    Run r{false, 0, ""};
+    int err[2];
+    if (pipe(err) != 0) return r;
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) return r;
+    if (pid == 0) {
+        int in = open(input.c_str(), O_RDONLY), null = open("/dev/null", O_WRONLY);
+        if (in < 0 || null < 0) _exit(127);
+        dup2(in, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+        close(err[0]);
+        execl(interpreter.c_str(), interpreter.c_str(), engine.c_str(), "--stats", static_cast<char *>(nullptr));
+        _exit(127);
+    }
+    close(err[1]);
+    char buf[4096];
+    ssize_t n;
+    std::string captured;
+    while ((n = read(err[0], buf, sizeof buf)) > 0) captured.append(buf, n);
+    close(err[0]);
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid) return r;
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    r.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    // The stats line is the last one on stderr
+    size_t last = captured.rfind("allocations=");
+    if (last != std::string::npos) r.stats = captured.substr(last, captured.find('\n', last) - last);
+    return r;
+}
+
+// "key=value key=value" as JSON members
+static std::string statsJson(const std::string &stats) {
+    std::istringstream in(stats);
+    std::string field, json;
+    while (in >> field) {
+        size_t eq = field.find('=');
+        if (eq == std::string::npos) continue;
+        json += ",\"" + field.substr(0, eq) + "\":" + field.substr(eq + 1);
+    }
+    return json;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0] << " <interpreter> <workload dir> [--runs=N] [--engine=tree|vm]" << std::endl;
+        return 2;
+    }
+    std::string interpreter = argv[1], dir = argv[2], engine = "--engine=tree";
+    int runs = 5;
+    for (int i = 3; i < argc; i++) {
+        if (std::strncmp(argv[i], "--runs=", 7) == 0) {
+            runs = std::max(1, std::atoi(argv[i] + 7));
+        } else if (std::strncmp(argv[i], "--engine=", 9) == 0) {
+            engine = argv[i];
+        } else {
+            std::cerr << "unknown option " << argv[i] << std::endl;
+            return 2;
+        }
+    }
+
+    bool failed = false;
+    for (const char *name : WORKLOADS) {
+        std::string input = std::strcmp(name, "parse") == 0 ? writeParseWorkload() : dir + "/" + name + ".scm";
+        std::vector<double> times;
+        Run last{false, 0, ""};
+        for (int i = 0; i < runs; i++) {
+            last = runOnce(interpreter, engine, input);
+            if (!last.ok) break;
+            times.push_back(last.seconds);
+        }
+        std::cout << "{\"workload\":\"" << name << "\",\"engine\":\"" << engine.substr(9) << "\"";
+        if (!last.ok) {
+            failed = true;
+            std::cout << ",\"error\":\"interpreter failed\"}" << std::endl;
+            continue;
+        }
+        std::sort(times.begin(), times.end());
+        double median = times.size() % 2 ? times[times.size() / 2] : (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2;
+        char timing[128];
+        std::snprintf(timing, sizeof timing, ",\"runs\":%d,\"median_ms\":%.2f,\"min_ms\":%.2f", runs, median * 1e3, times[0] * 1e3);
+        std::cout << timing << statsJson(last.stats) << "}" << std::endl;
+    }
+    return failed ? 1 : 0;
+}
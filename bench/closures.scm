@@ -0,0 +1,20 @@
+; Closure-heavy counters: lambda creation, captured state and set!
+(define (make-counter)
+  (let ((n 0))
+    (lambda ()
+      (set! n (+ n 1))
+      n)))
+(define (run-counters k)
+  (letrec ((loop (lambda (k acc)
+                   (if (= k 0)
+                       acc
+                       (let ((c (make-counter)))
+                         (c) (c)
+                         (loop (- k 1) (+ acc (c))))))))
+    (loop k 0)))
+(run-counters 200000)
+(define (compose f g) (lambda (x) (f (g x))))
+(define add1 (lambda (x) (+ x 1)))
+(define (chain n f)
+  (if (= n 0) f (chain (- n 1) (compose add1 f))))
+((chain 10000 add1) 0)
@@ -0,0 +1,5 @@
+; Non-tail recursion 300000 frames deep, past the native stack onto chained
+; segments: collections scan the whole deep stack
+(define (build n) (if (= n 0) '() (cons n (build (- n 1)))))
+(define (len l) (if (null? l) 0 (+ 1 (len (cdr l)))))
+(len (build 300000))
@@ -0,0 +1,12 @@
+; Large amounts of display output
+(define l '(1 2 (3 4) "five" #t (6 . 7)))
+(define (show-all k)
+  (if (= k 0)
+      'done
+      (begin
+        (display k)
+        (display " ")
+        (display l)
+        (display "\n")
+        (show-all (- k 1)))))
+(show-all 200000)
@@ -0,0 +1,6 @@
+; Doubly recursive calls and fixnum arithmetic
+(define (fib n)
+  (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+(fib 27)
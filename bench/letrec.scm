@@ -0,0 +1,12 @@
+; Deep non-tail recursion through letrec-bound mutually recursive procedures
+(define (depth n)
+  (letrec ((even-depth (lambda (n) (if (= n 0) 0 (+ 1 (odd-depth (- n 1))))))
+           (odd-depth (lambda (n) (if (= n 0) 0 (+ 1 (even-depth (- n 1)))))))
+    (even-depth n)))
+(define (repeat k)
+  (if (= k 0)
+      'done
+      (begin
+        (depth 20000)
+        (repeat (- k 1)))))
+(repeat 20)
@@ -0,0 +1,24 @@
+; Building, reversing and mapping over lists: pair allocation and traversal
+(define (iota n)
+  (letrec ((loop (lambda (i acc)
+                   (if (= i 0) acc (loop (- i 1) (cons i acc))))))
+    (loop n '())))
+(define (rev l)
+  (letrec ((loop (lambda (l acc)
+                   (if (null? l) acc (loop (cdr l) (cons (car l) acc))))))
+    (loop l '())))
+(define (map1 f l)
+  (rev (letrec ((loop (lambda (l acc)
+                        (if (null? l) acc (loop (cdr l) (cons (f (car l)) acc))))))
+         (loop l '()))))
+(define (sum l)
+  (letrec ((loop (lambda (l acc)
+                   (if (null? l) acc (loop (cdr l) (+ acc (car l)))))))
+    (loop l 0)))
+(define (round k)
+  (if (= k 0)
+      'done
+      (begin
+        (sum (map1 (lambda (x) (* x 2)) (rev (iota 10000))))
+        (round (- k 1)))))
+(round 20)
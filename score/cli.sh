@@ -0,0 +1,238 @@
+#!/bin/bash
+# Command-line cases: what the data/ cases cannot show through a REPL on
+# standard input, such as exit codes and options. Each case runs a command
+# and checks its exit code and standard output.
+#
+#     cli.sh [interpreter]       (default ../build/code)
+
+CODE=$(realpath "${1:-$(dirname "$0")/../build/code}") || exit 2
+cd "$(dirname "$0")" || exit 2
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+pass=0
+fail=0
+
+# expect NAME RC OUTPUT COMMAND...: COMMAND exits with RC and prints OUTPUT
+expect() {
+    local name="$1" rc="$2" want="$3"
+    shift 3
+    local got
+    got=$("$@" 2>"$TMP/err")
+    local status=$?
+    if [[ $status -eq $rc && "$got" == "$want" ]]; then
+        pass=$((pass + 1))
+    else
+        fail=$((fail + 1))
+        echo "FAIL $name: exit $status, expected $rc"
+        echo "--- expected ---"; echo "$want"
+        echo "--- actual ---"; echo "$got"
+        echo "--- stderr ---"; cat "$TMP/err"
+    fi
+}
+
+# data_case N: data/N.in through the REPL gives data/N.out on both engines,
+# compared as score.sh does
+data_case() {
+    local engine got
+    for engine in tree vm; do
+        got=$({ cat "data/$1.in"; echo "(exit)"; } | "$CODE" --engine=$engine 2>/dev/null | sed '$d' | sed 's/^scm> //' | grep -v '^DEBUG: ')
+        if [[ "$got" == "$(cat "data/$1.out")" ]]; then
+            pass=$((pass + 1))
+        else
+            fail=$((fail + 1))
+            echo "FAIL data/$1 on $engine"
+            echo "--- expected ---"; cat "data/$1.out"
+            echo "--- actual ---"; echo "$got"
+        fi
+    done
+}
+
+# repl OPTION...: standard input through the REPL, printing its output as
+# data_case compares it
+repl() {
+    "$CODE" "$@" | sed 's/scm> //g' | grep -v '^DEBUG: '
+}
+
+# Batch mode: 0 when every script ran, 1 when a form failed, 2 when a file
+# could not be read
+printf '(display (+ 1 2))\n(display " ")\n' > "$TMP/a.scm"
+printf '(display 4)\n' > "$TMP/b.scm"
+expect batch-ok 0 "3 4" "$CODE" "$TMP/a.scm" "$TMP/b.scm"
+expect batch-inline 0 "5" "$CODE" -e '(display 5)'
+expect batch-exit 0 "1" "$CODE" -e '(display 1) (exit) (display 2)' -e '(display 3)'
+expect batch-error 1 "1" "$CODE" -e '(display 1) (car 1) (display 2)' -e '(display 3)'
+expect batch-missing 2 "" "$CODE" "$TMP/none.scm"
+# Input that ends inside a form does not run it
+expect batch-truncated 1 "" "$CODE" -e '(display (+ 1'
+expect batch-truncated-string 1 "1" "$CODE" -e '(display 1) (display "a'
+printf '(display 6)\n(define (f x)\n  (+ x 1)\n' > "$TMP/c.scm"
+expect batch-truncated-file 1 "6" "$CODE" "$TMP/c.scm"
+
+# Tail calls run in constant space: a stack that grew with the loop would
+# take segments past the heap limit, which counts them
+for engine in tree vm; do
+    expect tail-loop-$engine 0 "2000000" "$CODE" --engine=$engine --max-heap=16M data/132.in
+    expect tail-mutual-$engine 0 "(#t #t #f)" "$CODE" --engine=$engine --max-heap=16M data/133.in
+done
+
+# Redefining a primitive takes effect in calls specialized or folded before
+data_case 134
+
+# Cached top-level lookups see redefinitions, and not a body's own define
+data_case 135
+data_case 136
+
+# A quoted datum is built once, so it is the same object each time
+data_case 137
+
+# session SOCKET: standard input as one --server session, printing its
+# output as data_case compares it
+session() {
+    python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(sys.stdin.buffer.read())
+s.shutdown(socket.SHUT_WR)
+while True:
+    data = s.recv(65536)
+    if not data:
+        break
+    sys.stdout.buffer.write(data)
+' "$1" | grep -v '^DEBUG: '
+}
+
+# Server sessions see the prelude, and not each other's definitions; a failed
+# form ends neither its session nor the server
+printf '(define (square x) (* x x))\n(define base 7)\n' > "$TMP/prelude.scm"
+"$CODE" --prelude="$TMP/prelude.scm" --server="$TMP/sock" 2>"$TMP/server.err" &
+server=$!
+for _ in $(seq 50); do [[ -S "$TMP/sock" ]] && break; sleep 0.1; done
+expect server-first 0 "$(printf '49\nRuntimeError\n4')" \
+    session "$TMP/sock" <<< '(define x 2) (square base) (car 1) (square x)'
+expect server-second 0 "$(printf '9\nRuntimeError')" \
+    session "$TMP/sock" <<< '(square 3) x'
+kill $server
+wait $server
+status=$?
+# and SIGTERM stops it cleanly, removing the socket
+expect server-stop 0 "" test $status -eq 0 -a ! -e "$TMP/sock"
+
+# An image of the prelude runs its procedures without the prelude, on either
+# engine, and is the same as loading the prelude itself
+printf '(define (range a b) (if (> a b) (quote ()) (cons a (range (+ a 1) b))))\n(define (total xs) (if (null? xs) 0 (+ (car xs) (total (cdr xs)))))\n(define ten (range 1 10))\n' > "$TMP/lib.scm"
+use='(display ten) (display " ") (display (total ten)) (display " ") (display (total (range 1 3)))'
+expect image-save 0 "" "$CODE" --prelude="$TMP/lib.scm" --save-image="$TMP/lib.img" -e ''
+for engine in tree vm; do
+    expect image-load-$engine 0 "(1 2 3 4 5 6 7 8 9 10) 55 6" \
+        "$CODE" --engine=$engine --image="$TMP/lib.img" -e "$use"
+done
+expect image-prelude 0 "(1 2 3 4 5 6 7 8 9 10) 55 6" \
+    "$CODE" --prelude="$TMP/lib.scm" -e "$use"
+expect image-missing 1 "" "$CODE" --image="$TMP/none.img" -e '(display 1)'
+
+# cached FILE: FILE as standard input through the form cache
+cached() {
+    repl --cache="$TMP/cache" < "$1"
+}
+
+# A warm run reads the forms the cold run cached, and prints the same; a
+# cache it cannot use is parsed again, and input that ends inside a form is
+# not cached
+mkdir "$TMP/cache"
+printf '(define (f x) (* x 10))\n(f 4)\n(car 1)\n(quote (a "b" #t 1.5))\n(f 5)\n' > "$TMP/s.scm"
+cold=$(printf '40\nRuntimeError\n(a "b" #t 1.5)\n50')
+expect cache-cold 0 "$cold" cached "$TMP/s.scm"
+expect cache-made 0 "1" bash -c 'ls "$0" | wc -l' "$TMP/cache"
+expect cache-warm 0 "$cold" cached "$TMP/s.scm"
+for file in "$TMP"/cache/*; do : > "$file"; done
+expect cache-unusable 0 "$cold" cached "$TMP/s.scm"
+printf '(define (g x) (+ x 1))\n(g 1)\n(g (+ 1' > "$TMP/t.scm"
+rm -f "$TMP"/cache/*
+expect cache-truncated 0 "$(printf '2\nRuntimeError')" cached "$TMP/t.scm"
+expect cache-truncated-made 0 "0" bash -c 'ls "$0" | wc -l' "$TMP/cache"
+
+# A form over --max-steps or --max-heap fails, and a REPL or a server session
+# goes on to the next form with nothing left of it; a batch script stops
+loop='(define (loop n) (if (= n 0) 0 (loop (- n 1))))'
+build='(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))'
+expect steps-batch 1 "1" "$CODE" --max-steps=1000 -e "$loop (display 1) (loop 100000) (display 2)"
+expect steps-batch-under 0 "0" "$CODE" --max-steps=1000 -e "$loop (display (loop 100))"
+expect heap-batch 1 "1" "$CODE" --max-heap=4M -e "$build (display 1) (build 10000000 (quote ())) (display 2)"
+for engine in tree vm; do
+    expect steps-repl-$engine 0 "$(printf 'RuntimeError\n0\n0')" \
+        repl --engine=$engine --max-steps=1000 <<< "$loop (loop 100000) (loop 100) (loop 100)"
+    expect heap-repl-$engine 0 "$(printf 'RuntimeError\n1\nRuntimeError\n1')" \
+        repl --engine=$engine --max-heap=4M <<< "$build (define big (build 10000000 (quote ()))) (car (build 1000 (quote ()))) big (car (build 100000 (quote ())))"
+done
+expect limits-usage 1 "" "$CODE" --max-steps=many -e 1
+expect limits-usage-size 1 "" "$CODE" --max-heap=4Q -e 1
+"$CODE" --max-steps=10000 --max-heap=4M --server="$TMP/sock" 2>"$TMP/server.err" &
+server=$!
+for _ in $(seq 50); do [[ -S "$TMP/sock" ]] && break; sleep 0.1; done
+expect steps-server 0 "$(printf 'RuntimeError\n0')" \
+    session "$TMP/sock" <<< "$loop (loop 100000) (loop 100)"
+expect heap-server 0 "$(printf 'RuntimeError\n1')" \
+    session "$TMP/sock" <<< "$build (build 10000000 (quote ())) (car (build 1000 (quote ())))"
+kill $server
+wait $server
+
+# printed OPTION...: a checksum of what the interpreter prints
+printed() {
+    "$CODE" "$@" | cksum
+}
+
+# Printing takes no stack for nesting or length: data deeper than a recursive
+# printer could follow prints whole, as display and as a REPL value
+range='(define (range n acc) (if (= n 0) acc (range (- n 1) (cons n acc))))'
+nest='(define (nest n acc) (if (= n 0) acc (nest (- n 1) (list acc (vector acc)))))'
+expect print-long 0 "$(python3 -c "print('(' + ' '.join(map(str, range(1, 1000001))) + ' . 0)', end='')" | cksum)" \
+    printed -e "$range (display (range 1000000 0))"
+deep='(define (deep n acc) (if (= n 0) acc (deep (- n 1) (list acc))))'
+for engine in tree vm; do
+    expect print-deep-$engine 0 "$(python3 -c "print('(' * 100000 + 'x' + ')' * 100000, end='')" | cksum)" \
+        printed --engine=$engine -e "$deep (display (deep 100000 (quote x)))"
+    expect print-deep-value-$engine 0 "$(python3 -c "print('#(' * 100000 + '1' + ')' * 100000)" | cksum)" \
+        printed --engine=$engine -e "(define (deep n acc) (if (= n 0) acc (deep (- n 1) (vector acc)))) (deep 100000 1)"
+done
+
+# counters FILE: whether the SCHEME_STATS counters in FILE are consistent:
+# what a collection kept is part of what was allocated, with payloads and
+# stack segments counted apart
+counters() {
+    awk '{n[$1] = $2}
+        END {
+            kept = n["live-bytes"] <= n["allocated-bytes"] ? "ok" : "over"
+            print kept, (n["payload-bytes"] > 0), (n["segment-bytes"] > 0)
+        }' "$1"
+}
+
+# Deep recursion in the tree walker maps stack segments; a vector holds a
+# payload. Both count towards --max-heap
+SCHEME_STATS=1 "$CODE" data/131.in 2>"$TMP/stats" >/dev/null
+expect stats-segments 0 "ok 0 1" counters "$TMP/stats"
+SCHEME_STATS=1 "$CODE" -e "$build (define v (make-vector 1000000 0)) (define l (build 300000 (quote ())))" 2>"$TMP/stats"
+expect stats-payload 0 "ok 1 0" counters "$TMP/stats"
+expect heap-segments 1 "" "$CODE" --max-heap=32M data/131.in
+
+# within SECONDS NAME COMMAND...: COMMAND succeeds within SECONDS
+within() {
+    local seconds="$1" name="$2"
+    shift 2
+    local start=$SECONDS
+    if timeout "$seconds" "$@" >/dev/null 2>&1; then
+        pass=$((pass + 1))
+    else
+        fail=$((fail + 1))
+        echo "FAIL $name: did not finish within ${seconds}s ($((SECONDS - start))s)"
+    fi
+}
+
+# Deep non-tail recursion runs on chained stack segments, and collections
+# do not rescan the segments left behind, so its cost stays linear
+within 5 deep-recursion "$CODE" data/131.in
+within 5 deep-recursion-vm "$CODE" --engine=vm data/131.in
+
+echo "pass=$pass fail=$fail"
+[[ $fail -eq 0 ]]
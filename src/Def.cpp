@@ -8,6 +8,37 @@
  */
 
 #include "Def.hpp"
+#include <mutex>
+#include <unordered_set>
+
+Symbol::Symbol(const std::string &s) {
+    // Function-local so that the tables below can intern during static init.
+    // Futures may intern on other threads
+    static std::unordered_set<std::string> names;
+    static std::mutex names_lock;
+    std::lock_guard<std::mutex> guard(names_lock);
+    name = &*names.insert(s).first;
+}
+
+// In ExprType order
+static const char *const type_names[] = {
+    "fixnum", "bignum", "rational", "string", "boolean", "void", "exit", "null", "proc", "pair",
+    "vector", "fxvector", "hashtable", "future", "primitive", "specialform", "empty", "plus",
+    "minus", "mul", "div", "modulo", "expt", "lt", "le", "eq", "ge", "gt", "cons", "car", "cdr",
+    "list", "setcar", "setcdr", "vectorfunc", "makevector", "vectorq", "vectorlength", "vectorref",
+    "vectorset", "vectorfill", "vectortolist", "listtovector", "makefxvector", "listtofxvector",
+    "fxvectorq", "fxvectorsum", "fxvectoradd", "fxvectormul", "fxvectoreq", "makehashtable",
+    "makeequalhashtable", "hashtableq", "hashref", "hashset", "hashremove", "hashcount",
+    "makefuture", "touch", "futureq", "not", "and", "or", "eqq", "equalq", "boolq", "intq", "nullq",
+    "pairq", "procq", "symbolq", "listq", "stringq", "begin", "quote", "if", "cond", "var", "slist",
+    "apply", "guard", "badform", "lambda", "define", "deferred", "let", "letrec", "set",
+    "display", "runtime_stats",
+};
+static_assert(sizeof type_names / sizeof type_names[0] == E_TYPE_COUNT, "type_names out of step with ExprType");
+
+const char *type_name(ExprType t) {
+    return type_names[t];
+}
 
 /**
  * @brief Mapping of primitive function names to expression types
@@ -20,57 +51,102 @@
  * - Arithmetic: +, -, *, /, modulo, expt
  * - Comparison: <, <=, =, >=, >
  * - List operations: cons, car, cdr, list, set-car!, set-cdr!
+ * - Vector operations: vector, make-vector, vector?, vector-length, vector-ref, vector-set!,
+ *   vector-fill!, vector->list, list->vector (the accessors take both kinds of vector)
+ * - Fixnum vector operations: make-fxvector, list->fxvector, fxvector?, fxvector-sum,
+ *   fxvector-add, fxvector-mul, fxvector=?
+ * - Hash tables: make-hash-table (eq? keys), make-equal-hash-table, hash-table?, hash-ref,
+ *   hash-set!, hash-remove!, hash-count
+ * - Futures: touch, future? (future itself is a special form)
  * - Logic: not, and, or (and/or support short-circuit evaluation)
- * - Type predicates: eq?, boolean?, number?, null?, pair?, procedure?, symbol?, list?, string?
+ * - Type predicates: eq?, equal?, boolean?, number?, null?, pair?, procedure?, symbol?, list?, string?
  * - I/O: display
  * - Control: void, exit
+ * - Introspection: runtime-stats
  */
-std::unordered_map<std::string, ExprType> primitives = {
+std::unordered_map<Symbol, ExprType> primitives = {
     // Arithmetic operations
-    {"+",        E_PLUS},
-    {"-",        E_MINUS},
-    {"*",        E_MUL},
-    {"/",        E_DIV},
-    {"modulo",   E_MODULO},
-    {"expt",     E_EXPT},
+    {Symbol("+"),        E_PLUS},
+    {Symbol("-"),        E_MINUS},
+    {Symbol("*"),        E_MUL},
+    {Symbol("/"),        E_DIV},
+    {Symbol("modulo"),   E_MODULO},
+    {Symbol("expt"),     E_EXPT},
     
     // Comparison operations
-    {"<",        E_LT},
-    {"<=",       E_LE},
-    {"=",        E_EQ},
-    {">=",       E_GE},
-    {">",        E_GT},
+    {Symbol("<"),        E_LT},
+    {Symbol("<="),       E_LE},
+    {Symbol("="),        E_EQ},
+    {Symbol(">="),       E_GE},
+    {Symbol(">"),        E_GT},
 
      // List operations
-    {"cons",      E_CONS},
-    {"car",       E_CAR},
-    {"cdr",       E_CDR},
-    {"list",      E_LIST},
-    {"set-car!",  E_SETCAR},
-    {"set-cdr!",  E_SETCDR},
+    {Symbol("cons"),      E_CONS},
+    {Symbol("car"),       E_CAR},
+    {Symbol("cdr"),       E_CDR},
+    {Symbol("list"),      E_LIST},
+    {Symbol("set-car!"),  E_SETCAR},
+    {Symbol("set-cdr!"),  E_SETCDR},
+
+    // Vector operations
+    {Symbol("vector"),        E_VECTORFUNC},
+    {Symbol("make-vector"),   E_MAKEVECTOR},
+    {Symbol("vector?"),       E_VECTORQ},
+    {Symbol("vector-length"), E_VECTORLENGTH},
+    {Symbol("vector-ref"),    E_VECTORREF},
+    {Symbol("vector-set!"),   E_VECTORSET},
+    {Symbol("vector-fill!"),  E_VECTORFILL},
+    {Symbol("vector->list"),  E_VECTORTOLIST},
+    {Symbol("list->vector"),  E_LISTTOVECTOR},
+
+    // Fixnum vector operations
+    {Symbol("make-fxvector"),   E_MAKEFXVECTOR},
+    {Symbol("list->fxvector"),  E_LISTTOFXVECTOR},
+    {Symbol("fxvector?"),       E_FXVECTORQ},
+    {Symbol("fxvector-sum"),    E_FXVECTORSUM},
+    {Symbol("fxvector-add"),    E_FXVECTORADD},
+    {Symbol("fxvector-mul"),    E_FXVECTORMUL},
+    {Symbol("fxvector=?"),      E_FXVECTOREQ},
+
+    // Hash table operations
+    {Symbol("make-hash-table"),       E_MAKEHASHTABLE},
+    {Symbol("make-equal-hash-table"), E_MAKEEQUALHASHTABLE},
+    {Symbol("hash-table?"),           E_HASHTABLEQ},
+    {Symbol("hash-ref"),              E_HASHREF},
+    {Symbol("hash-set!"),             E_HASHSET},
+    {Symbol("hash-remove!"),          E_HASHREMOVE},
+    {Symbol("hash-count"),            E_HASHCOUNT},
+
+    // Futures
+    {Symbol("touch"),   E_TOUCH},
+    {Symbol("future?"), E_FUTUREQ},
 
     // Logic operations
-    {"not",       E_NOT},
-    {"and",       E_AND},
-    {"or",        E_OR},
+    {Symbol("not"),       E_NOT},
+    {Symbol("and"),       E_AND},
+    {Symbol("or"),        E_OR},
     
     // Type predicates
-    {"eq?",        E_EQQ},
-    {"boolean?",   E_BOOLQ},
-    {"number?",    E_INTQ},      
-    {"null?",      E_NULLQ},
-    {"pair?",      E_PAIRQ},
-    {"procedure?", E_PROCQ},
-    {"symbol?",    E_SYMBOLQ},
-    {"list?",      E_LISTQ},
-    {"string?",    E_STRINGQ},
+    {Symbol("eq?"),        E_EQQ},
+    {Symbol("equal?"),     E_EQUALQ},
+    {Symbol("boolean?"),   E_BOOLQ},
+    {Symbol("number?"),    E_INTQ},      
+    {Symbol("null?"),      E_NULLQ},
+    {Symbol("pair?"),      E_PAIRQ},
+    {Symbol("procedure?"), E_PROCQ},
+    {Symbol("symbol?"),    E_SYMBOLQ},
+    {Symbol("list?"),      E_LISTQ},
+    {Symbol("string?"),    E_STRINGQ},
     
     // I/O operations
-    {"display",   E_DISPLAY},
+    {Symbol("display"),   E_DISPLAY},
     
     // Special values and control
-    {"void",      E_VOID},
-    {"exit",      E_EXIT}
+    {Symbol("void"),      E_VOID},
+    {Symbol("exit"),      E_EXIT},
+
+    // Introspection
+    {Symbol("runtime-stats"), E_RUNTIME_STATS}
 };
 
 /**
@@ -87,29 +163,33 @@ std::unordered_map<std::string, ExprType> primitives = {
  * - Variable and function definition: define
  * - Binding constructs: let, letrec
  * - Assignment: set!
+ * - Parallelism: future
  * 
  * Note: and/or have been moved to primitives to support function-style usage
  * while maintaining their short-circuit evaluation behavior.
  */
-std::unordered_map<std::string, ExprType> reserved_words = {
+std::unordered_map<Symbol, ExprType> reserved_words = {
     // Control flow constructs
-    {"begin",   E_BEGIN},    
-    {"quote",   E_QUOTE},    
+    {Symbol("begin"),   E_BEGIN},    
+    {Symbol("quote"),   E_QUOTE},    
 
     // Conditional
-    {"if",      E_IF},       
-    {"cond",    E_COND},     
+    {Symbol("if"),      E_IF},       
+    {Symbol("cond"),    E_COND},     
 
     // Function definition
-    {"lambda",  E_LAMBDA},   
+    {Symbol("lambda"),  E_LAMBDA},   
 
     // Variable and function definition
-    {"define",  E_DEFINE},   
+    {Symbol("define"),  E_DEFINE},   
 
     // Binding constructs
-    {"let",     E_LET},      
-    {"letrec",  E_LETREC},   
+    {Symbol("let"),     E_LET},      
+    {Symbol("letrec"),  E_LETREC},   
     
     // Assignment
-    {"set!",    E_SET}      
+    {Symbol("set!"),    E_SET},
+
+    // Parallelism
+    {Symbol("future"),  E_MAKEFUTURE}
 };
@@ -21,7 +21,29 @@
 struct Syntax;
 struct Expr;
 struct Env;
-using EnvPtr = std::shared_ptr<Env>;
+using EnvPtr = Env *;
+
+/**
+ * @brief Interned identifier
+ *
+ * Each spelling is stored once, so a Symbol is just a pointer to its name:
+ * comparing and hashing symbols never looks at the characters.
+ */
+class Symbol {
+    const std::string *name;
+public:
+    explicit Symbol(const std::string &);
+    const std::string &str() const { return *name; }
+    bool operator==(const Symbol &o) const { return name == o.name; }
+    bool operator!=(const Symbol &o) const { return name != o.name; }
+    std::size_t hash() const { return std::hash<const std::string *>()(name); }
+};
+
+namespace std {
+template <> struct hash<Symbol> {
+    size_t operator()(const Symbol &s) const { return s.hash(); }
+};
+}
 
 /**
  * @brief Expression types enumeration
@@ -32,6 +54,7 @@ using EnvPtr = std::shared_ptr<Env>;
 enum ExprType {
     // Basic types and literals
     E_FIXNUM,          
+    E_BIGNUM,
     E_RATIONAL,        
     E_STRING,
     E_BOOLEAN,               
@@ -40,6 +63,10 @@ enum ExprType {
     E_NULL,
     E_PROC,
     E_PAIR,
+    E_VECTOR,
+    E_FXVECTOR,
+    E_HASHTABLE,
+    E_FUTURE,
     E_PRIMITIVE,
     E_SPECIALFORM,
     E_EMPTY,            
@@ -67,6 +94,39 @@ enum ExprType {
     E_SETCAR,          
     E_SETCDR,          
 
+    // Vector operations
+    E_VECTORFUNC,
+    E_MAKEVECTOR,
+    E_VECTORQ,
+    E_VECTORLENGTH,
+    E_VECTORREF,
+    E_VECTORSET,
+    E_VECTORFILL,
+    E_VECTORTOLIST,
+    E_LISTTOVECTOR,
+
+    // Fixnum vector operations
+    E_MAKEFXVECTOR,
+    E_LISTTOFXVECTOR,
+    E_FXVECTORQ,
+    E_FXVECTORSUM,
+    E_FXVECTORADD,
+    E_FXVECTORMUL,
+    E_FXVECTOREQ,
+
+    // Hash table operations
+    E_MAKEHASHTABLE,
+    E_MAKEEQUALHASHTABLE,
+    E_HASHTABLEQ,
+    E_HASHREF,
+    E_HASHSET,
+    E_HASHREMOVE,
+    E_HASHCOUNT,
+    // Futures
+    E_MAKEFUTURE,
+    E_TOUCH,
+    E_FUTUREQ,
+
     // Logic operations
     E_NOT,              
     E_AND,             
@@ -74,6 +134,7 @@ enum ExprType {
     
     // Type predicates
     E_EQQ,              
+    E_EQUALQ,
     E_BOOLQ,           
     E_INTQ,            
     E_NULLQ,            
@@ -95,8 +156,11 @@ enum ExprType {
     E_VAR,
     E_SLIST,              
     E_APPLY,           
+    E_GUARD,
+    E_BADFORM,
     E_LAMBDA,         
     E_DEFINE,          
+    E_DEFERRED,
 
     // Binding constructs
     E_LET,            
@@ -107,6 +171,13 @@ enum ExprType {
 
     // I/O operations
     E_DISPLAY,
+
+    // Introspection
+    E_RUNTIME_STATS,
+
+    E_TYPE_COUNT       ///< Number of types, keep last
 };
 
+const char *type_name(ExprType);   ///< Lower-case name without the E_ prefix, as runtime-stats reports it
+
 #endif // DEF_HPP
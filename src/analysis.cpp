@@ -0,0 +1,573 @@
+/**
+ * @file analysis.cpp
+ * @brief Syntactic analysis pass between parse() and eval()
+ *
+ * parse() only produces literals, Vars and SLists. analyze() walks that raw
+ * tree once and replaces every SList with the specialized expression that
+ * evaluates it (If, Let, PlusVar, Apply, ...), so evaluating a form no longer
+ * re-dispatches on its head or allocates dispatch nodes on every run.
+ *
+ * The same walk resolves every variable to a lexical address: the number of
+ * frames to walk up and the slot in that frame. Each lambda call, let and
+ * letrec creates exactly one frame whose slots are its bound names followed by
+ * the names its body defines, so local lookups never hash a name.
+ *
+ * A head naming a primitive or special form is only specialized when the name
+ * is not bound by an enclosing lambda/let/letrec or in the environment the
+ * form is analyzed in. Since a later define can still rebind such a name, the
+ * specialized node is wrapped in a Guard that falls back to an ordinary
+ * application once that happens.
+ *
+ * The walk also folds what it can decide before running: a pure primitive
+ * applied to constants becomes its value, an if or cond with a constant test
+ * becomes the branch it takes, and constants and lambdas whose value a
+ * begin or body discards are dropped. A folded node relies on the heads of
+ * the forms it was folded from, so their names join those of the Guard
+ * around it, which analyzes the form again if any of them is rebound.
+ */
+
+#include "RE.hpp"
+#include "Def.hpp"
+#include "expr.hpp"
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+
+using std::string;
+using std::vector;
+using std::pair;
+
+extern std::unordered_map<Symbol, ExprType> primitives;
+extern std::unordered_map<Symbol, ExprType> reserved_words;
+
+// Names of primitives and special forms that some define has rebound
+static std::unordered_set<Symbol> shadowed_names;
+
+void note_define(const Symbol &x) {
+    if (primitives.count(x) || reserved_words.count(x)) {
+        shadowed_names.insert(x);
+        Env::version++;
+    }
+}
+
+bool is_shadowed(const Symbol &x) {
+    return !shadowed_names.empty() && shadowed_names.count(x);
+}
+
+// Lambda, procedure define and future nodes made so far. A frame whose code
+// made none can only be captured by forms analyzed as it runs, which escape()
+static unsigned long closures = 0;
+
+// Lexical address of x; slot is -1 when x is not bound locally, and depth is
+// then the distance to the top-level frame
+static void resolve(const Symbol &x, const ScopePtr &scope, int &depth, int &slot) {
+    depth = 0;
+    for (Scope *cur = scope.get(); cur != nullptr; cur = cur->parent.get(), depth++) {
+        slot = cur->slot(x);
+        if (slot >= 0) return;
+    }
+    slot = -1;
+}
+
+static bool is_local(const Symbol &x, const ScopePtr &scope) {
+    int depth, slot;
+    resolve(x, scope, depth, slot);
+    return slot >= 0;
+}
+
+static bool is_bound(const Symbol &x, const ScopePtr &scope, const EnvPtr &env) {
+    return is_local(x, scope) || global_binding(global_frame(env), x) != nullptr;
+}
+
+static bool is_special(const Var *head, ExprType type, const ScopePtr &scope, const EnvPtr &env) {
+    auto it = reserved_words.find(head->x);
+    return it != reserved_words.end() && it->second == type && !is_bound(head->x, scope, env);
+}
+
+// Collects the names defined by form into the frame described by scope,
+// without descending into forms that evaluate in a frame of their own
+static void scanDefines(const Expr &form, const ScopePtr &scope, const EnvPtr &env) {
+    if (form->e_type != E_SLIST) return;
+    const auto &terms = static_cast<SList*>(form.get())->terms;
+    if (terms.empty()) return;
+    auto begin = terms.begin() + 1;
+    auto head = dynamic_cast<Var*>(terms[0].get());
+    if (head != nullptr) {
+        if (is_special(head, E_QUOTE, scope, env) || is_special(head, E_LAMBDA, scope, env) ||
+            is_special(head, E_LETREC, scope, env)) {
+            return;
+        }
+        if (is_special(head, E_DEFINE, scope, env)) {
+            if (terms.size() < 2) return;
+            Var *name = dynamic_cast<Var*>(terms[1].get());
+            auto sig = dynamic_cast<SList*>(terms[1].get());
+            if (name == nullptr && sig != nullptr && !sig->terms.empty()) name = dynamic_cast<Var*>(sig->terms[0].get());
+            if (name != nullptr && scope->slot(name->x) < 0) scope->names.push_back(name->x);
+            if (sig != nullptr) return;     // the body runs in the procedure's frame
+            begin = terms.begin() + 2;
+        } else if (is_special(head, E_LET, scope, env)) {
+            // Only the inits run in this frame
+            auto bind = terms.size() > 1 ? dynamic_cast<SList*>(terms[1].get()) : nullptr;
+            if (bind == nullptr) return;
+            for (const auto &b : bind->terms) {
+                auto y = dynamic_cast<SList*>(b.get());
+                if (y != nullptr && y->terms.size() == 2) scanDefines(y->terms[1], scope, env);
+            }
+            return;
+        }
+    }
+    for (auto it = begin; it != terms.end(); ++it) scanDefines(*it, scope, env);
+}
+
+// Scope of a new frame binding names, extended with what forms define
+static ScopePtr frameScope(const vector<Symbol> &names, vector<Expr>::const_iterator begin,
+                           vector<Expr>::const_iterator end, const ScopePtr &parent, const EnvPtr &env) {
+    ScopePtr inner = std::make_shared<Scope>(names, parent);
+    for (auto it = begin; it != end; ++it) scanDefines(*it, inner, env);
+    return inner;
+}
+
+static vector<Expr> analyzeAll(vector<Expr>::const_iterator begin, vector<Expr>::const_iterator end,
+                               const ScopePtr &scope, const EnvPtr &env) {
+    vector<Expr> res;
+    res.reserve(end - begin);
+    std::transform(begin, end, std::back_inserter(res), [&](const Expr &x) {
+        return analyze(x, scope, env);
+    });
+    return res;
+}
+
+// Whether evaluating an analyzed node does nothing but produce its value
+static bool isPure(const Expr &node) {
+    switch (node->e_type) {
+        case E_FIXNUM: case E_BOOLEAN: case E_STRING: case E_BIGNUM: case E_RATIONAL: case E_LAMBDA:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Drops what a sequence evaluates only to discard, when that has no effect
+static vector<Expr> sequence(vector<Expr> es) {
+    if (es.size() > 1) es.erase(std::remove_if(es.begin(), es.end() - 1, isPure), es.end() - 1);
+    return es;
+}
+
+static Expr analyzeBody(vector<Expr>::const_iterator begin, vector<Expr>::const_iterator end,
+                        const ScopePtr &scope, const EnvPtr &env) {
+    return Expr(new Begin(sequence(analyzeAll(begin, end, scope, env))));
+}
+
+// Value of an analyzed node known before it runs, adding to deps the names
+// it relies on; false if it is not a constant
+static bool constantValue(const Expr &node, Expr &value, vector<Symbol> &deps) {
+    switch (node->e_type) {
+        case E_FIXNUM: case E_BOOLEAN: case E_STRING: case E_BIGNUM: case E_RATIONAL:
+            value = node->eval(nullptr);
+            return true;
+        case E_QUOTE:
+            value = static_cast<Quote*>(node.get())->ex;
+            return true;
+        case E_GUARD:
+        {
+            auto g = static_cast<Guard*>(node.get());
+            vector<Symbol> used(g->names);
+            if (!constantValue(g->fast, value, used)) return false;
+            deps.insert(deps.end(), used.begin(), used.end());
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Primitives whose result depends only on their arguments and is not a
+// fresh object the program could mutate
+static bool isFoldable(ExprType type) {
+    switch (type) {
+        case E_PLUS: case E_MINUS: case E_MUL: case E_DIV: case E_MODULO:
+        case E_LT: case E_LE: case E_EQ: case E_GE: case E_GT:
+        case E_NOT: case E_AND: case E_OR:
+        case E_EQQ: case E_EQUALQ: case E_BOOLQ: case E_INTQ: case E_NULLQ: case E_PAIRQ:
+        case E_PROCQ: case E_SYMBOLQ: case E_LISTQ: case E_STRINGQ:
+        case E_VECTORQ: case E_FXVECTORQ: case E_HASHTABLEQ: case E_FUTUREQ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The value of (type rand...) as a Quote when every rand is a constant, else null
+static Expr fold(ExprType type, const vector<Expr> &rand, vector<Symbol> &deps) {
+    if (!isFoldable(type)) return Expr(nullptr);
+    vector<Expr> args;
+    vector<Symbol> used;
+    for (const Expr &x : rand) {
+        Expr v(nullptr);
+        if (!constantValue(x, v, used)) return Expr(nullptr);
+        args.push_back(v);
+    }
+    try {
+        Expr v = applyPrimitive(type, args);
+        deps.insert(deps.end(), used.begin(), used.end());
+        return Expr(new Quote(v));
+    } catch (const RuntimeError &) {
+        // Left for evaluation to raise, if it gets there
+        return Expr(nullptr);
+    }
+}
+
+static Symbol varName(const Expr &x, const char *err) {
+    auto v = dynamic_cast<Var*>(x.get());
+    if (v == nullptr) throw(RuntimeError(err));
+    if (!is_valid_var(v->x.str())) throw(RuntimeError("not a valid variable name!"));
+    return v->x;
+}
+
+static vector<Symbol> paramNames(vector<Expr>::const_iterator begin, vector<Expr>::const_iterator end) {
+    vector<Symbol> paras;
+    std::transform(begin, end, std::back_inserter(paras), [](const Expr &x) {
+        return varName(x, "lambda parameter is not Var");
+    });
+    return paras;
+}
+
+static vector<pair<Symbol, Expr>> bindingList(const Expr &x, const char *form) {
+    auto pairList = dynamic_cast<SList*>(x.get());
+    if (pairList == nullptr) throw(RuntimeError("let takes a list as the 1st parameter"));
+    vector<pair<Symbol, Expr>> result;
+    for (const auto &b : pairList->terms) {
+        auto y = dynamic_cast<SList*>(b.get());
+        if (y == nullptr || y->terms.size() != 2 || y->terms[0]->e_type != E_VAR) {
+            throw(RuntimeError(string("Wrong form of arguments for ") + form));
+        }
+        result.emplace_back(varName(y->terms[0], ""), y->terms[1]);
+    }
+    return result;
+}
+
+static vector<Symbol> namesOf(const vector<pair<Symbol, Expr>> &bind) {
+    vector<Symbol> names;
+    for (const auto &b : bind) names.push_back(b.first);
+    return names;
+}
+
+static vector<pair<int, Expr>> slotBindings(const vector<pair<Symbol, Expr>> &bind, const ScopePtr &inner) {
+    vector<pair<int, Expr>> result;
+    for (const auto &b : bind) result.emplace_back(inner->slot(b.first), b.second);
+    return result;
+}
+
+static int defineSlot(const Symbol &x, const ScopePtr &scope) {
+    if (scope == nullptr) return -1;
+    int slot = scope->slot(x);
+    if (slot < 0) throw(RuntimeError("define is not allowed in this context"));
+    return slot;
+}
+
+static Expr analyzeCond(const vector<Expr> &rand, const ScopePtr &scope, const EnvPtr &env, vector<Symbol> &deps) {
+    vector<CondClause> clauses;
+    for (size_t i = 0; i < rand.size(); i++) {
+        CondClause c{Expr(nullptr), Expr(nullptr)};
+        auto list = dynamic_cast<SList*>(rand[i].get());
+        if (list == nullptr || list->terms.empty()) {
+            // Evaluating only a test that raises keeps the error on this clause
+            c.test = Expr(new BadForm(list == nullptr ? "Wrong form of arguments for cond"
+                                                      : "Wrong number of arguments for cond"));
+            clauses.push_back(c);
+            continue;
+        }
+        const auto &terms = list->terms;
+        bool last = i + 1 == rand.size();
+        static const Symbol else_sym("else");
+        auto v = dynamic_cast<Var*>(terms[0].get());
+        bool is_else = last && terms.size() > 1 && v != nullptr && v->x == else_sym && !is_bound(else_sym, scope, env);
+        if (!is_else) c.test = analyze(terms[0], scope, env);
+        if (terms.size() > 1) c.body = analyzeBody(terms.begin() + 1, terms.end(), scope, env);
+        Expr value(nullptr);
+        bool constant = is_else || constantValue(c.test, value, deps);
+        // A clause never taken goes; one always taken ends the cond. Without a
+        // body, the clause is taken whatever its test gives
+        if (constant && !is_else && !c.body.null() && is_false(value)) continue;
+        if (constant && clauses.empty()) return c.body.null() ? c.test : c.body;
+        clauses.push_back(c);
+        if (constant) break;
+    }
+    // As when no test holds
+    if (clauses.empty() && !rand.empty()) return Expr(new Quote(EmptyE()));
+    return Expr(new Cond(clauses));
+}
+
+// Names an analyzed lambda after the variable it is bound to, for the profiler
+static Expr named(const Expr &e, const Symbol &name) {
+    Expr node = e->e_type == E_GUARD ? static_cast<Guard*>(e.get())->fast : e;
+    if (node->e_type == E_LAMBDA) static_cast<Lambda*>(node.get())->name = name;
+    return e;
+}
+
+static Expr analyzeDefine(const vector<Expr> &rand, const ScopePtr &scope, const EnvPtr &env) {
+    if (rand.empty()) throw(RuntimeError("Wrong number of arguments for define"));
+    if (rand.size() == 2 && rand[0]->e_type == E_VAR) {
+        Symbol variable = varName(rand[0], "");
+        return Expr(new Define(variable, defineSlot(variable, scope), named(analyze(rand[1], scope, env), variable)));
+    }
+    auto VarsList = dynamic_cast<SList*>(rand[0].get());
+    if (VarsList == nullptr) throw(RuntimeError("define takes a Var or list as the 1st parameter"));
+    const auto &Vars = VarsList->terms;
+    if (Vars.empty() || Vars[0]->e_type != E_VAR) throw(RuntimeError("function name in Define is not valid"));
+    Symbol variable = varName(Vars[0], "");
+    vector<Symbol> paras = paramNames(Vars.begin() + 1, Vars.end());
+    int slot = defineSlot(variable, scope);
+    ScopePtr inner = frameScope(paras, rand.begin() + 1, rand.end(), scope, env);
+    unsigned long before = closures;
+    Expr body = analyzeBody(rand.begin() + 1, rand.end(), inner, env);
+    bool reclaimable = closures++ == before;
+    return Expr(new Define_f(variable, slot, paras, body, inner->names.size(), vector<Expr>(rand.begin() + 1, rand.end()), scope,
+                             reclaimable));
+}
+
+// Specializes (name rand...) for a special form; throws on malformed syntax
+static Expr specialForm(ExprType type, const vector<Expr> &rand, const ScopePtr &scope, const EnvPtr &env,
+                        vector<Symbol> &deps) {
+    switch (type) {
+        // Control flow constructs
+        case E_BEGIN:
+            return Expr(new Begin(sequence(analyzeAll(rand.begin(), rand.end(), scope, env))));
+        case E_QUOTE:
+            if (rand.size() != 1) throw(RuntimeError("Wrong number of arguments for quote"));
+            return Expr(new Quote(Quoted(rand[0])));
+        // Conditional
+        case E_IF:
+        {
+            if (rand.size() != 3) throw(RuntimeError("Wrong number of arguments for if"));
+            Expr test = analyze(rand[0], scope, env), v(nullptr);
+            if (constantValue(test, v, deps)) return analyze(is_false(v) ? rand[2] : rand[1], scope, env);
+            return Expr(new If(test, analyze(rand[1], scope, env), analyze(rand[2], scope, env)));
+        }
+        case E_COND:
+            return analyzeCond(rand, scope, env, deps);
+        // Variables and function definition
+        case E_LAMBDA:
+        {
+            if (rand.size() < 2) throw(RuntimeError("Wrong number of arguments for lambda"));
+            auto VarsList = dynamic_cast<SList*>(rand[0].get());
+            if (VarsList == nullptr) throw(RuntimeError("lambda takes a list as the 1st parameter"));
+            vector<Symbol> paras = paramNames(VarsList->terms.begin(), VarsList->terms.end());
+            ScopePtr inner = frameScope(paras, rand.begin() + 1, rand.end(), scope, env);
+            unsigned long before = closures;
+            Expr body = analyzeBody(rand.begin() + 1, rand.end(), inner, env);
+            bool reclaimable = closures++ == before;
+            return Expr(new Lambda(paras, body, inner->names.size(), vector<Expr>(rand.begin() + 1, rand.end()), scope,
+                                   reclaimable));
+        }
+        case E_DEFINE:
+            return analyzeDefine(rand, scope, env);
+        // Binding constructs
+        case E_LET:
+        {
+            if (rand.size() < 2) throw(RuntimeError("Wrong number of arguments for let"));
+            auto bind = bindingList(rand[0], "let");
+            for (auto &b : bind) b.second = named(analyze(b.second, scope, env), b.first);
+            ScopePtr inner = frameScope(namesOf(bind), rand.begin() + 1, rand.end(), scope, env);
+            unsigned long before = closures;
+            Expr body = analyzeBody(rand.begin() + 1, rand.end(), inner, env);
+            return Expr(new Let(slotBindings(bind, inner), body, inner->names.size(), closures == before));
+        }
+        case E_LETREC:
+        {
+            if (rand.size() < 2) throw(RuntimeError("Wrong number of arguments for letrec"));
+            auto bind = bindingList(rand[0], "letrec");
+            ScopePtr inner = frameScope(namesOf(bind), rand.begin() + 1, rand.end(), scope, env);
+            for (const auto &b : bind) scanDefines(b.second, inner, env);
+            unsigned long before = closures;
+            for (auto &b : bind) b.second = named(analyze(b.second, inner, env), b.first);
+            Expr body = analyzeBody(rand.begin() + 1, rand.end(), inner, env);
+            return Expr(new Letrec(slotBindings(bind, inner), body, inner->names.size(), closures == before));
+        }
+        // Assignment
+        case E_SET:
+            if (rand.size() != 2) throw(RuntimeError("Wrong number of arguments for set!"));
+        {
+            if (rand[0]->e_type != E_VAR) throw(RuntimeError("set! takes a Var as the 1st parameter"));
+            Symbol variable = varName(rand[0], "");
+            int depth, slot;
+            resolve(variable, scope, depth, slot);
+            return Expr(new Set(variable, depth, slot, analyze(rand[1], scope, env)));
+        }
+        // Parallelism
+        case E_MAKEFUTURE:
+            if (rand.size() != 1) throw(RuntimeError("Wrong number of arguments for future"));
+            closures++;
+            return Expr(new MakeFuture(analyze(rand[0], scope, env)));
+        default:
+            throw(RuntimeError("Unknown reserved word"));
+    }
+}
+
+static void arity(bool ok, const char *name) {
+    if (!ok) throw(RuntimeError(string("Wrong number of arguments for ") + name));
+}
+
+// Specializes (name rand...) for a primitive; throws on a wrong argument count
+static Expr primitiveForm(ExprType type, const vector<Expr> &rand) {
+    switch (type) {
+        // Arithmetic operations
+        // Two operands get a dedicated node, with a fixnum kernel where there is one
+        case E_PLUS: return rand.size() == 2 ? Expr(new Plus(rand[0], rand[1])) : Expr(new PlusVar(rand));
+        case E_MINUS:
+            arity(rand.size() >= 1, "-");
+            return rand.size() == 2 ? Expr(new Minus(rand[0], rand[1])) : Expr(new MinusVar(rand));
+        case E_MUL: return rand.size() == 2 ? Expr(new Mult(rand[0], rand[1])) : Expr(new MultVar(rand));
+        case E_DIV:
+            arity(rand.size() >= 1, "/");
+            return rand.size() == 2 ? Expr(new Div(rand[0], rand[1])) : Expr(new DivVar(rand));
+        case E_MODULO: arity(rand.size() == 2, "modulo"); return Expr(new Modulo(rand[0], rand[1]));
+        case E_EXPT: arity(rand.size() == 2, "expt"); return Expr(new Expt(rand[0], rand[1]));
+        // Comparison operations
+        case E_LT: return rand.size() == 2 ? Expr(new Less(rand[0], rand[1])) : Expr(new LessVar(rand));
+        case E_LE: return rand.size() == 2 ? Expr(new LessEq(rand[0], rand[1])) : Expr(new LessEqVar(rand));
+        case E_EQ: return rand.size() == 2 ? Expr(new Equal(rand[0], rand[1])) : Expr(new EqualVar(rand));
+        case E_GE: return rand.size() == 2 ? Expr(new GreaterEq(rand[0], rand[1])) : Expr(new GreaterEqVar(rand));
+        case E_GT: return rand.size() == 2 ? Expr(new Greater(rand[0], rand[1])) : Expr(new GreaterVar(rand));
+        // Logic operations
+        case E_NOT: arity(rand.size() == 1, "not"); return Expr(new Not(rand[0]));
+        case E_AND: return Expr(new AndVar(rand));
+        case E_OR: return Expr(new OrVar(rand));
+        // List operations
+        case E_CONS: arity(rand.size() == 2, "cons"); return Expr(new Cons(rand[0], rand[1]));
+        case E_CAR: arity(rand.size() == 1, "car"); return Expr(new Car(rand[0]));
+        case E_CDR: arity(rand.size() == 1, "cdr"); return Expr(new Cdr(rand[0]));
+        case E_LIST: return Expr(new ListFunc(rand));
+        case E_SETCAR: arity(rand.size() == 2, "set-car!"); return Expr(new SetCar(rand[0], rand[1]));
+        case E_SETCDR: arity(rand.size() == 2, "set-cdr!"); return Expr(new SetCdr(rand[0], rand[1]));
+        // Vector operations
+        case E_VECTORFUNC: return Expr(new VectorFunc(rand));
+        case E_MAKEVECTOR: arity(rand.size() == 1 || rand.size() == 2, "make-vector"); return Expr(new MakeVector(rand));
+        case E_VECTORQ: arity(rand.size() == 1, "vector?"); return Expr(new IsVector(rand[0]));
+        case E_VECTORLENGTH: arity(rand.size() == 1, "vector-length"); return Expr(new VectorLength(rand[0]));
+        case E_VECTORREF: arity(rand.size() == 2, "vector-ref"); return Expr(new VectorRef(rand[0], rand[1]));
+        case E_VECTORSET: arity(rand.size() == 3, "vector-set!"); return Expr(new VectorSet(rand));
+        case E_VECTORFILL: arity(rand.size() == 2, "vector-fill!"); return Expr(new VectorFill(rand[0], rand[1]));
+        case E_VECTORTOLIST: arity(rand.size() == 1, "vector->list"); return Expr(new VectorToList(rand[0]));
+        case E_LISTTOVECTOR: arity(rand.size() == 1, "list->vector"); return Expr(new ListToVector(rand[0]));
+        // Fixnum vector operations
+        case E_MAKEFXVECTOR: arity(rand.size() == 1 || rand.size() == 2, "make-fxvector"); return Expr(new MakeFxVector(rand));
+        case E_LISTTOFXVECTOR: arity(rand.size() == 1, "list->fxvector"); return Expr(new ListToFxVector(rand[0]));
+        case E_FXVECTORQ: arity(rand.size() == 1, "fxvector?"); return Expr(new IsFxVector(rand[0]));
+        case E_FXVECTORSUM: arity(rand.size() == 1, "fxvector-sum"); return Expr(new FxVectorSum(rand[0]));
+        case E_FXVECTORADD: arity(rand.size() == 2, "fxvector-add"); return Expr(new FxVectorAdd(rand[0], rand[1]));
+        case E_FXVECTORMUL: arity(rand.size() == 2, "fxvector-mul"); return Expr(new FxVectorMul(rand[0], rand[1]));
+        case E_FXVECTOREQ: arity(rand.size() == 2, "fxvector=?"); return Expr(new FxVectorEq(rand[0], rand[1]));
+        // Hash table operations
+        case E_MAKEHASHTABLE: arity(rand.size() == 0, "make-hash-table"); return Expr(new MakeHashTable(false));
+        case E_MAKEEQUALHASHTABLE: arity(rand.size() == 0, "make-equal-hash-table"); return Expr(new MakeHashTable(true));
+        case E_HASHTABLEQ: arity(rand.size() == 1, "hash-table?"); return Expr(new IsHashTable(rand[0]));
+        case E_HASHREF: arity(rand.size() == 2 || rand.size() == 3, "hash-ref"); return Expr(new HashRef(rand));
+        case E_HASHSET: arity(rand.size() == 3, "hash-set!"); return Expr(new HashSet(rand));
+        case E_HASHREMOVE: arity(rand.size() == 2, "hash-remove!"); return Expr(new HashRemove(rand[0], rand[1]));
+        case E_HASHCOUNT: arity(rand.size() == 1, "hash-count"); return Expr(new HashCount(rand[0]));
+        // Futures
+        case E_TOUCH: arity(rand.size() == 1, "touch"); return Expr(new Touch(rand[0]));
+        case E_FUTUREQ: arity(rand.size() == 1, "future?"); return Expr(new IsFuture(rand[0]));
+        case E_DISPLAY: arity(rand.size() == 1, "display!"); return Expr(new Display(rand[0]));
+        // Type predicates
+        case E_EQQ: arity(rand.size() == 2, "eq?"); return Expr(new IsEq(rand[0], rand[1]));
+        case E_EQUALQ: arity(rand.size() == 2, "equal?"); return Expr(new IsEqual(rand[0], rand[1]));
+        case E_BOOLQ: arity(rand.size() == 1, "boolean?"); return Expr(new IsBoolean(rand[0]));
+        case E_INTQ: arity(rand.size() == 1, "number?"); return Expr(new IsFixnum(rand[0]));
+        case E_NULLQ: arity(rand.size() == 1, "null?"); return Expr(new IsNull(rand[0]));
+        case E_PAIRQ: arity(rand.size() == 1, "pair?"); return Expr(new IsPair(rand[0]));
+        case E_PROCQ: arity(rand.size() == 1, "procedure?"); return Expr(new IsProcedure(rand[0]));
+        case E_SYMBOLQ: arity(rand.size() == 1, "symbol?"); return Expr(new IsSymbol(rand[0]));
+        case E_LISTQ: arity(rand.size() == 1, "list?"); return Expr(new IsList(rand[0]));
+        case E_STRINGQ: arity(rand.size() == 1, "string?"); return Expr(new IsString(rand[0]));
+        // Special values and control
+        case E_VOID: arity(rand.size() == 0, "void"); return Expr(new MakeVoid());
+        case E_EXIT: arity(rand.size() == 0, "exit"); return Expr(new Exit());
+        // Introspection
+        case E_RUNTIME_STATS: arity(rand.size() == 0, "runtime-stats"); return Expr(new GetRuntimeStats());
+        default:
+            throw(RuntimeError("Unknown primitive"));
+    }
+}
+
+static Expr analyzeSpecialForm(ExprType type, const Expr &form, const ScopePtr &scope, const EnvPtr &env,
+                               vector<Symbol> &deps) {
+    std::lock_guard<std::recursive_mutex> guard(toplevel_lock);
+    const auto &terms = static_cast<SList*>(form.get())->terms;
+    try {
+        return specialForm(type, vector<Expr>(terms.begin() + 1, terms.end()), scope, env, deps);
+    } catch (const RuntimeError &RE) {
+        return Expr(new BadForm(RE.message()));
+    }
+}
+
+Expr analyzeSpecialForm(ExprType type, const Expr &form, const ScopePtr &scope, const EnvPtr &env) {
+    // Also called while evaluating, when a variable turns out to name a special form
+    vector<Symbol> deps;
+    Expr node = analyzeSpecialForm(type, form, scope, env, deps);
+    if (deps.empty()) return node;
+    return Expr(new Guard(deps, node, form, scope));
+}
+
+static Expr analyzePrimitive(ExprType type, const Expr &form, const ScopePtr &scope, const EnvPtr &env,
+                             vector<Symbol> &deps) {
+    const auto &terms = static_cast<SList*>(form.get())->terms;
+    try {
+        vector<Expr> rand = analyzeAll(terms.begin() + 1, terms.end(), scope, env);
+        Expr folded = fold(type, rand, deps);
+        return folded.null() ? primitiveForm(type, rand) : folded;
+    } catch (const RuntimeError &RE) {
+        return Expr(new BadForm(RE.message()));
+    }
+}
+
+// names with duplicates removed, the first kept in front
+static vector<Symbol> distinct(vector<Symbol> names) {
+    for (size_t i = 1; i < names.size(); i++) {
+        if (std::find(names.begin(), names.begin() + i, names[i]) != names.begin() + i) names.erase(names.begin() + i--);
+    }
+    return names;
+}
+
+Expr analyze(const Expr &e, const ScopePtr &scope, const EnvPtr &env) {
+    if (e->e_type == E_VAR) {
+        const Symbol &x = static_cast<Var*>(e.get())->x;
+        int depth, slot;
+        resolve(x, scope, depth, slot);
+        return Expr(new Var(x, depth, slot));
+    }
+    if (e->e_type != E_SLIST) return e;     // literals
+    const auto &terms = static_cast<SList*>(e.get())->terms;
+    if (terms.empty()) return Expr(new BadForm("Attempt to apply a non-procedure"));
+
+    auto head = dynamic_cast<Var*>(terms[0].get());
+    if (head != nullptr && !is_bound(head->x, scope, env)) {
+        vector<Symbol> names{head->x};
+        auto it = primitives.find(head->x);
+        if (it != primitives.end()) {
+            Expr fast = analyzePrimitive(it->second, e, scope, env, names);
+            return Expr(new Guard(distinct(names), fast, e, scope));
+        }
+        it = reserved_words.find(head->x);
+        if (it != reserved_words.end()) {
+            Expr fast = analyzeSpecialForm(it->second, e, scope, env, names);
+            return Expr(new Guard(distinct(names), fast, e, scope));
+        }
+    }
+    return Expr(new Apply(analyze(terms[0], scope, env), analyzeAll(terms.begin() + 1, terms.end(), scope, env), e, scope));
+}
+
+Expr analyze(const Expr &e, const EnvPtr &env) {
+    std::lock_guard<std::recursive_mutex> guard(toplevel_lock);
+    return analyze(e, nullptr, env);
+}
+
+Expr analyzeProcedureBody(const vector<Symbol> &paras, const vector<Expr> &source, const ScopePtr &scope,
+                          const EnvPtr &env, size_t &frame_size) {
+    std::lock_guard<std::recursive_mutex> guard(toplevel_lock);
+    ScopePtr inner = frameScope(paras, source.begin(), source.end(), scope, env);
+    frame_size = inner->names.size();
+    return analyzeBody(source.begin(), source.end(), inner, env);
+}
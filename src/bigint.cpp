@@ -0,0 +1,268 @@
+/**
+ * @file bigint.cpp
+ * @brief Arbitrary-precision integer arithmetic
+ */
+
+#include "bigint.hpp"
+#include <algorithm>
+
+BigInt::BigInt(int64_t v) : neg(v < 0) {
+    // Negate in unsigned arithmetic so INT64_MIN works too
+    uint64_t m = neg ? ~static_cast<uint64_t>(v) + 1 : static_cast<uint64_t>(v);
+    while (m != 0) {
+        mag.push_back(static_cast<uint32_t>(m));
+        m >>= 32;
+    }
+}
+
+bool BigInt::parse(const char *b, const char *e, BigInt &out) {
+    bool negative = false;
+    if (b != e && (*b == '+' || *b == '-')) {
+        negative = *b == '-';
+        b++;
+    }
+    if (b == e) return false;
+    BigInt r;
+    while (b != e) {
+        // Nine digits at a time fit a limb
+        uint32_t chunk = 0, scale = 1;
+        for (int i = 0; i < 9 && b != e; i++, b++) {
+            if (*b < '0' || *b > '9') return false;
+            chunk = chunk * 10 + (*b - '0');
+            scale *= 10;
+        }
+        uint64_t carry = chunk;
+        for (uint32_t &limb : r.mag) {
+            uint64_t t = static_cast<uint64_t>(limb) * scale + carry;
+            limb = static_cast<uint32_t>(t);
+            carry = t >> 32;
+        }
+        if (carry != 0) r.mag.push_back(static_cast<uint32_t>(carry));
+    }
+    r.trim();
+    r.neg = negative && !r.isZero();
+    out = r;
+    return true;
+}
+
+bool BigInt::fitsInt64() const {
+    if (mag.size() > 2) return false;
+    uint64_t m = 0;
+    for (size_t i = mag.size(); i-- > 0; ) m = (m << 32) | mag[i];
+    return neg ? m <= static_cast<uint64_t>(INT64_MAX) + 1 : m <= static_cast<uint64_t>(INT64_MAX);
+}
+
+int64_t BigInt::toInt64() const {
+    uint64_t m = 0;
+    for (size_t i = std::min<size_t>(mag.size(), 2); i-- > 0; ) m = (m << 32) | mag[i];
+    return neg ? static_cast<int64_t>(~m + 1) : static_cast<int64_t>(m);
+}
+
+std::string BigInt::toString() const {
+    if (isZero()) return "0";
+    Limbs m = mag;
+    std::string digits;
+    while (!m.empty()) {
+        uint32_t chunk = divModSmall(m, 1000000000);
+        for (int i = 0; i < 9; i++) {
+            digits.push_back('0' + chunk % 10);
+            chunk /= 10;
+            if (m.empty() && chunk == 0) break;
+        }
+    }
+    if (neg) digits.push_back('-');
+    std::reverse(digits.begin(), digits.end());
+    return digits;
+}
+
+void BigInt::trim() {
+    while (!mag.empty() && mag.back() == 0) mag.pop_back();
+    if (mag.empty()) neg = false;
+}
+
+int BigInt::compareMag(const Limbs &a, const Limbs &b) {
+    if (a.size() != b.size()) return a.size() < b.size() ? -1 : 1;
+    for (size_t i = a.size(); i-- > 0; ) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+void BigInt::addMag(const Limbs &a, const Limbs &b, Limbs &out) {
+    const Limbs &x = a.size() >= b.size() ? a : b;
+    const Limbs &y = a.size() >= b.size() ? b : a;
+    Limbs r(x.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < x.size(); i++) {
+        uint64_t t = static_cast<uint64_t>(x[i]) + (i < y.size() ? y[i] : 0) + carry;
+        r[i] = static_cast<uint32_t>(t);
+        carry = t >> 32;
+    }
+    r[x.size()] = static_cast<uint32_t>(carry);
+    out.swap(r);
+}
+
+void BigInt::subMag(const Limbs &a, const Limbs &b, Limbs &out) {
+    Limbs r(a.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        int64_t t = static_cast<int64_t>(a[i]) - (i < b.size() ? b[i] : 0) - borrow;
+        borrow = t < 0;
+        r[i] = static_cast<uint32_t>(t + (borrow << 32));
+    }
+    out.swap(r);
+}
+
+void BigInt::mulMag(const Limbs &a, const Limbs &b, Limbs &out) {
+    Limbs r(a.size() + b.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < b.size(); j++) {
+            uint64_t t = static_cast<uint64_t>(a[i]) * b[j] + r[i + j] + carry;
+            r[i + j] = static_cast<uint32_t>(t);
+            carry = t >> 32;
+        }
+        r[i + b.size()] = static_cast<uint32_t>(carry);
+    }
+    out.swap(r);
+}
+
+uint32_t BigInt::divModSmall(Limbs &m, uint32_t d) {
+    uint64_t rem = 0;
+    for (size_t i = m.size(); i-- > 0; ) {
+        uint64_t t = (rem << 32) | m[i];
+        m[i] = static_cast<uint32_t>(t / d);
+        rem = t % d;
+    }
+    while (!m.empty() && m.back() == 0) m.pop_back();
+    return static_cast<uint32_t>(rem);
+}
+
+// Knuth, TAOCP vol. 2, 4.3.1, algorithm D; v has at least two limbs, u at least as many
+void BigInt::divModMag(const Limbs &u, const Limbs &v, Limbs &q, Limbs &r) {
+    size_t n = v.size(), m = u.size() - n;
+    int s = __builtin_clz(v[n - 1]);
+    // Normalize so the divisor's top bit is set
+    Limbs vn(n), un(u.size() + 1);
+    for (size_t i = n - 1; i > 0; i--) vn[i] = (v[i] << s) | (s ? static_cast<uint32_t>(static_cast<uint64_t>(v[i - 1]) >> (32 - s)) : 0);
+    vn[0] = v[0] << s;
+    un[u.size()] = s ? static_cast<uint32_t>(static_cast<uint64_t>(u[u.size() - 1]) >> (32 - s)) : 0;
+    for (size_t i = u.size() - 1; i > 0; i--) un[i] = (u[i] << s) | (s ? static_cast<uint32_t>(static_cast<uint64_t>(u[i - 1]) >> (32 - s)) : 0);
+    un[0] = u[0] << s;
+
+    const uint64_t base = 1ull << 32;
+    q.assign(m + 1, 0);
+    for (size_t j = m + 1; j-- > 0; ) {
+        uint64_t num = (static_cast<uint64_t>(un[j + n]) << 32) | un[j + n - 1];
+        uint64_t qhat = num / vn[n - 1], rhat = num % vn[n - 1];
+        while (qhat >= base || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >= base) break;
+        }
+        // Multiply and subtract
+        int64_t borrow = 0, t;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t p = qhat * vn[i];
+            t = static_cast<int64_t>(un[i + j]) - borrow - static_cast<int64_t>(p & 0xffffffff);
+            un[i + j] = static_cast<uint32_t>(t);
+            borrow = static_cast<int64_t>(p >> 32) - (t >> 32);
+        }
+        t = static_cast<int64_t>(un[j + n]) - borrow;
+        un[j + n] = static_cast<uint32_t>(t);
+        q[j] = static_cast<uint32_t>(qhat);
+        if (t < 0) {
+            // Subtracted too much: add the divisor back
+            q[j]--;
+            uint64_t carry = 0;
+            for (size_t i = 0; i < n; i++) {
+                uint64_t sum = static_cast<uint64_t>(un[i + j]) + vn[i] + carry;
+                un[i + j] = static_cast<uint32_t>(sum);
+                carry = sum >> 32;
+            }
+            un[j + n] += static_cast<uint32_t>(carry);
+        }
+    }
+    // Unnormalize the remainder
+    r.assign(n, 0);
+    for (size_t i = 0; i < n; i++) {
+        r[i] = (un[i] >> s) | (s ? static_cast<uint32_t>(static_cast<uint64_t>(un[i + 1]) << (32 - s)) : 0);
+    }
+}
+
+BigInt BigInt::operator-() const {
+    BigInt r = *this;
+    r.neg = !neg && !isZero();
+    return r;
+}
+
+BigInt BigInt::signedSum(const BigInt &a, const BigInt &b, bool negate_b) {
+    bool b_neg = negate_b ? !b.neg : b.neg;
+    BigInt r;
+    if (a.neg == b_neg) {
+        addMag(a.mag, b.mag, r.mag);
+        r.neg = a.neg;
+    } else if (compareMag(a.mag, b.mag) >= 0) {
+        subMag(a.mag, b.mag, r.mag);
+        r.neg = a.neg;
+    } else {
+        subMag(b.mag, a.mag, r.mag);
+        r.neg = b_neg;
+    }
+    r.trim();
+    return r;
+}
+
+BigInt operator+(const BigInt &a, const BigInt &b) {
+    return BigInt::signedSum(a, b, false);
+}
+
+BigInt operator-(const BigInt &a, const BigInt &b) {
+    return BigInt::signedSum(a, b, true);
+}
+
+BigInt operator*(const BigInt &a, const BigInt &b) {
+    BigInt r;
+    if (a.isZero() || b.isZero()) return r;
+    BigInt::mulMag(a.mag, b.mag, r.mag);
+    r.neg = a.neg != b.neg;
+    r.trim();
+    return r;
+}
+
+int compare(const BigInt &a, const BigInt &b) {
+    if (a.neg != b.neg) return a.neg ? -1 : 1;
+    int c = BigInt::compareMag(a.mag, b.mag);
+    return a.neg ? -c : c;
+}
+
+void BigInt::divMod(const BigInt &a, const BigInt &b, BigInt &quot, BigInt &rem) {
+    BigInt q, r;
+    if (compareMag(a.mag, b.mag) < 0) {
+        r = a;
+    } else if (b.mag.size() == 1) {
+        q.mag = a.mag;
+        uint32_t small = divModSmall(q.mag, b.mag[0]);
+        if (small != 0) r.mag.push_back(small);
+    } else {
+        divModMag(a.mag, b.mag, q.mag, r.mag);
+    }
+    // The quotient's sign is the product of the signs, the remainder's the dividend's
+    q.neg = a.neg != b.neg;
+    r.neg = a.neg;
+    q.trim();
+    r.trim();
+    quot = q;
+    rem = r;
+}
+
+BigInt BigInt::gcd(BigInt a, BigInt b) {
+    a.neg = b.neg = false;
+    while (!b.isZero()) {
+        BigInt q, r;
+        divMod(a, b, q, r);
+        a = b;
+        b = r;
+    }
+    return a;
+}
@@ -0,0 +1,54 @@
+#ifndef BIGINT_HPP
+#define BIGINT_HPP
+
+/**
+ * @file bigint.hpp
+ * @brief Arbitrary-precision integers for the numeric tower
+ *
+ * Sign and magnitude, the magnitude stored as base 2^32 limbs, least
+ * significant first and without leading zero limbs; zero has no limbs and is
+ * never negative. Only integers that do not fit a fixnum are held this way.
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class BigInt {
+public:
+    BigInt() : neg(false) {}
+    BigInt(int64_t);
+    static bool parse(const char *b, const char *e, BigInt &);   ///< Optional sign, then decimal digits
+
+    bool isZero() const { return mag.empty(); }
+    bool isNegative() const { return neg; }
+    bool fitsInt64() const;
+    int64_t toInt64() const;               ///< Only if fitsInt64()
+    std::string toString() const;
+    std::size_t bytes() const { return mag.capacity() * sizeof(uint32_t); }   ///< Memory the limbs take
+
+    BigInt operator-() const;
+    friend BigInt operator+(const BigInt &, const BigInt &);
+    friend BigInt operator-(const BigInt &, const BigInt &);
+    friend BigInt operator*(const BigInt &, const BigInt &);
+    friend int compare(const BigInt &, const BigInt &);   ///< -1, 0 or 1
+    /// Truncating division, as / and % on C++ integers; b must not be zero
+    static void divMod(const BigInt &a, const BigInt &b, BigInt &quot, BigInt &rem);
+    static BigInt gcd(BigInt, BigInt);     ///< Non-negative
+
+private:
+    using Limbs = std::vector<uint32_t>;
+    bool neg;
+    Limbs mag;
+
+    void trim();
+    static int compareMag(const Limbs &, const Limbs &);
+    static void addMag(const Limbs &, const Limbs &, Limbs &);
+    static void subMag(const Limbs &, const Limbs &, Limbs &);   ///< First operand not smaller
+    static void mulMag(const Limbs &, const Limbs &, Limbs &);
+    static uint32_t divModSmall(Limbs &, uint32_t);              ///< In place; returns the remainder
+    static void divModMag(const Limbs &, const Limbs &, Limbs &, Limbs &);
+    static BigInt signedSum(const BigInt &, const BigInt &, bool negate_b);
+};
+
+#endif
@@ -0,0 +1,20 @@
+/**
+ * @file budget.cpp
+ * @brief The errors for exceeded limits
+ */
+
+#include "budget.hpp"
+#include "RE.hpp"
+#include <cstdint>
+
+std::size_t max_steps = SIZE_MAX;
+__thread std::size_t steps_taken = 0;
+
+void budget_exceeded() {
+    if (gc_heap_exceeded) {
+        // Once per collection that found too much live
+        gc_heap_exceeded = false;
+        throw(RuntimeError("Heap limit exceeded"));
+    }
+    throw(RuntimeError("Step limit exceeded"));
+}
@@ -0,0 +1,40 @@
+#ifndef BUDGET_HPP
+#define BUDGET_HPP
+
+/**
+ * @file budget.hpp
+ * @brief --max-heap and --max-steps: limits on what one top-level form may use
+ *
+ * The evaluators call eval_safepoint() where they call gc_safepoint(): before
+ * each trampoline step in the tree walker and before each call or frame in
+ * the VM, so a loop or a recursion reaches it at every iteration. It fails
+ * the running form with a RuntimeError once the form has taken more than
+ * max_steps steps, or when a collection found the heap over gc_max_heap
+ * (gc.hpp). The error unwinds to the REPL, which reports it and goes on to
+ * the next form with its data no longer reachable.
+ *
+ * Steps are counted per thread and start again from zero with each top-level
+ * form and each future, so a future has a budget of its own and a form
+ * waiting in touch takes no steps meanwhile.
+ */
+
+#include "gc.hpp"
+#include <cstddef>
+
+extern std::size_t max_steps;              ///< --max-steps; SIZE_MAX for no limit
+extern __thread std::size_t steps_taken;   ///< By the form or future this thread runs
+
+[[noreturn]] void budget_exceeded();       ///< Throws RuntimeError for the limit reached
+
+inline void eval_safepoint() {
+    gc_safepoint();
+    if (++steps_taken > max_steps || gc_heap_exceeded) budget_exceeded();
+}
+
+/// Before a top-level form or a future: no steps taken, and only collections from now on count
+inline void budget_start() {
+    steps_taken = 0;
+    gc_heap_exceeded = false;
+}
+
+#endif
@@ -11,18 +11,21 @@
 #include "expr.hpp" 
 #include "RE.hpp"
 #include "syntax.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
+#include "output.hpp"
+#include "future.hpp"
+#include "budget.hpp"
 #include <cstring>
 #include <vector>
 #include <map>
 #include <climits>
-#include <numeric>
 #include <algorithm>
-#include <functional>
 #include <memory>
 #include <cctype>
 
-extern std::unordered_map<std::string, ExprType> primitives;
-extern std::unordered_map<std::string, ExprType> reserved_words;
+extern std::unordered_map<Symbol, ExprType> primitives;
+extern std::unordered_map<Symbol, ExprType> reserved_words;
 
 Expr self_evaluating::eval(const EnvPtr &) {
     return Expr(this);
@@ -37,8 +40,17 @@ Expr Binary::eval(const EnvPtr &e) { // evaluation of two-operators primitive
     return evalRator(rand1->eval(e), rand2->eval(e));
 }
 
+Expr NumericBinary::eval(const EnvPtr &e) {
+    Expr a = rand1->eval(e);
+    Expr b = rand2->eval(e);
+    Expr r(nullptr);
+    if (fixnumKernel(a, b, r)) return r;
+    return evalRator(a, b);
+}
+
 Expr Variadic::eval(const EnvPtr &e) { // evaluation of multi-operator primitive
     std::vector<Expr> results;
+    GcRoot root(results);
     results.reserve(rands.size());
     std::transform(rands.begin(), rands.end(), std::back_inserter(results), [&e](const Expr &x){return x->eval(e);});
     return evalRator(results);
@@ -52,318 +64,108 @@ Expr Var::eval(const EnvPtr &e) { // evaluation of variable
     //Variable names can contain any non-whitespace characters except #, ', ", `, but the first character cannot be a digit
     //When a variable is not defined in the current scope, your interpreter should output RuntimeError
     
-    Expr matched_Expr = find(x, e);
-    if (matched_Expr.get() == nullptr) {
-        if (primitives.count(x)) {
-            return PrimitiveE(primitives[x]);
-        }
-        else if (reserved_words.count(x)) {
-            return SpecialFormE(reserved_words[x]);
-        }
-        else {
-            throw(RuntimeError("undefined variable"));
+    Env *frame = e;
+    for (int i = 0; i < depth; i++) frame = frame->parent;
+    if (slot >= 0) {
+        const Expr &v = frame->slots[slot];
+        if (v.null()) throw(RuntimeError("undefined variable"));
+        stats_lookup(depth);
+        return v;
+    }
+
+    runtime_stats.global_lookups++;
+    if (cache_version.load(std::memory_order_acquire) == Env::version && cache_frame.load(std::memory_order_relaxed) == frame) {
+        return *cache.load(std::memory_order_relaxed);
+    }
+    return resolveGlobal(frame);
+}
+
+Expr Var::resolveGlobal(Env *frame) {
+    std::lock_guard<std::recursive_mutex> guard(toplevel_lock);
+    const Expr *value = global_binding(frame, x);
+    if (value == nullptr) {
+        if (builtin.null()) {
+            auto prim = primitives.find(x);
+            auto rw = reserved_words.find(x);
+            if (prim != primitives.end()) builtin = PrimitiveE(prim->second);
+            else if (rw != reserved_words.end()) builtin = SpecialFormE(rw->second);
+            else throw(RuntimeError("undefined variable"));
         }
+        value = &builtin;
     }
-    return matched_Expr;
+    cache.store(value, std::memory_order_relaxed);
+    cache_frame.store(frame, std::memory_order_relaxed);
+    cache_version.store(Env::version, std::memory_order_release);
+    return *value;
 }
 
 Expr Quoted(const Expr&e) {
     auto list = dynamic_cast<SList*>(e.get());
-    if (list == nullptr) return e;
-
-    auto terms = list->terms;
-    if (terms.size() >= 3) {
-        auto s = *(terms.rbegin() + 1);
-        auto ss = dynamic_cast<Var*>(s.get());
-        if (ss != nullptr && ss->x == ".") {
-            Expr ex = Quoted(*(terms.rbegin()));
-            return std::accumulate(
-            (terms.rbegin() + 2), terms.rend(), ex,
-            [](Expr tail, const Expr& x) {
-                return PairE(Quoted(x), tail);
-            });
+    if (list == nullptr) {
+        // Symbols stay as they are; number and boolean literals become immediates
+        return e->e_type == E_VAR ? e : e->eval(nullptr);
+    }
+
+    const auto &terms = list->terms;
+    size_t n = terms.size();
+    Expr tail = NullExprE();
+    if (n >= 3) {
+        static const Symbol dot(".");
+        auto ss = dynamic_cast<Var*>(terms[n - 2].get());
+        if (ss != nullptr && ss->x == dot) {
+            tail = Quoted(terms[n - 1]);
+            n -= 2;
         }
     }
 
-    Expr ex = NullExprE();
-    return std::accumulate(
-        terms.rbegin(), terms.rend(), ex,
-        [](Expr tail, const Expr& x) {
-            return PairE(Quoted(x), tail);
-        });
+    std::vector<Expr> items;
+    items.reserve(n);
+    std::transform(terms.begin(), terms.begin() + n, std::back_inserter(items), Quoted);
+    return ListE(items, tail);
 }
 
-Expr SList::eval(const EnvPtr &e) {
-    Expr p = terms[0]->eval(e);
-    if (p->e_type == E_PROC) {
-        Procedure* clos_ptr = static_cast<Procedure*>(p.get());
-        std::vector<Expr> args;
-        std::transform(
-            terms.begin() + 1, terms.end(), std::back_inserter(args),
-            [&e](Expr x){
-                return x->eval(e);
-            }
-        );
-        return (Expr(new Apply(p, args)))->eval(e);
-    } else if (p->e_type == E_PRIMITIVE) {
-        auto op = static_cast<Primitive*>(p.get());
-        auto rand = std::vector<Expr>(terms.begin() + 1, terms.end());
-        switch (op->type)
-        {
-            case E_PLUS:
-            return Expr(new PlusVar(rand))->eval(e);
-            case E_MINUS:
-            return rand.size() >= 1 ? Expr(new MinusVar(rand))->eval(e): throw RuntimeError("Wrong number of arguments for -");
-            case E_MUL:
-            return Expr(new MultVar(rand))->eval(e);
-            case E_DIV:
-            return rand.size() >= 1 ? Expr(new DivVar(rand))->eval(e): throw RuntimeError("Wrong number of arguments for /");
-            case E_MODULO:
-            return rand.size() == 2 ? Expr(new Modulo(rand[0], rand[1]))->eval(e): throw RuntimeError("Wrong number of arguments for modulo");
-            case E_EXPT:
-            return rand.size() == 2 ? Expr(new Expt(rand[0], rand[1]))->eval(e): throw RuntimeError("Wrong number of arguments for expt");
-            // Comparison operations
-            case E_LT:
-            return Expr(new LessVar(rand))->eval(e);
-            case E_LE:
-            return Expr(new LessEqVar(rand))->eval(e);
-            case E_EQ: 
-            return Expr(new EqualVar(rand))->eval(e);
-            case E_GE: 
-            return Expr(new GreaterEqVar(rand))->eval(e);
-            case E_GT: 
-            return Expr(new GreaterVar(rand))->eval(e);
-            // Logic operations
-            case E_NOT:
-            return rand.size() == 1 ? Expr(new Not(rand[0]))->eval(e): throw RuntimeError("Wrong number of arguments for not");
-            case E_AND:
-            return Expr(new AndVar(rand))->eval(e);
-            case E_OR:
-            return Expr(new OrVar(rand))->eval(e);
-            // List operations
-            case E_CONS:
-            return rand.size() == 2 ? Expr(new Cons(rand[0], rand[1]))->eval(e): throw RuntimeError("Wrong number of arguments for cons");
-            case E_CAR:
-            return rand.size() == 1 ? Expr(new Car(rand[0]))->eval(e) : throw RuntimeError("Wrong number of arguments for car");
-            case E_CDR:
-            return rand.size() == 1 ? Expr(new Cdr(rand[0]))->eval(e) : throw RuntimeError("Wrong number of arguments for cdr");
-            case E_LIST:
-            return Expr(new ListFunc(rand))->eval(e);
-            case E_SETCAR:
-            {
-                if (rand.size() != 2) throw(RuntimeError("Wrong number of arguments for set-car!"));
-                return Expr(new SetCar(rand[0], rand[1]))->eval(e);
-            }
-            case E_SETCDR:
-            {
-                if (rand.size() != 2) throw(RuntimeError("Wrong number of arguments for set-cdr!"));
-                return Expr(new SetCdr(rand[0], rand[1]))->eval(e);
-            }
-            case E_DISPLAY:
-            {
-                if (rand.size() != 1) throw(RuntimeError("Wrong number of arguments for display!"));
-                return Expr(new Display(rand[0]))->eval(e);
-            }
-            // Type predicates
-            case E_EQQ:
-            return rand.size() == 2 ? Expr(new IsEq(rand[0], rand[1]))->eval(e): throw RuntimeError("Wrong number of arguments for eq?");
-            case E_BOOLQ:
-            return rand.size() == 1 ? Expr(new IsBoolean(rand[0]))->eval(e): throw RuntimeError("Wrong number of arguments for boolean?");
-            case E_INTQ:
-            return rand.size() == 1 ? Expr(new IsFixnum(rand[0]))->eval(e): throw RuntimeError("Wrong number of arguments for number??");
-            case E_NULLQ:
-            return rand.size() == 1 ? Expr(new IsNull(rand[0]))->eval(e): throw RuntimeError("Wrong number of arguments for null?");
-            case E_PAIRQ:
-            return rand.size() == 1 ? Expr(new IsPair(rand[0]))->eval(e): throw RuntimeError("Wrong number of arguments for pair?");
-            case E_PROCQ:
-            return rand.size() == 1 ? Expr(new IsProcedure(rand[0]))->eval(e): throw RuntimeError("Wrong number of arguments for procedure?");
-            case E_SYMBOLQ:
-            return rand.size() == 1 ? Expr(new IsSymbol(rand[0]))->eval(e): throw RuntimeError("Wrong number of arguments for Var?");
-            case E_LISTQ: 
-            return rand.size() == 1 ? Expr(new IsList(rand[0]))->eval(e): throw RuntimeError("Wrong number of arguments for list?");
-            case E_STRINGQ:
-            return rand.size() == 1 ? Expr(new IsString(rand[0]))->eval(e): throw RuntimeError("Wrong number of arguments for string?");
-            // Special Exprs and control
-            case E_VOID:
-            return rand.size() == 0 ? Expr(new MakeVoid())->eval(e): throw RuntimeError("Wrong number of arguments for void");
-            case E_EXIT:
-            return rand.size() == 0 ? Expr(new Exit())->eval(e): throw RuntimeError("Wrong number of arguments for exit");
-            default:
-                break;
-        }
-    }
-    else if (p->e_type == E_SPECIALFORM) {
-        auto op = static_cast<SpecialForm*>(p.get());
-        auto rand = std::vector<Expr>(terms.begin() + 1, terms.end());
-        switch (op->type) { 
-            // Control flow constructs
-            case E_BEGIN:
-            return Expr(new Begin(rand))->eval(e);
-            case E_QUOTE:
-            {
-            return rand.size() == 1 ? Quoted(rand[0]): throw RuntimeError("Wrong number of arguments for quote");
-            }
-            //Conditional
-            case E_IF:
-            return rand.size() == 3 ? Expr(new If(rand[0], rand[1], rand[2]))->eval(e) : throw RuntimeError("Wrong number of arguments for if");
-            case E_COND:
-            return Expr(new Cond(rand))->eval(e);
-            // Variables and function definition
-            case E_LAMBDA:
-            {
-                if (rand.size() < 2) throw(RuntimeError("Wrong number of arguments for lambda"));
-                std::vector<std::string> paras;
-                auto VarsList = dynamic_cast<SList*>(rand[0].get());
-                if (VarsList == nullptr) throw(RuntimeError("lambda takes a list as the 1st parameter"));
-                auto Vars = VarsList->terms;
-                std::transform(Vars.begin(), Vars.end(), std::back_inserter(paras),[](Expr x) {
-                    auto y = dynamic_cast<Var*>(x.get()); 
-                    if (y == nullptr) throw(RuntimeError("lambda parameter is not Var"));
-                    return y->x;
-                });
-                auto res = std::vector<Expr>(rand.begin() + 1, rand.end());
-                return Expr(new Lambda(paras, Expr(new Begin(res))))->eval(e);
-            }
-            case E_DEFINE:
-            {
-                if (rand.size() == 2) {
-                auto var = dynamic_cast<Var*>(rand[0].get());
-                // call Define
-                if (var != nullptr) {
-                    std::string variable = var->x;
-                    //if (primitives.count(variable) || reserved_words.count(variable)) throw(RuntimeError("variable names can't be primitives or reserve_words"));
-                    return Expr(new Define(variable, rand[1]))->eval(e);
-                }
-            }
-                // call Define_f
-                auto VarsList = dynamic_cast<SList*>(rand[0].get());
-                if (VarsList == nullptr) throw(RuntimeError("define takes a Var or list as the 1st parameter"));
-                auto Vars = VarsList->terms;
-
-                auto function_name = dynamic_cast<Var*>(Vars[0].get());
-                if (function_name == nullptr) throw(RuntimeError("function name in Define is not valid"));
-                std::string variable = function_name->x;
-                //if (primitives.count(variable) || reserved_words.count(variable)) throw(RuntimeError("variable names can't be primitives or reserve_words"));
-
-                std::vector<std::string> paras;
-                if (Vars.size() != 1){
-                std::transform(Vars.begin() + 1, Vars.end(), std::back_inserter(paras),[](Expr x) {
-                    auto y = dynamic_cast<Var*>(x.get()); 
-                    if (y == nullptr) throw(RuntimeError("lambda parameter is not Var"));
-                    return y->x;
-                });
-            }
-                Expr body = rand[1];
-                auto res = std::vector<Expr>(rand.begin() + 1, rand.end());
-                return Expr(new Define_f(variable, paras, res))->eval(e);
-            }
-            // Binding constructs
-            case E_LET:
-            {
-                if (rand.size() < 2) throw(RuntimeError("Wrong number of arguments for let"));
-                auto pairList = dynamic_cast<SList*>(rand[0].get());
-                if (pairList == nullptr) throw(RuntimeError("let takes a list as the 1st parameter"));
-                auto pairs = pairList->terms;
-
-                std::vector<std::pair<std::string, Expr>> result;
-                std::transform(pairs.begin(), pairs.end(), std::back_inserter(result),[](Expr x) {
-                    auto y = dynamic_cast<SList*>(x.get()); 
-                    if (y != nullptr) {
-                        auto s = y->terms;
-                        if (s.size() == 2) {
-                            auto s1 = dynamic_cast<Var*>(s[0].get());
-                            auto s2 = s[1];
-                            if (s1 != nullptr) {
-                                return std::make_pair(s1->x, s2);
-                            }
-                        }
-                    }
-                    throw(RuntimeError("Wrong form of arguments for let"));
-                });
-
-                auto res = std::vector<Expr>(rand.begin() + 1, rand.end());
-                return Expr(new Let(result, res))->eval(e);
-            }
-            case E_LETREC:
-            {
-                if (rand.size() < 2) throw(RuntimeError("Wrong number of arguments for letrec"));
-                auto pairList = dynamic_cast<SList*>(rand[0].get());
-                if (pairList == nullptr) throw(RuntimeError("let takes a list as the 1st parameter"));
-                auto pairs = pairList->terms;
-
-                std::vector<std::pair<std::string, Expr>> result;
-                std::transform(pairs.begin(), pairs.end(), std::back_inserter(result),[](Expr x) {
-                    auto y = dynamic_cast<SList*>(x.get()); 
-                    if (y != nullptr) {
-                        auto s = y->terms;
-                        if (s.size() == 2) {
-                            auto s1 = dynamic_cast<Var*>(s[0].get());
-                            auto s2 = s[1];
-                            if (s1 != nullptr) {
-                                return std::make_pair(s1->x, s2);
-                            }
-                        }
-                    }
-                    throw(RuntimeError("Wrong form of arguments for letrec"));
-                });
-                auto res = std::vector<Expr>(rand.begin() + 1, rand.end());
-                return Expr(new Letrec(result, res))->eval(e);
-            }
-            // Assignment
-            case E_SET:
-            {
-                if (rand.size() != 2) throw(RuntimeError("Wrong number of arguments for set!"));
-                auto var = dynamic_cast<Var*>(rand[0].get());
-                // call Define
-                if (var != nullptr) {
-                    std::string variable = var->x;
-                    //if (primitives.count(variable) || reserved_words.count(variable)) throw(RuntimeError("variable names can't be primitives or reserve_words"));
-                    return Expr(new Set(variable, rand[1]))->eval(e);
-                }
-            }
-        	default:
-            	throw RuntimeError("Unknown reserved word: " + op->type);
-    	}
-    }
-    throw RuntimeError("Attempt to apply a non-procedure");    
+Expr SList::eval(const EnvPtr &) {
+    // Combinations are replaced by analyze() before evaluation
+    throw RuntimeError("Attempt to evaluate an unanalyzed combination");
 }
 
 bool isInt(const Expr &v) {
-    return v->e_type == E_FIXNUM;
+    return v.is_fixnum() || v.type() == E_BIGNUM;
 }
 
 bool isRat(const Expr &v) {
-    return v->e_type == E_RATIONAL;
+    return v.type() == E_RATIONAL;
 }
 
 bool isNum(const Expr &v) {
     return isInt(v) || isRat(v);
 }
-RationalNum toRational(const Expr& v) {
-    switch (v->e_type) {
-    case E_FIXNUM:
-        return RationalNum(*static_cast<Fixnum*>(v.get()));
-    case E_RATIONAL:
-        return *static_cast<RationalNum*>(v.get());
-    default:
-        throw std::runtime_error("Not a number");
+
+BigInt toBig(const Expr &v) {
+    if (v.is_fixnum()) return BigInt(v.fixnum());
+    return static_cast<Bignum*>(v.get())->n;
+}
+
+void toRational(const Expr &v, BigInt &num, BigInt &den) {
+    if (isRat(v)) {
+        RationalNum *r = static_cast<RationalNum*>(v.get());
+        num = r->numerator;
+        den = r->denominator;
+    } else {
+        num = toBig(v);
+        den = BigInt(1);
     }
 }
 
 Expr H_Plus(const Expr &rand1, const Expr &rand2) {
+    Expr r(nullptr);
+    if (Expr::addFixnums(rand1, rand2, r)) return r;
+    if (isInt(rand1) && isInt(rand2)) return IntegerE(toBig(rand1) + toBig(rand2));
     if (isNum(rand1) && isNum(rand2)) {
-        RationalNum addend1 = toRational(rand1);
-        RationalNum addend2 = toRational(rand2);
-        int numerator1 = addend1.numerator, denominator1 = addend1.denominator;
-        int numerator2 = addend2.numerator, denominator2 = addend2.denominator;
-        int numerator3 = numerator1 * denominator2 + denominator1 * numerator2;
-        int denominator3 = denominator1 * denominator2;
-        RationalNum ans(numerator3, denominator3);
-
-        if (ans.denominator == 1) {
-            return FixnumE(ans.numerator);
-        }
-        return RationalNumE(numerator3, denominator3);
+        BigInt n1, d1, n2, d2;
+        toRational(rand1, n1, d1);
+        toRational(rand2, n2, d2);
+        return RationalE(n1 * d2 + d1 * n2, d1 * d2);
     }
     throw(RuntimeError("Wrong typename"));
 }
@@ -373,19 +175,14 @@ Expr Plus::evalRator(const Expr &rand1, const Expr &rand2) { // +
 }
 
 Expr H_Minus(const Expr &rand1, const Expr &rand2) { // -
+    Expr r(nullptr);
+    if (Expr::subFixnums(rand1, rand2, r)) return r;
+    if (isInt(rand1) && isInt(rand2)) return IntegerE(toBig(rand1) - toBig(rand2));
     if (isNum(rand1) && isNum(rand2)) {
-        RationalNum addend1 = toRational(rand1);
-        RationalNum addend2 = toRational(rand2);
-        int numerator1 = addend1.numerator, denominator1 = addend1.denominator;
-        int numerator2 = addend2.numerator, denominator2 = addend2.denominator;
-        int numerator3 = numerator1 * denominator2 - denominator1 * numerator2;
-        int denominator3 = denominator1 * denominator2;
-        RationalNum ans(numerator3, denominator3);
-
-        if (ans.denominator == 1) {
-            return FixnumE(ans.numerator);
-        }
-        return RationalNumE(numerator3, denominator3);
+        BigInt n1, d1, n2, d2;
+        toRational(rand1, n1, d1);
+        toRational(rand2, n2, d2);
+        return RationalE(n1 * d2 - d1 * n2, d1 * d2);
     }
     throw(RuntimeError("Wrong typename"));
 }
@@ -395,19 +192,14 @@ Expr Minus::evalRator(const Expr &rand1, const Expr &rand2) { // -
 }
 
 Expr H_Mult(const Expr &rand1, const Expr &rand2) { // *
+    Expr r(nullptr);
+    if (Expr::mulFixnums(rand1, rand2, r)) return r;
+    if (isInt(rand1) && isInt(rand2)) return IntegerE(toBig(rand1) * toBig(rand2));
     if (isNum(rand1) && isNum(rand2)) {
-        RationalNum addend1 = toRational(rand1);
-        RationalNum addend2 = toRational(rand2);
-        int numerator1 = addend1.numerator, denominator1 = addend1.denominator;
-        int numerator2 = addend2.numerator, denominator2 = addend2.denominator;
-        int numerator3 = numerator1 * numerator2;
-        int denominator3 = denominator1 * denominator2;
-        RationalNum ans(numerator3, denominator3);
-
-        if (ans.denominator == 1) {
-            return FixnumE(ans.numerator);
-        }
-        return RationalNumE(numerator3, denominator3);
+        BigInt n1, d1, n2, d2;
+        toRational(rand1, n1, d1);
+        toRational(rand2, n2, d2);
+        return RationalE(n1 * n2, d1 * d2);
     }
     throw(RuntimeError("Wrong typename"));
 }
@@ -418,21 +210,18 @@ Expr Mult::evalRator(const Expr &rand1, const Expr &rand2) { // *
 
 Expr H_Div(const Expr &rand1, const Expr &rand2) { // /
     if (isNum(rand1) && isNum(rand2)) {
-        RationalNum addend1 = toRational(rand1);
-        RationalNum addend2 = toRational(rand2);
-        int numerator1 = addend1.numerator, denominator1 = addend1.denominator;
-        int numerator2 = addend2.numerator, denominator2 = addend2.denominator;
-        if (numerator2 == 0) {
+        if (rand2.is_fixnum() && rand2.fixnum() == 0) {
             throw(RuntimeError("Division by zero"));
         }
-        int numerator3 = numerator1 * denominator2;
-        int denominator3 = denominator1 * numerator2;
-        RationalNum ans(numerator3, denominator3);
-
-        if (ans.denominator == 1) {
-            return FixnumE(ans.numerator);
+        if (rand1.is_fixnum() && rand2.is_fixnum()) {
+            // Exact quotients stay fixnums; only FIXNUM_MIN / -1 leaves the range
+            intptr_t n1 = rand1.fixnum(), n2 = rand2.fixnum();
+            if (n1 % n2 == 0) return IntegerE(static_cast<int64_t>(n1 / n2));
         }
-        return RationalNumE(numerator3, denominator3);
+        BigInt n1, d1, n2, d2;
+        toRational(rand1, n1, d1);
+        toRational(rand2, n2, d2);
+        return RationalE(n1 * d2, d1 * n2);
     }
     throw(RuntimeError("Wrong typename"));
 }
@@ -442,104 +231,120 @@ Expr Div::evalRator(const Expr &rand1, const Expr &rand2) { // /
 }
 
 Expr Modulo::evalRator(const Expr &rand1, const Expr &rand2) { // modulo
-    if (rand1->e_type == E_FIXNUM && rand2->e_type == E_FIXNUM) {
-        int dividend = static_cast<Fixnum*>(rand1.get())->n;
-        int divisor = static_cast<Fixnum*>(rand2.get())->n;
-        if (divisor == 0) {
+    if (isInt(rand1) && isInt(rand2)) {
+        if (rand2.is_fixnum() && rand2.fixnum() == 0) {
             throw(RuntimeError("Division by zero"));
         }
-        return FixnumE(dividend % divisor);
+        if (rand1.is_fixnum() && rand2.is_fixnum()) {
+            return Expr::fromFixnum(rand1.fixnum() % rand2.fixnum());
+        }
+        BigInt q, r;
+        BigInt::divMod(toBig(rand1), toBig(rand2), q, r);
+        return IntegerE(r);
     }
     throw(RuntimeError("modulo is only defined for Fixnums"));
 }
 
+// The n-ary forms make one pass, adding fixnums in place until an operand
+// is not a fixnum or the sum overflows, and only then go generic
+
 Expr PlusVar::evalRator(const std::vector<Expr> &args) { // + with multiple args
-    return std::accumulate(args.begin(), args.end(), FixnumE(0), H_Plus);
+    Expr sum = FixnumE(0);
+    auto it = args.begin();
+    while (it != args.end() && Expr::addFixnums(sum, *it, sum)) ++it;
+    for (; it != args.end(); ++it) sum = H_Plus(sum, *it);
+    return sum;
 }
 
 Expr MinusVar::evalRator(const std::vector<Expr> &args) { // - with multiple args
     if (args.size() == 1) return H_Minus(FixnumE(0), args[0]);
-    return std::accumulate(args.begin() + 1, args.end(), args[0], H_Minus);
+    Expr diff = args[0];
+    auto it = args.begin() + 1;
+    while (it != args.end() && Expr::subFixnums(diff, *it, diff)) ++it;
+    for (; it != args.end(); ++it) diff = H_Minus(diff, *it);
+    return diff;
 }
 
 Expr MultVar::evalRator(const std::vector<Expr> &args) { // * with multiple args
-    return std::accumulate(args.begin(), args.end(), FixnumE(1), H_Mult);
+    Expr product = FixnumE(1);
+    auto it = args.begin();
+    while (it != args.end() && Expr::mulFixnums(product, *it, product)) ++it;
+    for (; it != args.end(); ++it) product = H_Mult(product, *it);
+    return product;
 }
 
 Expr DivVar::evalRator(const std::vector<Expr> &args) { // / with multiple args
     if (args.size() == 1) return H_Div(FixnumE(1), args[0]);
-    return std::accumulate(args.begin() + 1, args.end(), args[0], H_Div);
+    Expr quotient = args[0];
+    for (auto it = args.begin() + 1; it != args.end(); ++it) quotient = H_Div(quotient, *it);
+    return quotient;
 }
 
 Expr Expt::evalRator(const Expr &rand1, const Expr &rand2) { // expt
-    if (rand1->e_type == E_FIXNUM and rand2->e_type == E_FIXNUM) {
-        int base = dynamic_cast<Fixnum*>(rand1.get())->n;
-        int exponent = dynamic_cast<Fixnum*>(rand2.get())->n;
-        
-        if (exponent < 0) {
-            throw(RuntimeError("Negative exponent not supported for Fixnums"));
+    if (isInt(rand1) && isInt(rand2)) {
+        if (!rand2.is_fixnum() || rand2.fixnum() < 0) {
+            if (compare(toBig(rand2), BigInt(0)) < 0) {
+                throw(RuntimeError("Negative exponent not supported for Fixnums"));
+            }
+            // Only 0, 1 and -1 have powers this large that fit in memory
+            if (rand1.is_fixnum() && rand1.fixnum() >= -1 && rand1.fixnum() <= 1) {
+                if (rand1.fixnum() == -1) {
+                    BigInt q, r;
+                    BigInt::divMod(toBig(rand2), BigInt(2), q, r);
+                    return FixnumE(r.isZero() ? 1 : -1);
+                }
+                return rand1;
+            }
+            throw(RuntimeError("Exponent too large"));
         }
-        if (base == 0 && exponent == 0) {
+        intptr_t exponent = rand2.fixnum();
+        if (exponent == 0 && rand1.is_fixnum() && rand1.fixnum() == 0) {
             throw(RuntimeError("0^0 is undefined"));
         }
-        
-        long long result = 1;
-        long long b = base;
-        int exp = exponent;
-        
-        while (exp > 0) {
-            if (exp % 2 == 1) {
-                result *= b;
-                if (result > INT_MAX || result < INT_MIN) {
-                    throw(RuntimeError("Fixnum overflow in expt"));
-                }
-            }
-            b *= b;
-            if (b > INT_MAX || b < INT_MIN) {
-                if (exp > 1) {
-                    throw(RuntimeError("Fixnum overflow in expt"));
-                }
+
+        // Square and multiply in machine integers, starting over in BigInts
+        // if anything overflows
+        if (rand1.is_fixnum()) {
+            int64_t result = 1, b = rand1.fixnum();
+            bool overflow = false;
+            for (intptr_t exp = exponent; exp > 0 && !overflow; exp /= 2) {
+                if (exp % 2 == 1) overflow = __builtin_mul_overflow(result, b, &result);
+                if (exp > 1 && !overflow) overflow = __builtin_mul_overflow(b, b, &b);
             }
-            exp /= 2;
+            if (!overflow) return IntegerE(result);
+        }
+        BigInt result(1), b = toBig(rand1);
+        for (intptr_t exp = exponent; exp > 0; exp /= 2) {
+            if (exp % 2 == 1) result = result * b;
+            if (exp > 1) b = b * b;
         }
-        
-        return FixnumE((int)result);
+        return IntegerE(result);
     }
     throw(RuntimeError("Wrong typename"));
 }
 
 //A FUNCTION TO SIMPLIFY THE COMPARISON WITH Fixnum AND RATIONAL NUMBER
 int compareNumericExprs(const Expr &v1, const Expr &v2) {
-    if (v1->e_type == E_FIXNUM && v2->e_type == E_FIXNUM) {
-        int n1 = dynamic_cast<Fixnum*>(v1.get())->n;
-        int n2 = dynamic_cast<Fixnum*>(v2.get())->n;
+    if (v1.is_fixnum() && v2.is_fixnum()) {
+        intptr_t n1 = v1.fixnum();
+        intptr_t n2 = v2.fixnum();
         return (n1 < n2) ? -1 : (n1 > n2) ? 1 : 0;
     }
-    else if (v1->e_type == E_RATIONAL && v2->e_type == E_FIXNUM) {
-        RationalNum* r1 = dynamic_cast<RationalNum*>(v1.get());
-        int n2 = dynamic_cast<Fixnum*>(v2.get())->n;
-        int left = r1->numerator;
-        int right = n2 * r1->denominator;
-        return (left < right) ? -1 : (left > right) ? 1 : 0;
-    }
-    else if (v1->e_type == E_FIXNUM && v2->e_type == E_RATIONAL) {
-        int n1 = dynamic_cast<Fixnum*>(v1.get())->n;
-        RationalNum* r2 = dynamic_cast<RationalNum*>(v2.get());
-        int left = n1 * r2->denominator;
-        int right = r2->numerator;
-        return (left < right) ? -1 : (left > right) ? 1 : 0;
-    }
-    else if (v1->e_type == E_RATIONAL && v2->e_type == E_RATIONAL) {
-        RationalNum* r1 = dynamic_cast<RationalNum*>(v1.get());
-        RationalNum* r2 = dynamic_cast<RationalNum*>(v2.get());
-        int left = r1->numerator * r2->denominator;
-        int right = r2->numerator * r1->denominator;
-        return (left < right) ? -1 : (left > right) ? 1 : 0;
+    if (isInt(v1) && isInt(v2)) {
+        return compare(toBig(v1), toBig(v2));
+    }
+    if (isNum(v1) && isNum(v2)) {
+        // Denominators are positive, so cross-multiplying keeps the order
+        BigInt n1, d1, n2, d2;
+        toRational(v1, n1, d1);
+        toRational(v2, n2, d2);
+        return compare(n1 * d2, n2 * d1);
     }
     throw RuntimeError("Wrong typename in numeric comparison");
 }
 
 bool H_Less(const Expr &rand1, const Expr &rand2) { // <
+    if (rand1.is_fixnum() && rand2.is_fixnum()) return rand1.fixnum() < rand2.fixnum();
     int res = compareNumericExprs(rand1, rand2);
     return res == -1;
 }
@@ -549,6 +354,7 @@ Expr Less::evalRator(const Expr &rand1, const Expr &rand2) { // <
 }
 
 bool H_LessEq(const Expr &rand1, const Expr &rand2) { // <=
+    if (rand1.is_fixnum() && rand2.is_fixnum()) return rand1.fixnum() <= rand2.fixnum();
     int res = compareNumericExprs(rand1, rand2);
     return res == -1 || res == 0;
 }
@@ -558,6 +364,7 @@ Expr LessEq::evalRator(const Expr &rand1, const Expr &rand2) { // <=
 }
 
 bool H_Equal(const Expr &rand1, const Expr &rand2) { // =
+    if (rand1.is_fixnum() && rand2.is_fixnum()) return rand1.fixnum() == rand2.fixnum();
     int res = compareNumericExprs(rand1, rand2);
     return res == 0;
 }
@@ -567,6 +374,7 @@ Expr Equal::evalRator(const Expr &rand1, const Expr &rand2) { // =
 }
 
 bool H_GreaterEq(const Expr &rand1, const Expr &rand2) { // >=
+    if (rand1.is_fixnum() && rand2.is_fixnum()) return rand1.fixnum() >= rand2.fixnum();
     int res = compareNumericExprs(rand1, rand2);
     return res == 0 || res == 1;
 }
@@ -576,6 +384,7 @@ Expr GreaterEq::evalRator(const Expr &rand1, const Expr &rand2) { // >=
 }
 
 bool H_Greater(const Expr &rand1, const Expr &rand2) { // >
+    if (rand1.is_fixnum() && rand2.is_fixnum()) return rand1.fixnum() > rand2.fixnum();
     int res = compareNumericExprs(rand1, rand2);
     return res == 1;
 }
@@ -584,41 +393,31 @@ Expr Greater::evalRator(const Expr &rand1, const Expr &rand2) { // >
     return BooleanE(H_Greater(rand1, rand2));
 }
 
-// 输入比较函数，输出多变量比较函数
-std::function<Expr(const std::vector<Expr> &args)> VarFactory(std::function<bool(const Expr &rand1, const Expr &rand2)> cmp) {
-    return [cmp](const std::vector<Expr> &args) {
-        if (args.size() <= 1) {
-            return BooleanE(true);
-        }
-        for (auto it = args.begin(), next = it + 1; next != args.end(); ++it, ++next) {
-            if (!cmp(*it, *next)) {
-                return BooleanE(false);
-            }
+// 多变量比较：逐对比较相邻参数，遇到不成立即返回 #f
+template <bool (*cmp)(const Expr &, const Expr &)>
+static Expr compareChain(const std::vector<Expr> &args) {
+    for (size_t i = 1; i < args.size(); i++) {
+        if (!cmp(args[i - 1], args[i])) {
+            return BooleanE(false);
         }
-        return BooleanE(true);
-    };
+    }
+    return BooleanE(true);
 }
 
-static auto H_LessVar = VarFactory(H_Less);
-static auto H_LessEqVar = VarFactory(H_LessEq);
-static auto H_EqualVar = VarFactory(H_Equal);
-static auto H_GreaterEqVar = VarFactory(H_GreaterEq);
-static auto H_GreaterVar = VarFactory(H_Greater);
-
 Expr LessVar::evalRator(const std::vector<Expr>& args) { // <= with multiple args
-    return H_LessVar(args);
+    return compareChain<H_Less>(args);
 }
 Expr LessEqVar::evalRator(const std::vector<Expr> &args) { // <= with multiple args
-    return H_LessEqVar(args);
+    return compareChain<H_LessEq>(args);
 }
 Expr EqualVar::evalRator(const std::vector<Expr> &args) { // = with multiple args
-    return H_EqualVar(args);
+    return compareChain<H_Equal>(args);
 }
 Expr GreaterEqVar::evalRator(const std::vector<Expr> &args) { // >= with multiple args
-    return H_GreaterEqVar(args);
+    return compareChain<H_GreaterEq>(args);
 }
 Expr GreaterVar::evalRator(const std::vector<Expr> &args) { // > with multiple args
-    return H_GreaterVar(args);
+    return compareChain<H_Greater>(args);
 }
 
 Expr Cons::evalRator(const Expr &rand1, const Expr &rand2) { // cons
@@ -626,16 +425,24 @@ Expr Cons::evalRator(const Expr &rand1, const Expr &rand2) { // cons
 }
 
 Expr ListFunc::evalRator(const std::vector<Expr> &args) { // list function
-    return std::accumulate(
-        args.rbegin(), args.rend(), NullExprE(),
-        [](Expr tail, const Expr& x) {
-            return PairE(x, tail);
-        }
-    );
+    return ListE(args, NullExprE());
+}
+
+static Expr cdrOf(const Expr &pair) {
+    return static_cast<Pair*>(pair.get())->cdr;
 }
 
 bool H_IsList(const Expr &rand) {
-    return rand->e_type == E_NULL || rand->e_type == E_PAIR && H_IsList(static_cast<Pair*>(rand.get())->cdr);
+    // Floyd: slow follows at half the speed, and meets fast only on a cycle
+    Expr slow = rand, fast = rand;
+    for (;;) {
+        if (fast.type() != E_PAIR) return fast.type() == E_NULL;
+        fast = cdrOf(fast);
+        if (fast.type() != E_PAIR) return fast.type() == E_NULL;
+        fast = cdrOf(fast);
+        slow = cdrOf(slow);
+        if (fast.same(slow)) return false;
+    }
 }
 
 Expr IsList::evalRator(const Expr &rand) { // list?
@@ -643,21 +450,21 @@ Expr IsList::evalRator(const Expr &rand) { // list?
 }
 
 Expr Car::evalRator(const Expr &rand) { // car
-    if (rand->e_type != E_PAIR) {
+    if (rand.type() != E_PAIR) {
         throw(RuntimeError("Wrong typename"));
     }
     return static_cast<Pair*>(rand.get())->car;
 }
 
 Expr Cdr::evalRator(const Expr &rand) { // cdr
-    if (rand->e_type != E_PAIR) {
+    if (rand.type() != E_PAIR) {
         throw(RuntimeError("Wrong typename"));
     }
     return static_cast<Pair*>(rand.get())->cdr;
 }
 
 Expr SetCar::evalRator(const Expr &rand1, const Expr &rand2) { // set-car!
-    if (rand1->e_type != E_PAIR) {
+    if (rand1.type() != E_PAIR) {
         throw(RuntimeError("Wrong form of arguments for set-car!"));
     }
     auto p = static_cast<Pair*>(rand1.get());
@@ -666,7 +473,7 @@ Expr SetCar::evalRator(const Expr &rand1, const Expr &rand2) { // set-car!
 }
 
 Expr SetCdr::evalRator(const Expr &rand1, const Expr &rand2) { // set-cdr!
-    if (rand1->e_type != E_PAIR) {
+    if (rand1.type() != E_PAIR) {
         throw(RuntimeError("Wrong form of arguments for set-cdr!"));
     }
     auto p = static_cast<Pair*>(rand1.get());
@@ -674,190 +481,661 @@ Expr SetCdr::evalRator(const Expr &rand1, const Expr &rand2) { // set-cdr!
     return EmptyE();
 }
 
+bool H_IsEq(const Expr &rand1, const Expr &rand2) {
+    // Symbols are interned: equal names compare as one pointer
+    if (rand1.type() == E_VAR && rand2.type() == E_VAR) {
+        return static_cast<Var*>(rand1.get())->x == static_cast<Var*>(rand2.get())->x;
+    }
+    // Fixnums, booleans, null and void are immediates: equal values have equal words
+    return rand1.same(rand2);
+}
+
+// Vectors: length, ref, set!, fill! and ->list take either kind
+
+static Vector *asVector(const Expr &v) {
+    return v.type() == E_VECTOR ? static_cast<Vector*>(v.get()) : nullptr;
+}
+
+static FxVector *asFxVector(const Expr &v) {
+    return v.type() == E_FXVECTOR ? static_cast<FxVector*>(v.get()) : nullptr;
+}
+
+static FxVector *fxVector(const Expr &v) {
+    FxVector *fx = asFxVector(v);
+    if (fx == nullptr) throw(RuntimeError("Wrong typename"));
+    return fx;
+}
+
+static int64_t fxElement(const Expr &x) {
+    if (!x.is_fixnum()) throw(RuntimeError("Wrong typename"));
+    return x.fixnum();
+}
+
+static size_t vectorLength(const Expr &v) {
+    if (Vector *vec = asVector(v)) return vec->items.size();
+    return fxVector(v)->items.size();
+}
+
+// A valid index into v
+static size_t vectorIndex(const Expr &v, const Expr &k) {
+    size_t size = vectorLength(v);
+    if (!k.is_fixnum()) throw(RuntimeError("Wrong typename"));
+    if (k.fixnum() < 0 || static_cast<size_t>(k.fixnum()) >= size) throw(RuntimeError("Vector index out of range"));
+    return k.fixnum();
+}
+
+// Checked against --max-heap before anything is allocated
+static size_t newVectorSize(const Expr &n, size_t element_size) {
+    if (!n.is_fixnum()) throw(RuntimeError("Wrong typename"));
+    if (n.fixnum() < 0) throw(RuntimeError("Negative vector length"));
+    if (static_cast<uint64_t>(n.fixnum()) > SIZE_MAX / element_size || !gc_within_budget(n.fixnum() * element_size)) {
+        throw(RuntimeError("Heap limit exceeded"));
+    }
+    return n.fixnum();
+}
+
+// The elements of a proper list
+static std::vector<Expr> listItems(const Expr &list) {
+    if (!H_IsList(list)) throw(RuntimeError("Wrong typename"));
+    std::vector<Expr> items;
+    for (Expr p = list; p.type() == E_PAIR; p = cdrOf(p)) items.push_back(static_cast<Pair*>(p.get())->car);
+    return items;
+}
+
+Expr VectorFunc::evalRator(const std::vector<Expr> &args) { // vector
+    return VectorE(args);
+}
+
+Expr MakeVector::evalRator(const std::vector<Expr> &args) { // make-vector
+    return VectorE(std::vector<Expr>(newVectorSize(args[0], sizeof(Expr)), args.size() == 2 ? args[1] : FixnumE(0)));
+}
+
+Expr IsVector::evalRator(const Expr &rand) { // vector?
+    return BooleanE(rand.type() == E_VECTOR || rand.type() == E_FXVECTOR);
+}
+
+Expr VectorLength::evalRator(const Expr &rand) { // vector-length
+    return IntegerE(static_cast<int64_t>(vectorLength(rand)));
+}
+
+Expr VectorRef::evalRator(const Expr &rand1, const Expr &rand2) { // vector-ref
+    size_t i = vectorIndex(rand1, rand2);
+    if (Vector *vec = asVector(rand1)) return vec->items[i];
+    return Expr::fromFixnum(asFxVector(rand1)->items[i]);
+}
+
+Expr VectorSet::evalRator(const std::vector<Expr> &args) { // vector-set!
+    size_t i = vectorIndex(args[0], args[1]);
+    if (Vector *vec = asVector(args[0])) vec->items[i] = args[2];
+    else asFxVector(args[0])->items[i] = fxElement(args[2]);
+    return EmptyE();
+}
+
+Expr VectorFill::evalRator(const Expr &rand1, const Expr &rand2) { // vector-fill!
+    if (Vector *vec = asVector(rand1)) std::fill(vec->items.begin(), vec->items.end(), rand2);
+    else std::fill(fxVector(rand1)->items.begin(), fxVector(rand1)->items.end(), fxElement(rand2));
+    return EmptyE();
+}
+
+Expr VectorToList::evalRator(const Expr &rand) { // vector->list
+    if (Vector *vec = asVector(rand)) return ListE(vec->items, NullExprE());
+    const std::vector<int64_t> &fx = fxVector(rand)->items;
+    std::vector<Expr> items;
+    items.reserve(fx.size());
+    for (int64_t n : fx) items.push_back(Expr::fromFixnum(n));
+    return ListE(items, NullExprE());
+}
+
+Expr ListToVector::evalRator(const Expr &rand) { // list->vector
+    return VectorE(listItems(rand));
+}
+
+// Fixnum vectors. The bulk loops keep to plain integer arithmetic, with
+// overflow folded into a flag checked after the loop, so the compiler can
+// vectorize them; only the overflow check of fxvector-mul stays scalar
+
+Expr MakeFxVector::evalRator(const std::vector<Expr> &args) { // make-fxvector
+    size_t n = newVectorSize(args[0], sizeof(int64_t));
+    return FxVectorE(std::vector<int64_t>(n, args.size() == 2 ? fxElement(args[1]) : 0));
+}
+
+Expr ListToFxVector::evalRator(const Expr &rand) { // list->fxvector
+    std::vector<Expr> items = listItems(rand);
+    std::vector<int64_t> fx(items.size());
+    for (size_t i = 0; i < items.size(); i++) fx[i] = fxElement(items[i]);
+    return FxVectorE(std::move(fx));
+}
+
+Expr IsFxVector::evalRator(const Expr &rand) { // fxvector?
+    return BooleanE(rand.type() == E_FXVECTOR);
+}
+
+Expr FxVectorSum::evalRator(const Expr &rand) { // fxvector-sum
+    const std::vector<int64_t> &items = fxVector(rand)->items;
+    // Sum the high and low 32 bits of the elements separately: neither can
+    // overflow within a block, and the block total is rebuilt exactly after
+    const size_t BLOCK = size_t(1) << 31;
+    int64_t small = 0;
+    BigInt big;
+    bool overflow = false;
+    for (size_t b = 0; b < items.size(); b += BLOCK) {
+        size_t e = std::min(items.size(), b + BLOCK);
+        uint64_t lo = 0;
+        int64_t hi = 0;
+        for (size_t i = b; i < e; i++) {
+            lo += static_cast<uint32_t>(items[i]);
+            hi += items[i] >> 32;
+        }
+        int64_t t, s;
+        if (!overflow && !__builtin_mul_overflow(hi, int64_t(1) << 32, &t) &&
+            !__builtin_add_overflow(t, static_cast<int64_t>(lo), &t) && !__builtin_add_overflow(small, t, &s)) {
+            small = s;
+            continue;
+        }
+        if (!overflow) big = BigInt(small);
+        overflow = true;
+        big = big + BigInt(hi) * BigInt(int64_t(1) << 32) + BigInt(static_cast<int64_t>(lo));
+    }
+    return overflow ? IntegerE(big) : IntegerE(small);
+}
+
+// Set in the top bit of the result unless n is in fixnum range
+static inline uint64_t fixnumRangeBit(int64_t n) {
+    return static_cast<uint64_t>(n) - static_cast<uint64_t>(Expr::FIXNUM_MIN);
+}
+
+static void sameLength(const std::vector<int64_t> &a, const std::vector<int64_t> &b, const char *name) {
+    if (a.size() != b.size()) throw(RuntimeError(std::string("Wrong form of arguments for ") + name));
+}
+
+Expr FxVectorAdd::evalRator(const Expr &rand1, const Expr &rand2) { // fxvector-add
+    const std::vector<int64_t> &a = fxVector(rand1)->items, &b = fxVector(rand2)->items;
+    sameLength(a, b, "fxvector-add");
+    std::vector<int64_t> r(a.size());
+    uint64_t out_of_range = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        // Fixnums have 63 bits, so the sum cannot overflow 64
+        r[i] = a[i] + b[i];
+        out_of_range |= fixnumRangeBit(r[i]);
+    }
+    if (out_of_range >> 63) throw(RuntimeError("Fixnum overflow in fxvector-add"));
+    return FxVectorE(std::move(r));
+}
+
+Expr FxVectorMul::evalRator(const Expr &rand1, const Expr &rand2) { // fxvector-mul
+    const std::vector<int64_t> &a = fxVector(rand1)->items, &b = fxVector(rand2)->items;
+    sameLength(a, b, "fxvector-mul");
+    std::vector<int64_t> r(a.size());
+    uint64_t out_of_range = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        out_of_range |= static_cast<uint64_t>(__builtin_mul_overflow(a[i], b[i], &r[i])) << 63;
+        out_of_range |= fixnumRangeBit(r[i]);
+    }
+    if (out_of_range >> 63) throw(RuntimeError("Fixnum overflow in fxvector-mul"));
+    return FxVectorE(std::move(r));
+}
+
+Expr FxVectorEq::evalRator(const Expr &rand1, const Expr &rand2) { // fxvector=?
+    return BooleanE(fxVector(rand1)->items == fxVector(rand2)->items);
+}
+
+// Hash tables
+
+static HashTable *hashTable(const Expr &v) {
+    if (v.type() != E_HASHTABLE) throw(RuntimeError("Wrong typename"));
+    return static_cast<HashTable*>(v.get());
+}
+
+Expr MakeHashTable::eval(const EnvPtr &) { // make-hash-table, make-equal-hash-table
+    return Expr(new HashTable(equal));
+}
+
+Expr IsHashTable::evalRator(const Expr &rand) { // hash-table?
+    return BooleanE(rand.type() == E_HASHTABLE);
+}
+
+Expr HashRef::evalRator(const std::vector<Expr> &args) { // hash-ref
+    const Expr *value = hashTable(args[0])->find(args[1]);
+    if (value != nullptr) return *value;
+    if (args.size() == 3) return args[2];
+    throw(RuntimeError("Key not found in hash-ref"));
+}
+
+Expr HashSet::evalRator(const std::vector<Expr> &args) { // hash-set!
+    hashTable(args[0])->set(args[1], args[2]);
+    return EmptyE();
+}
+
+Expr HashRemove::evalRator(const Expr &rand1, const Expr &rand2) { // hash-remove!
+    hashTable(rand1)->remove(rand2);
+    return EmptyE();
+}
+
+Expr HashCount::evalRator(const Expr &rand) { // hash-count
+    return IntegerE(static_cast<int64_t>(hashTable(rand)->count));
+}
+
+// Futures
+
+Expr MakeFuture::eval(const EnvPtr &env) { // future
+    env->escape();
+    Future *f = new Future(e, env);
+    Expr v(f);
+    future_submit(f);
+    return v;
+}
+
+Expr Touch::evalRator(const Expr &rand) { // touch
+    if (rand.type() != E_FUTURE) return rand;
+    return future_touch(static_cast<Future*>(rand.get()));
+}
+
+Expr IsFuture::evalRator(const Expr &rand) { // future?
+    return BooleanE(rand.type() == E_FUTURE);
+}
+
 Expr IsEq::evalRator(const Expr &rand1, const Expr &rand2) { // eq?
-    // 检查类型是否为 Fixnum
-    if (rand1->e_type == E_FIXNUM && rand2->e_type == E_FIXNUM) {
-        return BooleanE((dynamic_cast<Fixnum*>(rand1.get())->n) == (dynamic_cast<Fixnum*>(rand2.get())->n));
-    }
-    // 检查类型是否为 Boolean
-    else if (rand1->e_type == E_BOOLEAN && rand2->e_type == E_BOOLEAN) {
-        return BooleanE((dynamic_cast<Boolean*>(rand1.get())->b) == (dynamic_cast<Boolean*>(rand2.get())->b));
-    }
-    // 检查类型是否为 Var
-    else if (rand1->e_type == E_VAR && rand2->e_type == E_VAR) {
-        return BooleanE((dynamic_cast<Var*>(rand1.get())->x) == (dynamic_cast<Var*>(rand2.get())->x));
-    }
-    // 检查类型是否为 Null 或 Void
-    else if ((rand1->e_type == E_NULL && rand2->e_type == E_NULL) ||
-             (rand1->e_type == E_VOID && rand2->e_type == E_VOID)) {
-        return BooleanE(true);
-    } else {
-        return BooleanE(rand1.get() == rand2.get());
+    return BooleanE(H_IsEq(rand1, rand2));
+}
+
+bool H_IsEqual(const Expr &rand1, const Expr &rand2) {
+    // Pairs still to compare, so neither long lists nor deep nesting recurse
+    std::vector<std::pair<Expr, Expr>> pending{{rand1, rand2}};
+    while (!pending.empty()) {
+        Expr a = pending.back().first, b = pending.back().second;
+        pending.pop_back();
+        // Walk down the cdrs here, pushing only the cars
+        while (!a.same(b)) {
+            ExprType t = a.type();
+            if (t == E_PAIR) {
+                if (b.type() != E_PAIR) return false;
+                Pair *p = static_cast<Pair*>(a.get()), *q = static_cast<Pair*>(b.get());
+                pending.emplace_back(p->car, q->car);
+                a = p->cdr;
+                b = q->cdr;
+            } else if (t == E_VECTOR) {
+                if (b.type() != E_VECTOR) return false;
+                const std::vector<Expr> &x = static_cast<Vector*>(a.get())->items, &y = static_cast<Vector*>(b.get())->items;
+                if (x.size() != y.size()) return false;
+                for (size_t i = 0; i < x.size(); i++) pending.emplace_back(x[i], y[i]);
+                break;
+            } else if (t == E_FXVECTOR) {
+                if (b.type() != E_FXVECTOR) return false;
+                if (static_cast<FxVector*>(a.get())->items != static_cast<FxVector*>(b.get())->items) return false;
+                break;
+            } else if (t == E_STRING) {
+                if (b.type() != E_STRING) return false;
+                if (static_cast<StringExpr*>(a.get())->s != static_cast<StringExpr*>(b.get())->s) return false;
+                break;
+            } else if (isNum(a)) {
+                if (!isNum(b) || compareNumericExprs(a, b) != 0) return false;
+                break;
+            } else {
+                if (!H_IsEq(a, b)) return false;
+                break;
+            }
+        }
     }
+    return true;
+}
+
+Expr IsEqual::evalRator(const Expr &rand1, const Expr &rand2) { // equal?
+    return BooleanE(H_IsEqual(rand1, rand2));
 }
 
 Expr IsBoolean::evalRator(const Expr &rand) { // boolean?
-    return BooleanE(rand->e_type == E_BOOLEAN);
+    return BooleanE(rand.type() == E_BOOLEAN);
 }
 
 Expr IsFixnum::evalRator(const Expr &rand) { // number?
-    return BooleanE(rand->e_type == E_FIXNUM);
+    return BooleanE(isInt(rand));
 }
 
 Expr IsNull::evalRator(const Expr &rand) { // null?
-    return BooleanE(rand->e_type == E_NULL);
+    return BooleanE(rand.type() == E_NULL);
 }
 
 Expr IsPair::evalRator(const Expr &rand) { // pair?
-    return BooleanE(rand->e_type == E_PAIR);
+    return BooleanE(rand.type() == E_PAIR);
 }
 
 Expr IsProcedure::evalRator(const Expr &rand) { // procedure?
-    return BooleanE(rand->e_type == E_PROC);
+    return BooleanE(rand.type() == E_PROC);
 }
 
 Expr IsSymbol::evalRator(const Expr &rand) { // Var?
-    return BooleanE(rand->e_type == E_VAR);
+    return BooleanE(rand.type() == E_VAR);
 }
 
 Expr IsString::evalRator(const Expr &rand) { // string?
-    return BooleanE(rand->e_type == E_STRING);
+    return BooleanE(rand.type() == E_STRING);
 }
 
-Expr Begin::eval(const EnvPtr &e) {
+Expr Trampolined::eval(const EnvPtr &e) {
+    if (gc_stack_low()) {
+        // Nested calls have used up this native stack: go on on a new segment
+        Expr v(nullptr);
+        if (!gc_deeper_stack([&] { v = eval(e); })) throw(RuntimeError("Recursion too deep"));
+        return v;
+    }
+    TailCall k;
+    Expr v = evalTail(e, k);
+    while (v.null()) {
+        // k keeps the pending body and frame reachable while the step runs
+        k.running = k.expr;
+        k.running_env = k.env;
+        eval_safepoint();
+        v = k.running->evalTail(k.running_env, k);
+        // The call it ran is over; what it bounced to has a frame of its own
+        Env::reclaim(k.running_env, nullptr);
+        k.running_env = nullptr;
+    }
+    return v;
+}
+
+Expr Begin::evalTail(const EnvPtr &e, TailCall &k) {
     if (es.empty()) return EmptyE();
     auto p = es.begin(), q = es.end() - 1;
     while (p != q) {
         (*p)->eval(e);
         p++;
     }
-    return (*q)->eval(e);
+    return (*q)->evalTail(e, k);
 }
 
-Expr Quote::eval(const EnvPtr &e) {
-    return ex->eval(e);
+Expr Quote::eval(const EnvPtr &) {
+    return ex;
 }
 
 bool is_false(Expr a) {
-    if (a.get() == nullptr) return false;
-    return a->e_type == E_BOOLEAN && !static_cast<Boolean*>(a.get())->b;
+    return a.same(BooleanE(false));
 }
 
 bool is_true(Expr a) {
     return !is_false(a);
 }
 
-Expr AndVar::eval(const EnvPtr &e) { // and with short-circuit evaluation
+Expr AndVar::evalTail(const EnvPtr &e, TailCall &k) { // and with short-circuit evaluation
     // Scheme semantics:
     // - (and) => #t
     // - Evaluate left-to-right; on first #f, return #f without evaluating rest
-    // - If all are truthy, return the last evaluated Expr
+    // - If all are truthy, return the last evaluated Expr (in tail position)
     if (rands.empty()) return BooleanE(true);
 
-    Expr last = BooleanE(true);
-    for (const auto &ex : rands) {
-        last = ex->eval(e);
+    for (auto p = rands.begin(); p + 1 != rands.end(); ++p) {
+        Expr last = (*p)->eval(e);
         if (is_false(last)) {
             return last;
         }
     }
-    return last;
+    return rands.back()->evalTail(e, k);
 }
 
-Expr OrVar::eval(const EnvPtr &e) { // or with short-circuit evaluation
+Expr OrVar::evalTail(const EnvPtr &e, TailCall &k) { // or with short-circuit evaluation
     if (rands.empty()) return BooleanE(false);
 
-    Expr last = BooleanE(false);
-    for (const auto &ex : rands) {
-        last = ex->eval(e);
+    for (auto p = rands.begin(); p + 1 != rands.end(); ++p) {
+        Expr last = (*p)->eval(e);
         if (is_true(last)) {
             return last;
         }
     }
-    return last;
+    return rands.back()->evalTail(e, k);
 }
 
 Expr Not::evalRator(const Expr &rand) { // not
     return BooleanE(is_false(rand));
 }
 
-Expr If::eval(const EnvPtr &e) {
+Expr If::evalTail(const EnvPtr &e, TailCall &k) {
     Expr cond_res = cond->eval(e);
     if (is_false(cond_res)) {
-        return alter->eval(e);
+        return alter->evalTail(e, k);
     }
-    return conseq->eval(e);
+    return conseq->evalTail(e, k);
 }
 
-Expr Cond::eval(const EnvPtr &env) {
+Expr Cond::evalTail(const EnvPtr &env, TailCall &k) {
     if (clauses.empty()) throw(RuntimeError("Cond with no arguments"));
-    auto p = clauses.begin();
-    auto q = clauses.end() - 1;
-    while (p != q) {
-        auto list = dynamic_cast<SList*>(p->get());
-        if (list == nullptr) throw(RuntimeError("Wrong form of arguments for cond")); 
-        auto terms = list->terms;
-
-        int size = terms.size();
-        if (size == 0) throw(RuntimeError("Wrong number of arguments for cond"));
-        if (size == 1) {
-            auto cond_res = terms[0]->eval(env);
-            return cond_res;
-        }
+    for (const auto &c : clauses) {
+        if (c.test.null()) return c.body->evalTail(env, k);   // else
+        Expr cond_res = c.test->eval(env);
+        if (c.body.null()) return cond_res;
+        if (is_true(cond_res)) return c.body->evalTail(env, k);
+    }
+    return EmptyE();
+}
+
+Expr Lambda::eval(const EnvPtr &env) { 
+    env->escape();
+    return ProcedureE(&x, e, env, frame_size, this);
+}
 
-        Expr cond_res = terms[0]->eval(env);
-        if (is_true(cond_res)) {
-            auto res = std::vector<Expr>(terms.begin() + 1, terms.end());
-            return Expr(new Begin(res))->eval(env);
+// Calls a primitive that was obtained as a value, e.g. (define f car) (f x)
+Expr applyPrimitive(ExprType type, const std::vector<Expr> &args) {
+    const Expr none(nullptr);
+    auto unary = [&](const char *name) -> const Expr & {
+        if (args.size() != 1) throw(RuntimeError(std::string("Wrong number of arguments for ") + name));
+        return args[0];
+    };
+    auto binary = [&](const char *name) {
+        if (args.size() != 2) throw(RuntimeError(std::string("Wrong number of arguments for ") + name));
+    };
+    switch (type) {
+        // Arithmetic operations
+        case E_PLUS: return PlusVar({}).evalRator(args);
+        case E_MINUS:
+            if (args.empty()) throw(RuntimeError("Wrong number of arguments for -"));
+            return MinusVar({}).evalRator(args);
+        case E_MUL: return MultVar({}).evalRator(args);
+        case E_DIV:
+            if (args.empty()) throw(RuntimeError("Wrong number of arguments for /"));
+            return DivVar({}).evalRator(args);
+        case E_MODULO: binary("modulo"); return Modulo(none, none).evalRator(args[0], args[1]);
+        case E_EXPT: binary("expt"); return Expt(none, none).evalRator(args[0], args[1]);
+        // Comparison operations
+        case E_LT: return LessVar({}).evalRator(args);
+        case E_LE: return LessEqVar({}).evalRator(args);
+        case E_EQ: return EqualVar({}).evalRator(args);
+        case E_GE: return GreaterEqVar({}).evalRator(args);
+        case E_GT: return GreaterVar({}).evalRator(args);
+        // Logic operations
+        case E_NOT: return Not(none).evalRator(unary("not"));
+        case E_AND:
+        {
+            Expr last = BooleanE(true);
+            for (const auto &x : args) {
+                last = x;
+                if (is_false(last)) break;
+            }
+            return last;
         }
-        p++;
+        case E_OR:
+        {
+            Expr last = BooleanE(false);
+            for (const auto &x : args) {
+                last = x;
+                if (is_true(last)) break;
+            }
+            return last;
+        }
+        // List operations
+        case E_CONS: binary("cons"); return Cons(none, none).evalRator(args[0], args[1]);
+        case E_CAR: return Car(none).evalRator(unary("car"));
+        case E_CDR: return Cdr(none).evalRator(unary("cdr"));
+        case E_LIST: return ListFunc({}).evalRator(args);
+        case E_SETCAR: binary("set-car!"); return SetCar(none, none).evalRator(args[0], args[1]);
+        case E_SETCDR: binary("set-cdr!"); return SetCdr(none, none).evalRator(args[0], args[1]);
+        // Vector operations
+        case E_VECTORFUNC: return VectorFunc({}).evalRator(args);
+        case E_MAKEVECTOR:
+            if (args.size() != 1 && args.size() != 2) throw(RuntimeError("Wrong number of arguments for make-vector"));
+            return MakeVector({}).evalRator(args);
+        case E_VECTORQ: return IsVector(none).evalRator(unary("vector?"));
+        case E_VECTORLENGTH: return VectorLength(none).evalRator(unary("vector-length"));
+        case E_VECTORREF: binary("vector-ref"); return VectorRef(none, none).evalRator(args[0], args[1]);
+        case E_VECTORSET:
+            if (args.size() != 3) throw(RuntimeError("Wrong number of arguments for vector-set!"));
+            return VectorSet({}).evalRator(args);
+        case E_VECTORFILL: binary("vector-fill!"); return VectorFill(none, none).evalRator(args[0], args[1]);
+        case E_VECTORTOLIST: return VectorToList(none).evalRator(unary("vector->list"));
+        case E_LISTTOVECTOR: return ListToVector(none).evalRator(unary("list->vector"));
+        // Fixnum vector operations
+        case E_MAKEFXVECTOR:
+            if (args.size() != 1 && args.size() != 2) throw(RuntimeError("Wrong number of arguments for make-fxvector"));
+            return MakeFxVector({}).evalRator(args);
+        case E_LISTTOFXVECTOR: return ListToFxVector(none).evalRator(unary("list->fxvector"));
+        case E_FXVECTORQ: return IsFxVector(none).evalRator(unary("fxvector?"));
+        case E_FXVECTORSUM: return FxVectorSum(none).evalRator(unary("fxvector-sum"));
+        case E_FXVECTORADD: binary("fxvector-add"); return FxVectorAdd(none, none).evalRator(args[0], args[1]);
+        case E_FXVECTORMUL: binary("fxvector-mul"); return FxVectorMul(none, none).evalRator(args[0], args[1]);
+        case E_FXVECTOREQ: binary("fxvector=?"); return FxVectorEq(none, none).evalRator(args[0], args[1]);
+        // Hash table operations
+        case E_MAKEHASHTABLE:
+        case E_MAKEEQUALHASHTABLE:
+            if (!args.empty()) throw(RuntimeError("Wrong number of arguments for make-hash-table"));
+            return Expr(new HashTable(type == E_MAKEEQUALHASHTABLE));
+        case E_HASHTABLEQ: return IsHashTable(none).evalRator(unary("hash-table?"));
+        case E_HASHREF:
+            if (args.size() != 2 && args.size() != 3) throw(RuntimeError("Wrong number of arguments for hash-ref"));
+            return HashRef({}).evalRator(args);
+        case E_HASHSET:
+            if (args.size() != 3) throw(RuntimeError("Wrong number of arguments for hash-set!"));
+            return HashSet({}).evalRator(args);
+        case E_HASHREMOVE: binary("hash-remove!"); return HashRemove(none, none).evalRator(args[0], args[1]);
+        case E_HASHCOUNT: return HashCount(none).evalRator(unary("hash-count"));
+        // Futures
+        case E_TOUCH: return Touch(none).evalRator(unary("touch"));
+        case E_FUTUREQ: return IsFuture(none).evalRator(unary("future?"));
+        case E_DISPLAY: return Display(none).evalRator(unary("display!"));
+        // Type predicates
+        case E_EQQ: binary("eq?"); return IsEq(none, none).evalRator(args[0], args[1]);
+        case E_EQUALQ: binary("equal?"); return IsEqual(none, none).evalRator(args[0], args[1]);
+        case E_BOOLQ: return IsBoolean(none).evalRator(unary("boolean?"));
+        case E_INTQ: return IsFixnum(none).evalRator(unary("number?"));
+        case E_NULLQ: return IsNull(none).evalRator(unary("null?"));
+        case E_PAIRQ: return IsPair(none).evalRator(unary("pair?"));
+        case E_PROCQ: return IsProcedure(none).evalRator(unary("procedure?"));
+        case E_SYMBOLQ: return IsSymbol(none).evalRator(unary("symbol?"));
+        case E_LISTQ: return IsList(none).evalRator(unary("list?"));
+        case E_STRINGQ: return IsString(none).evalRator(unary("string?"));
+        // Special values and control
+        case E_VOID:
+            if (!args.empty()) throw(RuntimeError("Wrong number of arguments for void"));
+            return MakeVoidE();
+        case E_EXIT:
+            if (!args.empty()) throw(RuntimeError("Wrong number of arguments for exit"));
+            return ExitE();
+        case E_RUNTIME_STATS:
+            if (!args.empty()) throw(RuntimeError("Wrong number of arguments for runtime-stats"));
+            return runtime_stats_list();
+        default:
+            throw(RuntimeError("Unknown primitive"));
     }
+}
 
-    auto list = dynamic_cast<SList*>(p->get());
-    if (list == nullptr) throw(RuntimeError("Wrong form of arguments for cond")); 
-    auto terms = list->terms;
-
-    int size = terms.size();
-    if (size == 0) throw(RuntimeError("Wrong number of arguments for cond"));
-    if (size == 1) {
-        auto cond_res = terms[0]->eval(env);
-        return cond_res;
+Expr Apply::evalTail(const EnvPtr &env, TailCall &k) {
+    Expr f = rator->eval(env);
+    if (f.type() == E_SPECIALFORM) {
+        // A variable bound to a special form: analyze the raw combination as that form
+        auto sf = static_cast<SpecialForm*>(f.get());
+        Expr node = analyzeSpecialForm(sf->type, form, scope, env);
+        GcRoot root(node);
+        return node->evalTail(env, k);
+    }
+    if (f.type() != E_PROC && f.type() != E_PRIMITIVE) {
+        throw RuntimeError("Attempt to apply a non-procedure");
     }
 
-    if (terms[0].get() != nullptr && terms[0]->e_type == E_VAR) {
-        auto v = dynamic_cast<Var*>(terms[0].get());
-        if (v != nullptr && find(v->x, env).get() == nullptr && v->x == "else") {
-            auto res = std::vector<Expr>(terms.begin() + 1, terms.end());
-            return Expr(new Begin(res))->eval(env);
+    if (f.type() == E_PROC) {
+        auto p = static_cast<Procedure*>(f.get());
+        if (rand.size() == p->parameters->size()) {
+            // Evaluate the arguments straight into the callee's frame
+            EnvPtr frame = Env::make(p->env, p->frame_size, p->reclaimable());
+            for (size_t i = 0; i < rand.size(); i++) frame->slots[i] = rand[i]->eval(env);
+            if (profiling) {
+                // A tail call ends the activation this loop is running
+                if (k.profiled) profile_exit();
+                profile_enter(p->name());
+                k.profiled = true;
+            }
+            // Bounce to the driver loop in Trampolined::eval instead of recursing
+            k.env = frame;
+            k.expr = p->e;
+            return Expr(nullptr);
         }
     }
 
-    Expr cond_res = terms[0]->eval(env);
-    if (is_true(cond_res)) {
-        auto res = std::vector<Expr>(terms.begin() + 1, terms.end());
-        return Expr(new Begin(res))->eval(env);
+    std::vector<Expr> args;
+    GcRoot root(args);
+    args.reserve(rand.size());
+    std::transform(rand.begin(), rand.end(), std::back_inserter(args), [&env](const Expr &x) {
+        return x->eval(env);
+    });
+    if (f.type() == E_PRIMITIVE) {
+        return applyPrimitive(static_cast<Primitive*>(f.get())->type, args);
     }
-
-    return EmptyE();
+    throw RuntimeError("Wrong number of arguments");
+}
+
+bool Guard::fastApplies(const EnvPtr &env) const {
+    if (checked_version.load(std::memory_order_acquire) == Env::version) return checked_fast.load(std::memory_order_relaxed);
+    std::lock_guard<std::recursive_mutex> guard(toplevel_lock);
+    bool fast = decideFast(env);
+    checked_fast.store(fast, std::memory_order_relaxed);
+    checked_version.store(Env::version, std::memory_order_release);
+    return fast;
+}
+
+bool Guard::decideFast(const EnvPtr &env) const {
+    for (const Symbol &name : names) {
+        if (!is_shadowed(name)) continue;
+
+        // Some define rebound the name; only keep the specialized form if it still
+        // refers to the same primitive or special form here
+        const Expr *binding = global_binding(global_frame(env), name);
+        if (binding == nullptr) continue;
+        const Expr &head = *binding;
+        if (head.type() == E_PRIMITIVE || head.type() == E_SPECIALFORM) {
+            bool prim = head.type() == E_PRIMITIVE;
+            ExprType t = prim ? static_cast<Primitive*>(head.get())->type : static_cast<SpecialForm*>(head.get())->type;
+            const auto &table = prim ? primitives : reserved_words;
+            auto it = table.find(name);
+            if (it != table.end() && it->second == t) continue;
+        }
+        return false;
+    }
+    return true;
 }
 
-Expr Lambda::eval(const EnvPtr &env) { 
-    return ProcedureE(x, e, env);
+Expr Guard::evalTail(const EnvPtr &env, TailCall &k) {
+    if (fastApplies(env)) return fast->evalTail(env, k);
+    Expr node(nullptr);
+    {
+        std::lock_guard<std::recursive_mutex> guard(toplevel_lock);
+        if (slow.null()) slow = analyze(form, scope, env);
+        node = slow;
+    }
+    return node->evalTail(env, k);
 }
 
-Expr Apply::eval(const EnvPtr &env) {
-    auto p = static_cast<Procedure*>(rator.get());
-    if (rand.size() != p->parameters.size()) {throw RuntimeError("Wrong number of arguments");}
+Expr BadForm::eval(const EnvPtr &) {
+    throw(RuntimeError(msg));
+}
 
-    EnvPtr param_env = std::make_shared<Env>(p->env);
-    for (size_t i = 0; i < rand.size(); i++) {
-        safe_add_bind(p->parameters[i], rand[i], param_env);
+// Binds a define'd name: a slot of the current frame, or a top-level name
+void define_var(const Symbol &var, int slot, const Expr &v, const EnvPtr &env) {
+    if (slot >= 0) {
+        env->slots[slot] = v;
+        return;
     }
-    return p->e->eval(param_env);
+    std::lock_guard<std::recursive_mutex> guard(toplevel_lock);
+    note_define(var);
+    add_bind(var, v, env);
 }
 
 Expr Define::eval(const EnvPtr &env) {
-    safe_add_bind(var, e->eval(env), env);
+    define_var(var, slot, e->eval(env), env);
     return EmptyE();
 }
 
@@ -865,37 +1143,83 @@ Expr Define_f::eval(const EnvPtr &env) {
     if (env == nullptr) {
         throw(RuntimeError("define needs an environment"));
     }
-    safe_add_bind(var, ProcedureE(x, Expr(new Begin(es)), env), env);
+    env->escape();
+    define_var(var, slot, ProcedureE(&x, e, env, frame_size, this), env);
     return EmptyE();
 }
 
-Expr Let::eval(const EnvPtr &env) {
-    EnvPtr param_env = std::make_shared<Env>(env);
-    for (auto b : bind) {
-        safe_add_bind(b.first, b.second->eval(env), param_env);
+Expr DeferredBody::body(const EnvPtr &env) {
+    ExprBase *node = analyzed.load(std::memory_order_acquire);
+    if (node != nullptr) return Expr(node);
+    std::lock_guard<std::recursive_mutex> guard(toplevel_lock);
+    node = analyzed.load(std::memory_order_relaxed);
+    if (node != nullptr) return Expr(node);
+    size_t size;
+    Expr e = analyzeProcedureBody(x, source, scope, env, size);
+    if (size != frame_size) throw(RuntimeError("procedure from the image no longer fits its frame"));
+    analyzed.store(e.get(), std::memory_order_release);
+    return e;
+}
+
+Expr DeferredBody::eval(const EnvPtr &env) {
+    return body(env)->eval(env);
+}
+
+Expr DeferredBody::evalTail(const EnvPtr &env, TailCall &k) {
+    return body(env)->evalTail(env, k);
+}
+
+Expr Let::evalTail(const EnvPtr &env, TailCall &k) {
+    EnvPtr param_env = Env::make(env, frame_size, reclaimable);
+    for (const auto &b : bind) {
+        param_env->slots[b.first] = b.second->eval(env);
     }
-    return Expr(new Begin(body))->eval(param_env);
+    Expr v = body->evalTail(param_env, k);
+    Env::reclaim(param_env, env);
+    return v;
 }
 
-Expr Letrec::eval(const EnvPtr &env) {
-    EnvPtr param_env = std::make_shared<Env>(env);
-    for (auto b : bind) {
-        safe_add_bind(b.first, b.second->eval(param_env), param_env);
+Expr Letrec::evalTail(const EnvPtr &env, TailCall &k) {
+    EnvPtr param_env = Env::make(env, frame_size, reclaimable);
+    for (const auto &b : bind) {
+        param_env->slots[b.first] = b.second->eval(param_env);
+    }
+    Expr v = body->evalTail(param_env, k);
+    Env::reclaim(param_env, env);
+    return v;
+}
+
+void Set::assign(const EnvPtr &env, const Expr &v) const {
+    Env *frame = env;
+    for (int i = 0; i < depth; i++) frame = frame->parent;
+    if (slot < 0) {
+        std::lock_guard<std::recursive_mutex> guard(toplevel_lock);
+        auto it = frame->top->bindings.find(var);
+        if (it == frame->top->bindings.end()) {
+            if (global_binding(frame, var) != nullptr) throw(RuntimeError("cannot set! a binding of the shared prelude"));
+            throw(RuntimeError("try to set! a non-existent var"));
+        }
+        if (frame->top->frozen) throw(RuntimeError("cannot set! a binding of the shared prelude"));
+        it->second = v;
+        if (is_shadowed(var)) Env::version++;
+    } else {
+        if (frame->slots[slot].null()) throw(RuntimeError("try to set! a non-existent var"));
+        frame->slots[slot] = v;
     }
-    return Expr(new Begin(body))->eval(param_env);
 }
 
 Expr Set::eval(const EnvPtr &env) {
-    safe_modify(var, e->eval(env), env);
+    assign(env, e->eval(env));
     return EmptyE();
 }
 
 Expr Display::evalRator(const Expr &rand) { // display function
-    if (rand->e_type == E_STRING) {
+    std::lock_guard<std::mutex> guard(output_lock);
+    if (rand.type() == E_STRING) {
         StringExpr* str_ptr = dynamic_cast<StringExpr*>(rand.get());
-        std::cout << str_ptr->s;
+        *current_output << str_ptr->s;
     } else {
-        rand->show(std::cout);
+        rand.show(*current_output);
     }
     return EmptyE();
 }
@@ -1,6 +1,9 @@
 #include "Def.hpp"
 #include "RE.hpp"
 #include "expr.hpp"
+#include "vm.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
 #include <cstring>
 #include <cstdlib>
 #include <utility>
@@ -9,42 +12,167 @@ using std::vector;
 using std::string;
 using std::pair;
 
-// 辅助函数：计算最大公约数
-static int gcd(int a, int b) {
-    while (b != 0) {
-        int temp = b;
-        b = a % b;
-        a = temp;
+ExprBase::ExprBase(ExprType et) : e_type(et) {
+    runtime_stats.allocations[et]++;
+}
+
+Expr ExprBase::evalTail(const EnvPtr &env, TailCall &) {
+    return eval(env);
+}
+
+
+
+static const ExprType constant_types[] = {E_BOOLEAN, E_BOOLEAN, E_NULL, E_VOID, E_EMPTY};
+
+ExprType Expr::type() const {
+    if (is_fixnum()) return E_FIXNUM;
+    if ((bits & 7) == CONSTANT_TAG) return constant_types[bits >> 3];
+    return get()->e_type;
+}
+
+// Iterative, so neither long lists nor deep nesting use the C++ stack: open
+// holds, for each list or vector still open, what is left of it to print
+void Expr::show(std::ostream &os) const {
+    if (null()) return;
+    // A value other than a pair or a vector with items
+    auto atom = [&os](const Expr &v) {
+        if (v.is_fixnum()) {
+            os << v.fixnum();
+            return;
+        }
+        switch (v.type()) {
+            case E_BOOLEAN: os << ((v.bits >> 3) == C_TRUE ? "#t" : "#f"); return;
+            case E_NULL: os << "()"; return;
+            case E_VOID: os << "#<void>"; return;
+            case E_EMPTY: return;
+            case E_VECTOR: os << "#()"; return;
+            default: v->show(os);
+        }
+    };
+    // The rest of a list, or a vector and the index of its next item
+    struct Open {
+        Expr rest;
+        const Vector *vector;
+        size_t next;
+    };
+    std::vector<Open> open;
+    Expr v = *this;
+    for (;;) {
+        if (v.type() == E_PAIR) {
+            Pair *p = static_cast<Pair *>(v.get());
+            os << '(';
+            open.push_back(Open{p->cdr, nullptr, 0});
+            v = p->car;
+            continue;
+        }
+        if (v.type() == E_VECTOR && !static_cast<Vector *>(v.get())->items.empty()) {
+            const Vector *vec = static_cast<Vector *>(v.get());
+            os << "#(";
+            open.push_back(Open{Expr(nullptr), vec, 1});
+            v = vec->items[0];
+            continue;
+        }
+        atom(v);
+        for (;;) {
+            if (open.empty()) return;
+            Open &o = open.back();
+            if (o.vector != nullptr) {
+                if (o.next < o.vector->items.size()) {
+                    os << ' ';
+                    v = o.vector->items[o.next++];
+                    break;
+                }
+            } else if (o.rest.null()) {
+                // Its dotted tail is printed
+            } else if (o.rest.type() == E_PAIR) {
+                Pair *p = static_cast<Pair *>(o.rest.get());
+                os << ' ';
+                o.rest = p->cdr;
+                v = p->car;
+                break;
+            } else if (o.rest.type() != E_NULL) {
+                // A dotted tail prints as an item would, then the list closes
+                os << " . ";
+                v = o.rest;
+                o.rest = Expr(nullptr);
+                break;
+            }
+            open.pop_back();
+            os << ')';
+        }
     }
-    return a;
 }
 
-ExprBase::ExprBase(ExprType et) : e_type(et) {}
+Env::Env(EnvPtr parent_env, size_t n, bool r)
+    : reclaimable(r), parent(parent_env), size(n), slots(reinterpret_cast<Expr *>(this + 1)), top() {
+    std::fill(slots, slots + size, Expr(nullptr));
+}
+Env::Env(EnvPtr prelude_env)
+    : reclaimable(false), parent(nullptr), size(0), slots(nullptr), top(new TopLevel{std::unordered_map<Symbol, Expr>(), prelude_env, false}) {
+    runtime_stats.env_frames++;
+}
+
+std::atomic<unsigned long> Env::version(0);
+std::recursive_mutex toplevel_lock;
 
-void ExprBase::showCdr(std::ostream &os) const {
-    os << " . ";
-    show(os);
-    os << ')';
+EnvPtr Env::make(EnvPtr parent_env, size_t size, bool reclaimable) {
+    void *mem = gc_allocate(sizeof(Env) + size * sizeof(Expr));
+    runtime_stats.env_frames++;
+    // A frame that may be captured keeps the ones it sits on
+    if (!reclaimable && parent_env != nullptr) parent_env->escape();
+    return new (mem) Env(parent_env, size, reclaimable);
 }
 
+void Env::release(Env *frame, const Env *keep) {
+    do {
+        Env *parent = frame->parent;
+        size_t bytes = sizeof(Env) + frame->size * sizeof(Expr);
+        if (bytes > GC_MAX_CELL) return;
+        frame->Env::~Env();
+        gc_free(frame, bytes);
+        runtime_stats.env_frames_reclaimed++;
+        frame = parent;
+    } while (frame != nullptr && frame != keep && frame->reclaimable);
+}
 
-Expr::Expr(ExprBase * eb) : ptr(eb) {}
-ExprBase* Expr::operator->() const { return ptr.get(); }
-ExprBase& Expr::operator*() { return *ptr; }
-ExprBase* Expr::get() const { return ptr.get(); }
+void Env::trace() const {
+    for (size_t i = 0; i < size; i++) gc_mark(slots[i]);
+    if (top) {
+        for (const auto &b : top->bindings) gc_mark(b.second);
+        gc_mark(top->prelude);
+    }
+    gc_mark(parent);
+}
+
+Scope::Scope(const std::vector<Symbol> &vec, const ScopePtr &p) : names(vec), parent(p) {}
+
+int Scope::slot(const Symbol &x) const {
+    // A name bound twice in one frame (lambda (x x) ...) refers to the last binding
+    for (size_t i = names.size(); i-- > 0; ) {
+        if (names[i] == x) return i;
+    }
+    return -1;
+}
 
-void Expr::show(std::ostream &os) const { 
-    if (get() == nullptr) return;
-    this->ptr->show(os);
+Env *global_frame(const EnvPtr &env) {
+    Env *cur = env;
+    while (cur->parent != nullptr) cur = cur->parent;
+    return cur;
 }
 
-Env::Env(EnvPtr parent_env) : bindings(), parent(std::move(parent_env)) {}
-Env::Env() : bindings(), parent(nullptr) {}
+Expr *global_binding(Env *frame, const Symbol &x) {
+    for (Env *cur = frame; cur != nullptr; cur = cur->top->prelude) {
+        auto it = cur->top->bindings.find(x);
+        if (it != cur->top->bindings.end()) return &it->second;
+    }
+    return nullptr;
+}
 
-void modify(const std::string &x, const Expr &v, const EnvPtr &env) {
+void modify(const Symbol &x, const Expr &v, const EnvPtr &env) {
     for (EnvPtr cur = env; cur != nullptr; cur = cur->parent) {
-        auto it = cur->bindings.find(x);
-        if (it != cur->bindings.end()) {
+        if (!cur->top) continue;
+        auto it = cur->top->bindings.find(x);
+        if (it != cur->top->bindings.end()) {
             it->second = v;
             return;
         }
@@ -52,22 +180,29 @@ void modify(const std::string &x, const Expr &v, const EnvPtr &env) {
     throw(RuntimeError("try to set! a non-existent var"));
 }
 
-void add_bind(const std::string &x, const Expr &v, const EnvPtr &env) {
+void add_bind(const Symbol &x, const Expr &v, const EnvPtr &env) {
     if (env == nullptr) {
         throw(RuntimeError("attempt to bind in an empty environment"));
     }
-    auto it = env->bindings.find(x);
-    if (it != env->bindings.end()) {
+    if (!env->top) env->top.reset(new Env::TopLevel{std::unordered_map<Symbol, Expr>(), nullptr, false});
+    if (env->top->frozen) {
+        throw(RuntimeError("cannot define in the shared prelude"));
+    }
+    auto &bindings = env->top->bindings;
+    auto it = bindings.find(x);
+    if (it != bindings.end()) {
         it->second = v;
     } else {
-        env->bindings.emplace(x, v);
+        bindings.emplace(x, v);
+        Env::version++;
     }
 }
 
-Expr find(const std::string &x, const EnvPtr &env) {
+Expr find(const Symbol &x, const EnvPtr &env) {
     for (EnvPtr cur = env; cur != nullptr; cur = cur->parent) {
-        auto it = cur->bindings.find(x);
-        if (it != cur->bindings.end()) {
+        if (!cur->top) continue;
+        auto it = cur->top->bindings.find(x);
+        if (it != cur->top->bindings.end()) {
             return it->second;
         }
     }
@@ -88,13 +223,13 @@ void assert_valid_var(const std::string &s) {
     if (!is_valid_var(s)) throw(RuntimeError("not a valid variable name!"));
 }
 
-void safe_add_bind(const std::string &x, const Expr &v, const EnvPtr &env) {
-    assert_valid_var(x);
+void safe_add_bind(const Symbol &x, const Expr &v, const EnvPtr &env) {
+    assert_valid_var(x.str());
     add_bind(x, v, env);
 }
 
-void safe_modify(const std::string &x, const Expr &v, const EnvPtr &env) {
-    assert_valid_var(x);
+void safe_modify(const Symbol &x, const Expr &v, const EnvPtr &env) {
+    assert_valid_var(x.str());
     modify(x, v, env);
 }
 
@@ -102,35 +237,59 @@ void safe_modify(const std::string &x, const Expr &v, const EnvPtr &env) {
 
 self_evaluating::self_evaluating(ExprType et) : ExprBase(et) {}
 
-Fixnum::Fixnum(int x) : self_evaluating(E_FIXNUM), n(x) {}
+Fixnum::Fixnum(int64_t x) : self_evaluating(E_FIXNUM), n(x) {}
 
 Expr Fixnum::eval(const EnvPtr &) {
-    return FixnumE(n);
+    return IntegerE(n);
+}
+
+Expr IntegerE(int64_t n) {
+    if (n >= Expr::FIXNUM_MIN && n <= Expr::FIXNUM_MAX) return Expr::fromFixnum(n);
+    return Expr(new Bignum(BigInt(n)));
+}
+
+Expr IntegerE(const BigInt &n) {
+    if (n.fitsInt64()) return IntegerE(n.toInt64());
+    return Expr(new Bignum(n));
+}
+
+Bignum::Bignum(const BigInt &x) : self_evaluating(E_BIGNUM), n(x) {
+    gc_allocate_payload(n.bytes());
+}
+
+void Bignum::trace() const {
+    gc_mark_payload(n.bytes());
+}
+
+RationalNum::RationalNum(const BigInt &num, const BigInt &den) : self_evaluating(E_RATIONAL), numerator(num), denominator(den) {
+    gc_allocate_payload(numerator.bytes() + denominator.bytes());
+}
+
+void RationalNum::trace() const {
+    gc_mark_payload(numerator.bytes() + denominator.bytes());
 }
 
-RationalNum::RationalNum(int num, int den) : self_evaluating(E_RATIONAL), numerator(num), denominator(den) {
+Expr RationalE(const BigInt &num, const BigInt &den) {
     // 简化分数
-    int g = gcd(abs(numerator), abs(denominator));
-    numerator /= g;
-    denominator /= g;
-    
+    BigInt g = BigInt::gcd(num, den), n, d, rem;
+    BigInt::divMod(num, g, n, rem);
+    BigInt::divMod(den, g, d, rem);
+
     // 确保分母为正
-    if (denominator < 0) {
-        numerator = -numerator;
-        denominator = -denominator;
+    if (d.isNegative()) {
+        n = -n;
+        d = -d;
     }
+    if (compare(d, BigInt(1)) == 0) return IntegerE(n);
+    return Expr(new RationalNum(n, d));
 }
 
-RationalNum::RationalNum(const Fixnum &a) : self_evaluating(E_RATIONAL), numerator(a.n), denominator(1) {}
-
-Expr RationalNum::eval(const EnvPtr &) {
-    return RationalNumE(numerator, denominator);
+StringExpr::StringExpr(std::string str) : self_evaluating(E_STRING), s(std::move(str)) {
+    gc_allocate_payload(s.capacity());
 }
 
-StringExpr::StringExpr(const std::string &str) : self_evaluating(E_STRING), s(str) {}
-
-Expr StringExpr::eval(const EnvPtr &) {
-    return StringExprE(s);
+void StringExpr::trace() const {
+    gc_mark_payload(s.capacity());
 }
 
 Boolean::Boolean(const bool &b) : self_evaluating(E_BOOLEAN), b(b) {}
@@ -151,6 +310,12 @@ Expr Exit::eval(const EnvPtr &) {
     return ExitE();
 }
 
+GetRuntimeStats::GetRuntimeStats() : ExprBase(E_RUNTIME_STATS) {}
+
+Expr GetRuntimeStats::eval(const EnvPtr &) {
+    return runtime_stats_list();
+}
+
 NullExpr::NullExpr() : self_evaluating(E_NULL) {}
 
 Expr NullExpr::eval(const EnvPtr &) {
@@ -159,17 +324,95 @@ Expr NullExpr::eval(const EnvPtr &) {
 
 Pair::Pair(const Expr &car, const Expr &cdr) : self_evaluating(E_PAIR), car(car), cdr(cdr) {}
 
+void Pair::show(std::ostream &os) const {
+    Expr(const_cast<Pair *>(this)).show(os);
+}
+
+void Pair::trace() const {
+    gc_mark(car);
+    gc_mark(cdr);
+}
+
+Expr ListE(const std::vector<Expr> &items, const Expr &tail) {
+    // Fill runs of adjacent cells from the back, so that each pair is followed
+    // in memory by its cdr and walking the list reads memory in order
+    Expr rest = tail;
+    size_t end = items.size();
+    while (end > 0) {
+        size_t n = end, stride;
+        char *cells = gc_allocate_run(sizeof(Pair), n, stride);
+        for (size_t i = n; i-- > 0; ) {
+            rest = Expr(new (cells + i * stride) Pair(items[end - n + i], rest));
+        }
+        end -= n;
+    }
+    return rest;
+}
+
 Expr Pair::eval(const EnvPtr &) {
     return PairE(car, cdr);
 }
 
-Procedure::Procedure(const std::vector<std::string> &vec, const Expr &e, const EnvPtr &env)
-    : self_evaluating(E_PROC), parameters(vec), e(e), env(env) {}
+Vector::Vector(std::vector<Expr> items) : self_evaluating(E_VECTOR), items(std::move(items)) {
+    gc_allocate_payload(this->items.capacity() * sizeof(Expr));
+}
+
+void Vector::trace() const {
+    gc_mark_payload(items.capacity() * sizeof(Expr));
+    gc_mark(items);
+}
+
+void Vector::show(std::ostream &os) const {
+    Expr(const_cast<Vector *>(this)).show(os);
+}
+
+FxVector::FxVector(std::vector<int64_t> items) : self_evaluating(E_FXVECTOR), items(std::move(items)) {
+    gc_allocate_payload(this->items.capacity() * sizeof(int64_t));
+}
+
+void FxVector::trace() const {
+    gc_mark_payload(items.capacity() * sizeof(int64_t));
+}
+
+void FxVector::show(std::ostream &os) const {
+    os << "#vfx(";
+    for (size_t i = 0; i < items.size(); i++) {
+        if (i != 0) os << ' ';
+        os << items[i];
+    }
+    os << ')';
+}
+
+Procedure::Procedure(const std::vector<Symbol> *vec, const Expr &e, const EnvPtr &env, size_t size, const ExprBase *o)
+    : self_evaluating(E_PROC), parameters(vec), e(e), env(env), frame_size(size), code(nullptr), origin(o) {}
+
+void Procedure::trace() const {
+    gc_mark(e);
+    gc_mark(env);
+    gc_mark(code.load(std::memory_order_relaxed));
+    gc_mark(origin);
+}
+
+Symbol Procedure::name() const {
+    if (origin->e_type == E_LAMBDA) return static_cast<const Lambda*>(origin)->name;
+    return static_cast<const Define_f*>(origin)->var;
+}
+
+Future::Future(const Expr &body, const EnvPtr &env)
+    : self_evaluating(E_FUTURE), body(body), env(env), value(nullptr), state(PENDING), group(nullptr) {}
+
+void Future::trace() const {
+    gc_mark(body);
+    gc_mark(env);
+    gc_mark(value);
+}
 
 Empty::Empty() : self_evaluating(E_EMPTY) {}
 
 Expr Procedure::eval(const EnvPtr &) {
-    return ProcedureE(parameters, e, env);
+    Expr copy = ProcedureE(parameters, e, env, frame_size, origin);
+    static_cast<Procedure*>(copy.get())->code.store(code.load(std::memory_order_acquire), std::memory_order_relaxed);
+    return copy;
 }
 
 Expr Primitive::eval(const EnvPtr &) {
@@ -184,21 +427,51 @@ Expr SpecialForm::eval(const EnvPtr &) {
 
 Unary::Unary(ExprType et, const Expr &expr) : ExprBase(et), rand(expr) {}
 
+void Unary::trace() const {
+    gc_mark(rand);
+}
+
 Binary::Binary(ExprType et, const Expr &r1, const Expr &r2) : ExprBase(et), rand1(r1), rand2(r2) {}
 
+void Binary::trace() const {
+    gc_mark(rand1);
+    gc_mark(rand2);
+}
+
 Variadic::Variadic(ExprType et, const std::vector<Expr> &rands) : ExprBase(et), rands(rands) {}
 
+void Variadic::trace() const {
+    gc_mark(rands);
+}
+
+__thread TailCall *TailCall::active = nullptr;
+
+TailCall::TailCall() : expr(nullptr), env(nullptr), running(nullptr), running_env(nullptr), prev(active), profiled(false) {
+    active = this;
+    stats_enter();
+}
+
+TailCall::~TailCall() {
+    stats_exit();
+    if (profiled) profile_exit();
+    active = prev;
+}
+
+Trampolined::Trampolined(ExprType et) : ExprBase(et) {}
+
+NumericBinary::NumericBinary(ExprType et, const Expr &r1, const Expr &r2) : Binary(et, r1, r2) {}
+
 //ARITHMETIC OPERATIONS
 
-Plus::Plus(const Expr &r1, const Expr &r2) : Binary(E_PLUS, r1, r2) {}
+Plus::Plus(const Expr &r1, const Expr &r2) : NumericBinary(E_PLUS, r1, r2) {}
 
-Minus::Minus(const Expr &r1, const Expr &r2) : Binary(E_MINUS, r1, r2) {}
+Minus::Minus(const Expr &r1, const Expr &r2) : NumericBinary(E_MINUS, r1, r2) {}
 
-Mult::Mult(const Expr &r1, const Expr &r2) : Binary(E_MUL, r1, r2) {}
+Mult::Mult(const Expr &r1, const Expr &r2) : NumericBinary(E_MUL, r1, r2) {}
 
 Div::Div(const Expr &r1, const Expr &r2) : Binary(E_DIV, r1, r2) {}
 
-Modulo::Modulo(const Expr &r1, const Expr &r2) : Binary(E_MODULO, r1, r2) {}
+Modulo::Modulo(const Expr &r1, const Expr &r2) : NumericBinary(E_MODULO, r1, r2) {}
 
 Expt::Expt(const Expr &r1, const Expr &r2) : Binary(E_EXPT, r1, r2) {}
 
@@ -212,15 +485,15 @@ DivVar::DivVar(const std::vector<Expr> &rands) : Variadic(E_DIV, rands) {}
 
 //COMPARISON OPERATIONS
 
-Less::Less(const Expr &r1, const Expr &r2) : Binary(E_LT, r1, r2) {}
+Less::Less(const Expr &r1, const Expr &r2) : NumericBinary(E_LT, r1, r2) {}
 
-LessEq::LessEq(const Expr &r1, const Expr &r2) : Binary(E_LE, r1, r2) {}
+LessEq::LessEq(const Expr &r1, const Expr &r2) : NumericBinary(E_LE, r1, r2) {}
 
-Equal::Equal(const Expr &r1, const Expr &r2) : Binary(E_EQ, r1, r2) {}
+Equal::Equal(const Expr &r1, const Expr &r2) : NumericBinary(E_EQ, r1, r2) {}
 
-GreaterEq::GreaterEq(const Expr &r1, const Expr &r2) : Binary(E_GE, r1, r2) {}
+GreaterEq::GreaterEq(const Expr &r1, const Expr &r2) : NumericBinary(E_GE, r1, r2) {}
 
-Greater::Greater(const Expr &r1, const Expr &r2) : Binary(E_GT, r1, r2) {}
+Greater::Greater(const Expr &r1, const Expr &r2) : NumericBinary(E_GT, r1, r2) {}
 
 LessVar::LessVar(const std::vector<Expr> &rands) : Variadic(E_LT, rands) {}
 
@@ -246,17 +519,88 @@ SetCar::SetCar(const Expr &r1, const Expr &r2) : Binary(E_SETCAR, r1, r2) {}
 
 SetCdr::SetCdr(const Expr &r1, const Expr &r2) : Binary(E_SETCDR, r1, r2) {}
 
+//VECTOR OPERATIONS
+
+VectorFunc::VectorFunc(const std::vector<Expr> &rands) : Variadic(E_VECTORFUNC, rands) {}
+
+MakeVector::MakeVector(const std::vector<Expr> &rands) : Variadic(E_MAKEVECTOR, rands) {}
+
+IsVector::IsVector(const Expr &r1) : Unary(E_VECTORQ, r1) {}
+
+VectorLength::VectorLength(const Expr &r1) : Unary(E_VECTORLENGTH, r1) {}
+
+VectorRef::VectorRef(const Expr &r1, const Expr &r2) : Binary(E_VECTORREF, r1, r2) {}
+
+VectorSet::VectorSet(const std::vector<Expr> &rands) : Variadic(E_VECTORSET, rands) {}
+
+VectorFill::VectorFill(const Expr &r1, const Expr &r2) : Binary(E_VECTORFILL, r1, r2) {}
+
+VectorToList::VectorToList(const Expr &r1) : Unary(E_VECTORTOLIST, r1) {}
+
+ListToVector::ListToVector(const Expr &r1) : Unary(E_LISTTOVECTOR, r1) {}
+
+//FIXNUM VECTOR OPERATIONS
+
+MakeFxVector::MakeFxVector(const std::vector<Expr> &rands) : Variadic(E_MAKEFXVECTOR, rands) {}
+
+ListToFxVector::ListToFxVector(const Expr &r1) : Unary(E_LISTTOFXVECTOR, r1) {}
+
+IsFxVector::IsFxVector(const Expr &r1) : Unary(E_FXVECTORQ, r1) {}
+
+FxVectorSum::FxVectorSum(const Expr &r1) : Unary(E_FXVECTORSUM, r1) {}
+
+FxVectorAdd::FxVectorAdd(const Expr &r1, const Expr &r2) : Binary(E_FXVECTORADD, r1, r2) {}
+
+FxVectorMul::FxVectorMul(const Expr &r1, const Expr &r2) : Binary(E_FXVECTORMUL, r1, r2) {}
+
+FxVectorEq::FxVectorEq(const Expr &r1, const Expr &r2) : Binary(E_FXVECTOREQ, r1, r2) {}
+
+//HASH TABLE OPERATIONS
+
+MakeHashTable::MakeHashTable(bool equal) : ExprBase(equal ? E_MAKEEQUALHASHTABLE : E_MAKEHASHTABLE), equal(equal) {}
+
+IsHashTable::IsHashTable(const Expr &r1) : Unary(E_HASHTABLEQ, r1) {}
+
+HashRef::HashRef(const std::vector<Expr> &rands) : Variadic(E_HASHREF, rands) {}
+
+HashSet::HashSet(const std::vector<Expr> &rands) : Variadic(E_HASHSET, rands) {}
+
+HashRemove::HashRemove(const Expr &r1, const Expr &r2) : Binary(E_HASHREMOVE, r1, r2) {}
+
+HashCount::HashCount(const Expr &r1) : Unary(E_HASHCOUNT, r1) {}
+
+//FUTURES
+
+MakeFuture::MakeFuture(const Expr &e) : ExprBase(E_MAKEFUTURE), e(e) {}
+
+void MakeFuture::trace() const {
+    gc_mark(e);
+}
+
+Touch::Touch(const Expr &r1) : Unary(E_TOUCH, r1) {}
+
+IsFuture::IsFuture(const Expr &r1) : Unary(E_FUTUREQ, r1) {}
+
 //LOGIC OPERATIONS
 
 Not::Not(const Expr &r1) : Unary(E_NOT, r1) {}
 
-AndVar::AndVar(const std::vector<Expr> &rands) : ExprBase(E_AND), rands(rands) {}
+AndVar::AndVar(const std::vector<Expr> &rands) : Trampolined(E_AND), rands(rands) {}
+
+void AndVar::trace() const {
+    gc_mark(rands);
+}
 
-OrVar::OrVar(const std::vector<Expr> &rands) : ExprBase(E_OR), rands(rands) {}
+OrVar::OrVar(const std::vector<Expr> &rands) : Trampolined(E_OR), rands(rands) {}
+
+void OrVar::trace() const {
+    gc_mark(rands);
+}
 
 //TYPE PREDICATES
 
 IsEq::IsEq(const Expr &r1, const Expr &r2) : Binary(E_EQQ, r1, r2) {}
+IsEqual::IsEqual(const Expr &r1, const Expr &r2) : Binary(E_EQUALQ, r1, r2) {}
 
 IsBoolean::IsBoolean(const Expr &r1) : Unary(E_BOOLQ, r1) {}
 
@@ -276,42 +620,145 @@ IsString::IsString(const Expr &r1) : Unary(E_STRINGQ, r1) {}
 
 //CONTROL FLOW CONSTRUCTS
 
-Begin::Begin(const vector<Expr> &vec) : ExprBase(E_BEGIN), es(vec) {}
+Begin::Begin(const vector<Expr> &vec) : Trampolined(E_BEGIN), es(vec) {}
+
+void Begin::trace() const {
+    gc_mark(es);
+}
 
 Quote::Quote(const Expr &expr) : ExprBase(E_QUOTE), ex(expr) {}
 
+void Quote::trace() const {
+    gc_mark(ex);
+}
+
 //CONDITIONAL
 
-If::If(const Expr &c, const Expr &c_t, const Expr &c_e) : ExprBase(E_IF), cond(c), conseq(c_t), alter(c_e) {}
+If::If(const Expr &c, const Expr &c_t, const Expr &c_e) : Trampolined(E_IF), cond(c), conseq(c_t), alter(c_e) {}
+
+void If::trace() const {
+    gc_mark(cond);
+    gc_mark(conseq);
+    gc_mark(alter);
+}
 
-Cond::Cond(const std::vector<Expr> &cls) : ExprBase(E_COND), clauses(cls) {}
+Cond::Cond(const std::vector<CondClause> &cls) : Trampolined(E_COND), clauses(cls) {}
+
+void Cond::trace() const {
+    for (const auto &c : clauses) {
+        gc_mark(c.test);
+        gc_mark(c.body);
+    }
+}
 
 //VARIABLE AND FUNCITON DEFINITION
 
-Var::Var(const string &s) : ExprBase(E_VAR), x(s) {}
+Var::Var(const Symbol &s)
+    : ExprBase(E_VAR), x(s), depth(0), slot(-1), cache(nullptr), cache_frame(nullptr), cache_version(0), builtin(nullptr) {}
+
+Var::Var(const Symbol &s, int d, int i)
+    : ExprBase(E_VAR), x(s), depth(d), slot(i), cache(nullptr), cache_frame(nullptr), cache_version(0), builtin(nullptr) {}
+
+void Var::trace() const {
+    gc_mark(builtin);
+}
 
 SList::SList(const std::vector<Expr> t) : ExprBase(E_SLIST), terms(t) {}
 
-Apply::Apply(const Expr &expr, const vector<Expr> &vec) : ExprBase(E_APPLY), rator(expr), rand(vec) {}
+void SList::trace() const {
+    gc_mark(terms);
+}
+
+Apply::Apply(const Expr &expr, const vector<Expr> &vec, const Expr &f, const ScopePtr &sc)
+    : Trampolined(E_APPLY), rator(expr), rand(vec), form(f), scope(sc) {}
+
+void Apply::trace() const {
+    gc_mark(rator);
+    gc_mark(rand);
+    gc_mark(form);
+}
+
+Guard::Guard(const std::vector<Symbol> &s, const Expr &fast_e, const Expr &f, const ScopePtr &sc)
+    : Trampolined(E_GUARD), names(s), fast(fast_e), form(f), scope(sc), slow(nullptr), checked_version(~0UL), checked_fast(true) {}
+
+void Guard::trace() const {
+    gc_mark(fast);
+    gc_mark(form);
+    gc_mark(slow);
+}
+
+BadForm::BadForm(const string &m) : ExprBase(E_BADFORM), msg(m) {}
+
+// "(lambda (x y))", the profiler's name for a lambda that is not bound to a name
+static Symbol anonymousName(const vector<Symbol> &parameters) {
+    string s = "(lambda (";
+    for (size_t i = 0; i < parameters.size(); i++) {
+        if (i > 0) s += ' ';
+        s += parameters[i].str();
+    }
+    return Symbol(s + "))");
+}
+
+Lambda::Lambda(const vector<Symbol> &vec, const Expr &expr, size_t size, const vector<Expr> &src, const ScopePtr &s,
+               bool r)
+    : ExprBase(E_LAMBDA), x(vec), e(expr), frame_size(size), name(anonymousName(vec)), source(src), scope(s), reclaimable(r) {}
+
+void Lambda::trace() const {
+    gc_mark(e);
+    gc_mark(source);
+}
+
+DeferredBody::DeferredBody(const vector<Symbol> &vec, const vector<Expr> &src, const ScopePtr &s, size_t size)
+    : ExprBase(E_DEFERRED), x(vec), source(src), scope(s), frame_size(size), analyzed(nullptr) {}
+
+void DeferredBody::trace() const {
+    gc_mark(source);
+    gc_mark(analyzed.load(std::memory_order_relaxed));
+}
 
-Lambda::Lambda(const vector<string> &vec, const Expr &expr) : ExprBase(E_LAMBDA), x(vec), e(expr) {}
+Define::Define(const Symbol &variable, int i, const Expr &expr) : ExprBase(E_DEFINE), var(variable), slot(i), e(expr) {}
 
-Define::Define(const string &variable, const Expr &expr) : ExprBase(E_DEFINE), var(variable), e(expr) {}
+void Define::trace() const {
+    gc_mark(e);
+}
 
-Define_f::Define_f(const string &variable, vector<string>& vec, const std::vector<Expr> &expr) : ExprBase(E_DEFINE), var(variable), x(vec), es(expr) {}
+Define_f::Define_f(const Symbol &variable, int i, const vector<Symbol> &vec, const Expr &expr, size_t size,
+                   const vector<Expr> &src, const ScopePtr &s, bool r)
+    : ExprBase(E_DEFINE), var(variable), slot(i), x(vec), e(expr), frame_size(size), source(src), scope(s), reclaimable(r) {}
+
+void Define_f::trace() const {
+    gc_mark(e);
+    gc_mark(source);
+}
 
 Primitive::Primitive(ExprType et) : self_evaluating(E_PRIMITIVE), type(et) {}
 
 SpecialForm::SpecialForm(ExprType et) : self_evaluating(E_SPECIALFORM), type(et) {}
 //BINDING CONSTRUCTS
 
-Let::Let(const vector<pair<string, Expr>> &vec, const std::vector<Expr> &e) : ExprBase(E_LET), bind(vec), body(e) {}
+Let::Let(const vector<pair<int, Expr>> &vec, const Expr &e, size_t size, bool r)
+    : Trampolined(E_LET), bind(vec), body(e), frame_size(size), reclaimable(r) {}
+
+void Let::trace() const {
+    for (const auto &b : bind) gc_mark(b.second);
+    gc_mark(body);
+}
+
+Letrec::Letrec(const vector<pair<int, Expr>> &vec, const Expr &expr, size_t size, bool r)
+    : Trampolined(E_LETREC), bind(vec), body(expr), frame_size(size), reclaimable(r) {}
 
-Letrec::Letrec(const vector<pair<string, Expr>> &vec, const std::vector<Expr> &expr) : ExprBase(E_LETREC), bind(vec), body(expr) {}
+void Letrec::trace() const {
+    for (const auto &b : bind) gc_mark(b.second);
+    gc_mark(body);
+}
 
 //ASSIGNMENT
 
-Set::Set(const std::string &var, const Expr &e) : ExprBase(E_SET), var(var), e(e) {}
+Set::Set(const Symbol &var, int d, int i, const Expr &e) : ExprBase(E_SET), var(var), depth(d), slot(i), e(e) {}
+
+void Set::trace() const {
+    gc_mark(e);
+}
 
 //I/O OPERATIONS
 
@@ -19,8 +19,13 @@ public:
 #include "RE.hpp"
 #include "Def.hpp"
 #include "syntax.hpp"
+#include "gc.hpp"
+#include "bigint.hpp"
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <cstring>
+#include <cstdint>
 #include <vector>
 
 
@@ -34,91 +39,238 @@ public:
  */
 
 struct Env;
-using EnvPtr = std::shared_ptr<Env>;
+using EnvPtr = Env *;
+struct TailCall;
+struct Code;
 
-struct ExprBase{
+struct ExprBase : GcObject {
     ExprType e_type;
     ExprBase(ExprType);
     virtual Expr eval(const EnvPtr &) = 0;
+    virtual Expr evalTail(const EnvPtr &, TailCall &);
     inline virtual void show(std::ostream &) const {};
-    virtual void showCdr(std::ostream &) const;
     virtual ~ExprBase() = default;
 };
 
+/**
+ * @brief Handle to an expression or a value
+ * A single tagged word. A set low bit marks a fixnum, an integer of up to 63
+ * bits stored in the word itself (larger ones are Bignums), and #t, #f, (),
+ * #<void> and the empty result are constants encoded by their tag, so none of them allocates. Any other value points to a
+ * collector-owned ExprBase (see gc.hpp). A zero word is the null handle.
+ */
 struct Expr {
-    std::shared_ptr<ExprBase> ptr;
+    enum Constant : uintptr_t { C_FALSE, C_TRUE, C_NULL, C_VOID, C_EMPTY };
+private:
+    uintptr_t bits;
+    static const uintptr_t CONSTANT_TAG = 2;
+    explicit Expr(uintptr_t w) : bits(w) {}
+    bool heap() const { return bits != 0 && (bits & 7) == 0; }
 public:
-    explicit Expr(ExprBase *);
-    void show(std::ostream &) const;
-    ExprBase* operator->() const;
-    ExprBase& operator*();
-    ExprBase* get() const;
+    explicit Expr(ExprBase *p) : bits(reinterpret_cast<uintptr_t>(p)) {}
+
+    static const intptr_t FIXNUM_MAX = INTPTR_MAX >> 1;
+    static const intptr_t FIXNUM_MIN = INTPTR_MIN >> 1;
+    static Expr fromFixnum(intptr_t n) { return Expr((static_cast<uintptr_t>(n) << 1) | 1); }   ///< n in [FIXNUM_MIN, FIXNUM_MAX]
+    static Expr fromConstant(Constant c) { return Expr((static_cast<uintptr_t>(c) << 3) | CONSTANT_TAG); }
+
+    bool null() const { return bits == 0; }
+    bool is_fixnum() const { return bits & 1; }
+    intptr_t fixnum() const { return static_cast<intptr_t>(bits) >> 1; }
+    bool same(const Expr &o) const { return bits == o.bits; }   ///< Identity, as for eq?
+    uintptr_t word() const { return bits; }                      ///< For hashing by identity
+    ExprType type() const;
+
+    /**
+     * Fixnum arithmetic straight on the tagged words: with a = 2x+1 and
+     * b = 2y+1, a + (b-1) = 2(x+y)+1, so the machine overflow flag tells
+     * whether the result is still a fixnum. False, leaving r alone, if either
+     * operand is not a fixnum or the result does not fit.
+     */
+    static bool addFixnums(const Expr &a, const Expr &b, Expr &r) {
+        intptr_t w;
+        if (!(a.bits & b.bits & 1) || __builtin_add_overflow(static_cast<intptr_t>(a.bits), static_cast<intptr_t>(b.bits - 1), &w)) return false;
+        r = Expr(static_cast<uintptr_t>(w));
+        return true;
+    }
+    static bool subFixnums(const Expr &a, const Expr &b, Expr &r) {
+        intptr_t w;
+        if (!(a.bits & b.bits & 1) || __builtin_sub_overflow(static_cast<intptr_t>(a.bits), static_cast<intptr_t>(b.bits - 1), &w)) return false;
+        r = Expr(static_cast<uintptr_t>(w));
+        return true;
+    }
+    static bool mulFixnums(const Expr &a, const Expr &b, Expr &r) {
+        // x * 2y is even, so adding the tag back cannot overflow
+        intptr_t w;
+        if (!(a.bits & b.bits & 1) || __builtin_mul_overflow(a.fixnum(), static_cast<intptr_t>(b.bits - 1), &w)) return false;
+        r = Expr(static_cast<uintptr_t>(w) | 1);
+        return true;
+    }
+
+    void show(std::ostream &) const;      ///< Written form; pairs and vectors are printed without recursion
+    ExprBase* operator->() const { return get(); }
+    ExprBase& operator*() { return *get(); }
+    ExprBase* get() const { return heap() ? reinterpret_cast<ExprBase *>(bits) : nullptr; }   ///< Null for immediates
 };
 
 inline std::ostream &operator<<(std::ostream &os, const Expr &v) {
-    v->show(os);
+    v.show(os);
     return os;
 }
 
-struct Env {
-    std::unordered_map<std::string, Expr> bindings;
+/**
+ * @brief Runtime environment frame
+ * Frames created by lambda calls, let and letrec are flat slot arrays
+ * indexed by the lexical addresses the analysis pass assigns, allocated in
+ * one piece with the Env. Only the top-level frame, where define can add
+ * names at any time, is keyed by name.
+ *
+ * A top-level frame may sit on a prelude, a frozen top-level frame shared by
+ * many sessions (see server.hpp): names it does not bind itself are looked
+ * up there before the builtins. The prelude is not its parent, so lexical
+ * addresses still end at the session's own frame, and a new session costs
+ * one empty map whatever the prelude holds.
+ *
+ * A call or let frame is made reclaimable when analysis found no lambda or
+ * future its body could make in it (see Let::reclaimable). It is freed as
+ * soon as its activation ends instead of waiting for a collection, unless a
+ * closure or future did capture it after all: escape(), called whenever one
+ * is made, clears the flag in the frame and those it sits on. A frame that
+ * is not reclaimable never sits on one that is.
+ */
+struct Env : GcObject {
+    /// What only a top-level frame has, kept out of line so call frames stay small
+    struct TopLevel {
+        std::unordered_map<Symbol, Expr> bindings;
+        EnvPtr prelude;                                 ///< Shared frame below this one, or null
+        bool frozen;                                    ///< No define or set! may change bindings anymore
+    };
+    bool reclaimable;                                   ///< Nothing but the running activation refers to it
     EnvPtr parent;
-
-    Env();
-    explicit Env(EnvPtr parent_env);
+    size_t size;                                        ///< Number of slots
+    Expr *slots;                                        ///< Lexically addressed frame, stored after the Env
+    std::unique_ptr<TopLevel> top;                      ///< Top-level frame only
+    /// Bumped whenever a top-level name may come to mean something else: a new
+    /// binding, or a define or set! of a primitive's or special form's name.
+    /// Caches of global lookups are valid while it is unchanged.
+    static std::atomic<unsigned long> version;
+
+    explicit Env(EnvPtr prelude = nullptr);             ///< A top-level frame
+    static EnvPtr make(EnvPtr parent_env, size_t size, bool reclaimable = false);   ///< A frame of size empty slots
+    /// Frees frame and the frames under it up to keep while they are reclaimable.
+    /// Called when the activation running in frame is done with it
+    static void reclaim(Env *frame, const Env *keep) {
+        if (frame != nullptr && frame != keep && frame->reclaimable) release(frame, keep);
+    }
+    /// Something made here can outlive the activation: this frame and the ones
+    /// it sits on are no longer reclaimable
+    void escape() {
+        for (Env *f = this; f != nullptr && f->reclaimable; f = f->parent) f->reclaimable = false;
+    }
+    virtual void trace() const override;
+private:
+    Env(EnvPtr parent_env, size_t size, bool reclaimable);
+    static void release(Env *frame, const Env *keep);
 };
 
+/// Held to change or look up top-level bindings, and by analysis, which reads
+/// them, as futures may do either on other threads. Lookups through caches
+/// valid at Env::version take no lock.
+extern std::recursive_mutex toplevel_lock;
+
 // Environment operations
-void safe_modify(const std::string&, const Expr &, const EnvPtr &);
-void safe_add_bind(const std::string&, const Expr &, const EnvPtr &);
-Expr find(const std::string &, const EnvPtr &);
+void modify(const Symbol&, const Expr &, const EnvPtr &);
+void add_bind(const Symbol&, const Expr &, const EnvPtr &);
+void safe_modify(const Symbol&, const Expr &, const EnvPtr &);
+void safe_add_bind(const Symbol&, const Expr &, const EnvPtr &);
+Expr find(const Symbol &, const EnvPtr &);
+Env *global_frame(const EnvPtr &);
+Expr *global_binding(Env *top_level, const Symbol &);   ///< In the frame or its prelude; null if neither binds it
+bool is_valid_var(const std::string &);
+
+/**
+ * @brief Compile-time lexical scope used by the analysis pass
+ * One Scope per lambda/let/letrec frame, holding the names that frame binds.
+ * A null ScopePtr is the top level, whose names live in the runtime Env.
+ */
+struct Scope;
+using ScopePtr = std::shared_ptr<Scope>;
+struct Scope {
+    std::vector<Symbol> names;             ///< Slot i of the frame holds names[i]
+    ScopePtr parent;
+    Scope(const std::vector<Symbol> &, const ScopePtr &);
+    int slot(const Symbol &) const;        ///< -1 if this frame does not bind the name
+};
+
+// Analysis pass (analysis.cpp): raw parse tree -> specialized expressions
+Expr analyze(const Expr &, const EnvPtr &);
+Expr analyze(const Expr &, const ScopePtr &, const EnvPtr &);
+Expr analyzeSpecialForm(ExprType, const Expr &, const ScopePtr &, const EnvPtr &);
+/// What lambda makes of body forms in scope, and the size of the frame they run in
+Expr analyzeProcedureBody(const std::vector<Symbol> &, const std::vector<Expr> &, const ScopePtr &, const EnvPtr &, size_t &frame_size);
+void note_define(const Symbol &);
+bool is_shadowed(const Symbol &);
+void define_var(const Symbol &, int slot, const Expr &, const EnvPtr &);
+Expr applyPrimitive(ExprType, const std::vector<Expr> &);
+bool is_false(Expr);                       ///< Only #f is false
 
 struct self_evaluating : ExprBase{
     self_evaluating(ExprType);
     virtual Expr eval(const EnvPtr &) override;
 };
 struct Fixnum : self_evaluating {
-    int n;
-    Fixnum(int);
+    int64_t n;
+    Fixnum(int64_t);
     inline virtual void show(std::ostream &os) const override {
         os << n;
     };
     virtual Expr eval(const EnvPtr &) override;
 };
-inline Expr FixnumE(int n) {return Expr(new Fixnum(n));};
+inline Expr FixnumE(int n) {return Expr::fromFixnum(n);};
+Expr IntegerE(int64_t);                    ///< A fixnum, or a Bignum if n needs more than 63 bits
+Expr IntegerE(const BigInt &);
+
+/**
+ * @brief Integer too large for a fixnum
+ * Arithmetic only produces one when the result does not fit a fixnum.
+ */
+struct Bignum : self_evaluating {
+    BigInt n;
+    Bignum(const BigInt &);
+    virtual void trace() const override;
+    inline virtual void show(std::ostream &os) const override {
+        os << n.toString();
+    };
+};
 
 /**
  * @brief Rational number literal expression
- * Represents rational numbers as numerator/denominator
+ * Represents rational numbers as numerator/denominator, in lowest terms with
+ * a positive denominator
  */
 struct RationalNum : self_evaluating {
-    int numerator;
-    int denominator;
-    RationalNum(int num, int den);
+    BigInt numerator;
+    BigInt denominator;
+    RationalNum(const BigInt &num, const BigInt &den);   ///< Already reduced; see RationalE()
+    virtual void trace() const override;
     inline virtual void show(std::ostream &os) const override {
-        if (denominator == 1) {
-            os << numerator;
-        } else {
-            os << numerator << "/" << denominator;
-        }
+        os << numerator.toString() << "/" << denominator.toString();
     };
-    explicit RationalNum(const Fixnum& a);
-    virtual Expr eval(const EnvPtr &) override;
 };
-inline Expr RationalNumE(int n, int d) {return Expr(new RationalNum(n, d));};
+Expr RationalE(const BigInt &num, const BigInt &den);   ///< num/den reduced, an integer if den divides num; den nonzero
 /**
  * @brief String literal expression
  * Represents string Exprs
  */
 struct StringExpr : self_evaluating {
     std::string s;
-    StringExpr(const std::string &);
+    StringExpr(std::string);
+    virtual void trace() const override;
     inline virtual void show(std::ostream &os) const override {
         os << "\"" << s << "\"";
     };
-    virtual Expr eval(const EnvPtr &) override;
 };
-inline Expr StringExprE(std::string s) {return Expr(new StringExpr(s));};
+inline Expr StringExprE(std::string s) {return Expr(new StringExpr(std::move(s)));};
 /**
  * @brief Boolean true literal
  */
@@ -131,7 +283,7 @@ struct Boolean : self_evaluating {
     };
     virtual Expr eval(const EnvPtr &) override;
 };
-inline Expr BooleanE(const bool &b) {return Expr(new Boolean(b));};
+inline Expr BooleanE(const bool &b) {return Expr::fromConstant(b ? Expr::C_TRUE : Expr::C_FALSE);};
 struct MakeVoid : self_evaluating {
     MakeVoid();
     inline virtual void show(std::ostream &os) const override {
@@ -139,7 +291,7 @@ struct MakeVoid : self_evaluating {
     }
     virtual Expr eval(const EnvPtr &) override;
 };
-inline Expr MakeVoidE() {return Expr(new MakeVoid());};
+inline Expr MakeVoidE() {return Expr::fromConstant(Expr::C_VOID);};
 
 struct Exit : self_evaluating {
     Exit();
@@ -148,50 +300,133 @@ struct Exit : self_evaluating {
 };
 inline Expr ExitE() {return Expr(new Exit());};
 
+struct GetRuntimeStats : ExprBase {    ///< (runtime-stats): a fresh alist of the counters in stats.hpp
+    GetRuntimeStats();
+    virtual Expr eval(const EnvPtr &) override;
+};
+
 struct NullExpr : self_evaluating {
     NullExpr();
     inline virtual void show(std::ostream &os) const override {
         os << "()";
     };
-    inline virtual void showCdr(std::ostream &os) const override {
-        os << ')';
-    };
     virtual Expr eval(const EnvPtr &) override;
 };
-inline Expr NullExprE() {return Expr(new NullExpr());};
+inline Expr NullExprE() {return Expr::fromConstant(Expr::C_NULL);};
 
 struct Pair : self_evaluating {
     Expr car;  ///< First element
     Expr cdr;  ///< Second element
     Pair(const Expr &, const Expr &);
-    inline virtual void show(std::ostream &os) const override {
-        os << '(' << car;
-        cdr->showCdr(os);
-    };
-    inline virtual void showCdr(std::ostream &os) const override {
-        os << ' ' << car;
-        cdr->showCdr(os);
-    };
+    virtual void trace() const override;
+    virtual void show(std::ostream &) const override;
     virtual Expr eval(const EnvPtr &) override;
 };
 inline Expr PairE(const Expr &car, const Expr &cdr) {return Expr(new Pair(car, cdr));};
+Expr ListE(const std::vector<Expr> &, const Expr &tail);   ///< Proper list, or ending in tail, laid out in adjacent cells
+
+struct Vector : self_evaluating {
+    std::vector<Expr> items;
+    Vector(std::vector<Expr>);
+    virtual void trace() const override;
+    virtual void show(std::ostream &) const override;
+};
+inline Expr VectorE(std::vector<Expr> items) {return Expr(new Vector(std::move(items)));};
+
+/**
+ * @brief Vector of unboxed fixnums
+ * Every element is a fixnum, stored as a plain integer in contiguous memory,
+ * so the bulk operations run as simple loops the compiler can vectorize.
+ */
+struct FxVector : self_evaluating {
+    std::vector<int64_t> items;            ///< Each in [Expr::FIXNUM_MIN, Expr::FIXNUM_MAX]
+    FxVector(std::vector<int64_t>);
+    virtual void trace() const override;
+    virtual void show(std::ostream &) const override;
+};
+inline Expr FxVectorE(std::vector<int64_t> items) {return Expr(new FxVector(std::move(items)));};
+
+bool H_IsEq(const Expr &, const Expr &);
+bool H_IsEqual(const Expr &, const Expr &);
+
+/**
+ * @brief Hash table with eq? or equal? keys
+ * Open addressing with linear probing in a power-of-two array that is kept
+ * at most half full, removed entries included. Each slot keeps its key's
+ * hash, so growing and probing past other keys need not rehash or compare
+ * them. Objects never move, so eq? keys hash by their word. An equal? key
+ * must not be mutated while it is in the table.
+ */
+struct HashTable : self_evaluating {
+    struct Slot {
+        Expr key;                          ///< Null if the slot is free
+        Expr value;
+        size_t hash;
+        bool removed;                      ///< Free, but probes must go on past it
+    };
+    bool equal;                            ///< Keys compare with equal? rather than eq?
+    std::vector<Slot> slots;
+    size_t count;                          ///< Entries
+    size_t used;                           ///< Entries and removed slots
+    HashTable(bool equal);
+    const Expr *find(const Expr &key) const;   ///< Null if absent
+    void set(const Expr &key, const Expr &value);
+    bool remove(const Expr &key);
+    virtual void trace() const override;
+    inline virtual void show(std::ostream &os) const override {
+        os << "#<hash-table>";
+    }
+private:
+    size_t hashOf(const Expr &) const;
+    size_t probe(const Expr &key, size_t hash) const;   ///< Slot holding key, or the free slot ending its chain
+    void grow();
+};
+
+/**
+ * @brief Value of (future e)
+ * body runs once, on the pool or on the first thread to touch the future
+ * while it is still pending (see future.hpp). value and error are written
+ * before state becomes DONE and only read after seeing it.
+ */
+struct FutureGroup;
+
+struct Future : self_evaluating {
+    enum State { PENDING, RUNNING, DONE };
+    Expr body;
+    EnvPtr env;
+    Expr value;                            ///< Null until done, and if body raised an error
+    std::string error;                     ///< Message of the RuntimeError body raised
+    std::atomic<int> state;
+    FutureGroup *group;                    ///< Server session it belongs to, else null
+    Future(const Expr &, const EnvPtr &);
+    virtual void trace() const override;
+    inline virtual void show(std::ostream &os) const override {
+        os << "#<future>";
+    }
+};
 
 struct Procedure : self_evaluating {
-    std::vector<std::string> parameters;   ///< Parameter names
+    const std::vector<Symbol> *parameters; ///< Parameter names, held by origin and shared by all its closures
     Expr e;                                ///< Function body expression
     EnvPtr env;                            ///< Closure environment
-    Procedure(const std::vector<std::string> &, const Expr &, const EnvPtr &);
+    size_t frame_size;                     ///< Slots of a call frame: parameters, then internal defines
+    std::atomic<Code *> code;              ///< Compiled body, set by the VM on first use, by any session calling it
+    const ExprBase *origin;                ///< The Lambda or Define_f that made it
+    Procedure(const std::vector<Symbol> *, const Expr &, const EnvPtr &, size_t, const ExprBase *);
+    Symbol name() const;                   ///< What the profiler reports it as
+    bool reclaimable() const;              ///< Whether its call frames are made reclaimable, as origin says
+    virtual void trace() const override;
     inline virtual void show(std::ostream &os) const override {
         os << "#<procedure>";
     };
     virtual Expr eval(const EnvPtr &) override;
 };
-inline Expr ProcedureE(const std::vector<std::string> &vec, const Expr &e, const EnvPtr &env) {return Expr(new Procedure(vec, e, env));};
+inline Expr ProcedureE(const std::vector<Symbol> *vec, const Expr &e, const EnvPtr &env, size_t size, const ExprBase *origin) {return Expr(new Procedure(vec, e, env, size, origin));};
 
 struct Empty : self_evaluating {
     Empty();
 };
-inline Expr EmptyE() {return Expr(new Empty());};
+inline Expr EmptyE() {return Expr::fromConstant(Expr::C_EMPTY);};
 
 // ================================================================================
 //                             BASIC ABSTRACT TYPES FOR PARAMETERS
@@ -200,6 +435,7 @@ inline Expr EmptyE() {return Expr(new Empty());};
 struct Unary : ExprBase {
     Expr rand;
     Unary(ExprType, const Expr &);
+    virtual void trace() const override;
     virtual Expr evalRator(const Expr &) = 0;
     virtual Expr eval(const EnvPtr &) override;
 };
@@ -208,6 +444,7 @@ struct Binary : ExprBase {
     Expr rand1;
     Expr rand2;
     Binary(ExprType, const Expr &, const Expr &);
+    virtual void trace() const override;
     virtual Expr evalRator(const Expr &, const Expr &) = 0;
     virtual Expr eval(const EnvPtr &) override;
 };
@@ -215,26 +452,91 @@ struct Binary : ExprBase {
 struct Variadic : ExprBase {
     std::vector<Expr> rands;
     Variadic(ExprType, const std::vector<Expr> &);
+    virtual void trace() const override;
     virtual Expr evalRator(const std::vector<Expr> &) = 0;
     virtual Expr eval(const EnvPtr &) override;
 };
 
+/**
+ * @brief Pending tail call
+ * evalTail() evaluates an expression in tail position. It either returns the
+ * value, or, when that position holds a procedure call, stores the body and
+ * the new frame here and returns a null Expr. eval() of a Trampolined
+ * expression loops on that, so a chain of tail calls runs in constant native
+ * stack instead of recursing once per call.
+ * Live TailCalls form a chain the collector uses as roots: running and
+ * running_env hold the body the loop is evaluating and its frame.
+ */
+struct TailCall {
+    Expr expr;
+    EnvPtr env;
+    Expr running;
+    EnvPtr running_env;
+    TailCall *prev;
+    bool profiled;                         ///< Whether the running body is a profiled activation, closed with the loop
+    static __thread TailCall *active;      ///< Innermost driver loop of this thread
+    TailCall();
+    ~TailCall();
+    TailCall(const TailCall &) = delete;
+    TailCall &operator=(const TailCall &) = delete;
+};
+
+/**
+ * @brief Expression with a subexpression in tail position
+ */
+struct Trampolined : ExprBase {
+    Trampolined(ExprType);
+    virtual Expr evalTail(const EnvPtr &, TailCall &) override = 0;
+    virtual Expr eval(const EnvPtr &) override;
+};
+
+/**
+ * @brief Two-operand arithmetic or comparison
+ * analyze() picks these for the two-operand forms of +, -, *, modulo and the
+ * comparisons. When both operands are fixnums the result comes from
+ * fixnumKernel() without a virtual call or an intermediate rational; other
+ * operands and overflowing results go through evalRator().
+ */
+struct NumericBinary : Binary {
+    NumericBinary(ExprType, const Expr &, const Expr &);
+    /// False if either operand is not a fixnum or the result does not fit one
+    bool fixnumKernel(const Expr &a, const Expr &b, Expr &r) const {
+        if (!(a.is_fixnum() && b.is_fixnum())) return false;
+        switch (e_type) {
+            case E_PLUS: return Expr::addFixnums(a, b, r);
+            case E_MINUS: return Expr::subFixnums(a, b, r);
+            case E_MUL: return Expr::mulFixnums(a, b, r);
+            case E_MODULO:
+                if (b.fixnum() == 0) return false;
+                r = Expr::fromFixnum(a.fixnum() % b.fixnum());
+                return true;
+            case E_LT: r = BooleanE(a.fixnum() < b.fixnum()); return true;
+            case E_LE: r = BooleanE(a.fixnum() <= b.fixnum()); return true;
+            case E_EQ: r = BooleanE(a.fixnum() == b.fixnum()); return true;
+            case E_GE: r = BooleanE(a.fixnum() >= b.fixnum()); return true;
+            case E_GT: r = BooleanE(a.fixnum() > b.fixnum()); return true;
+            default: return false;
+        }
+    }
+    virtual Expr eval(const EnvPtr &) override;
+};
+
 // ================================================================================
 //                             ARITHMETIC OPERATIONS
 // ================================================================================
 
-struct Plus : Binary {
+struct Plus : NumericBinary {
     Plus();
     Plus(const Expr &, const Expr &);
     virtual Expr evalRator(const Expr &, const Expr &) override;
 };
 
-struct Minus : Binary {
+struct Minus : NumericBinary {
     Minus(const Expr &, const Expr &);
     virtual Expr evalRator(const Expr &, const Expr &) override;
 };
 
-struct Mult : Binary {
+struct Mult : NumericBinary {
     Mult(const Expr &, const Expr &);
     virtual Expr evalRator(const Expr &, const Expr &) override;
 };
@@ -244,7 +546,7 @@ struct Div : Binary {
     virtual Expr evalRator(const Expr &, const Expr &) override;
 };
 
-struct Modulo : Binary {
+struct Modulo : NumericBinary {
     Modulo(const Expr &, const Expr &);
     virtual Expr evalRator(const Expr &, const Expr &) override;
 };
@@ -278,27 +580,27 @@ struct DivVar : Variadic {
 //                             COMPARISON OPERATIONS
 // ================================================================================
 
-struct Less : Binary {
+struct Less : NumericBinary {
     Less(const Expr &, const Expr &);
     virtual Expr evalRator(const Expr &, const Expr &) override;
 };
 
-struct LessEq : Binary {
+struct LessEq : NumericBinary {
     LessEq(const Expr &, const Expr &);
     virtual Expr evalRator(const Expr &, const Expr &) override;
 };
 
-struct Equal : Binary {
+struct Equal : NumericBinary {
     Equal(const Expr &, const Expr &);
     virtual Expr evalRator(const Expr &, const Expr &) override;
 };
 
-struct GreaterEq : Binary {
+struct GreaterEq : NumericBinary {
     GreaterEq(const Expr &, const Expr &);
     virtual Expr evalRator(const Expr &, const Expr &) override;
 };
 
-struct Greater : Binary {
+struct Greater : NumericBinary {
     Greater(const Expr &, const Expr &);
     virtual Expr evalRator(const Expr &, const Expr &) override;
 };
@@ -362,6 +664,151 @@ struct SetCdr : Binary {
     virtual Expr evalRator(const Expr &, const Expr &) override;
 };
 
+// ================================================================================
+//                             VECTOR OPERATIONS
+// ================================================================================
+// length, ref, set!, fill! and ->list take either kind of vector
+
+struct VectorFunc : Variadic {
+    VectorFunc(const std::vector<Expr> &);
+    virtual Expr evalRator(const std::vector<Expr> &) override;
+};
+
+struct MakeVector : Variadic {            ///< (make-vector n [fill])
+    MakeVector(const std::vector<Expr> &);
+    virtual Expr evalRator(const std::vector<Expr> &) override;
+};
+
+struct IsVector : Unary {
+    IsVector(const Expr &);
+    virtual Expr evalRator(const Expr &) override;
+};
+
+struct VectorLength : Unary {
+    VectorLength(const Expr &);
+    virtual Expr evalRator(const Expr &) override;
+};
+
+struct VectorRef : Binary {
+    VectorRef(const Expr &, const Expr &);
+    virtual Expr evalRator(const Expr &, const Expr &) override;
+};
+
+struct VectorSet : Variadic {             ///< (vector-set! v k obj)
+    VectorSet(const std::vector<Expr> &);
+    virtual Expr evalRator(const std::vector<Expr> &) override;
+};
+
+struct VectorFill : Binary {
+    VectorFill(const Expr &, const Expr &);
+    virtual Expr evalRator(const Expr &, const Expr &) override;
+};
+
+struct VectorToList : Unary {
+    VectorToList(const Expr &);
+    virtual Expr evalRator(const Expr &) override;
+};
+
+struct ListToVector : Unary {
+    ListToVector(const Expr &);
+    virtual Expr evalRator(const Expr &) override;
+};
+
+// ================================================================================
+//                             FIXNUM VECTOR OPERATIONS
+// ================================================================================
+
+struct MakeFxVector : Variadic {          ///< (make-fxvector n [fill])
+    MakeFxVector(const std::vector<Expr> &);
+    virtual Expr evalRator(const std::vector<Expr> &) override;
+};
+
+struct ListToFxVector : Unary {
+    ListToFxVector(const Expr &);
+    virtual Expr evalRator(const Expr &) override;
+};
+
+struct IsFxVector : Unary {
+    IsFxVector(const Expr &);
+    virtual Expr evalRator(const Expr &) override;
+};
+
+struct FxVectorSum : Unary {              ///< Exact sum, a bignum if it needs one
+    FxVectorSum(const Expr &);
+    virtual Expr evalRator(const Expr &) override;
+};
+
+struct FxVectorAdd : Binary {             ///< Element-wise sum of equal-length fxvectors, as a new one
+    FxVectorAdd(const Expr &, const Expr &);
+    virtual Expr evalRator(const Expr &, const Expr &) override;
+};
+
+struct FxVectorMul : Binary {             ///< Element-wise product, as a new fxvector
+    FxVectorMul(const Expr &, const Expr &);
+    virtual Expr evalRator(const Expr &, const Expr &) override;
+};
+
+struct FxVectorEq : Binary {              ///< Same length and elements
+    FxVectorEq(const Expr &, const Expr &);
+    virtual Expr evalRator(const Expr &, const Expr &) override;
+};
+
+// ================================================================================
+//                             HASH TABLE OPERATIONS
+// ================================================================================
+
+struct MakeHashTable : ExprBase {         ///< (make-hash-table) or (make-equal-hash-table)
+    bool equal;
+    MakeHashTable(bool equal);
+    virtual Expr eval(const EnvPtr &) override;
+};
+
+struct IsHashTable : Unary {
+    IsHashTable(const Expr &);
+    virtual Expr evalRator(const Expr &) override;
+};
+
+struct HashRef : Variadic {               ///< (hash-ref table key [default])
+    HashRef(const std::vector<Expr> &);
+    virtual Expr evalRator(const std::vector<Expr> &) override;
+};
+
+struct HashSet : Variadic {               ///< (hash-set! table key value)
+    HashSet(const std::vector<Expr> &);
+    virtual Expr evalRator(const std::vector<Expr> &) override;
+};
+
+struct HashRemove : Binary {
+    HashRemove(const Expr &, const Expr &);
+    virtual Expr evalRator(const Expr &, const Expr &) override;
+};
+
+struct HashCount : Unary {
+    HashCount(const Expr &);
+    virtual Expr evalRator(const Expr &) override;
+};
+
+// ================================================================================
+//                             FUTURES
+// ================================================================================
+
+struct MakeFuture : ExprBase {            ///< (future e): queue e, evaluated in the current frame
+    Expr e;
+    MakeFuture(const Expr &);
+    virtual void trace() const override;
+    virtual Expr eval(const EnvPtr &) override;
+};
+
+struct Touch : Unary {                    ///< Value of a future, waiting for it; any other value as it is
+    Touch(const Expr &);
+    virtual Expr evalRator(const Expr &) override;
+};
+
+struct IsFuture : Unary {
+    IsFuture(const Expr &);
+    virtual Expr evalRator(const Expr &) override;
+};
+
 // ================================================================================
 //                             LOGIC OPERATIONS
 // ================================================================================
@@ -371,16 +818,18 @@ struct Not : Unary {
     virtual Expr evalRator(const Expr &) override;
 };
 
-struct AndVar : ExprBase {
+struct AndVar : Trampolined {
     std::vector<Expr> rands;
     AndVar(const std::vector<Expr> &);
-    virtual Expr eval(const EnvPtr &) override;  
+    virtual void trace() const override;
+    virtual Expr evalTail(const EnvPtr &, TailCall &) override;  
 };
 
-struct OrVar : ExprBase {
+struct OrVar : Trampolined {
     std::vector<Expr> rands;
     OrVar(const std::vector<Expr> &);
-    virtual Expr eval(const EnvPtr &) override;
+    virtual void trace() const override;
+    virtual Expr evalTail(const EnvPtr &, TailCall &) override;
 };
 
 // ================================================================================
@@ -392,6 +841,11 @@ struct IsEq : Binary {
     virtual Expr evalRator(const Expr &, const Expr &) override;
 };
 
+struct IsEqual : Binary {
+    IsEqual(const Expr &, const Expr &);
+    virtual Expr evalRator(const Expr &, const Expr &) override;
+};
+
 struct IsBoolean : Unary {
     IsBoolean(const Expr &);
     virtual Expr evalRator(const Expr &) override;
@@ -436,90 +890,211 @@ struct IsString : Unary {
 //                             CONTROL FLOW CONSTRUCTS
 // ================================================================================
 
-struct Begin : ExprBase {
+struct Begin : Trampolined {
     std::vector<Expr> es;
     Begin(const std::vector<Expr> &);
-    virtual Expr eval(const EnvPtr &) override;
+    virtual void trace() const override;
+    virtual Expr evalTail(const EnvPtr &, TailCall &) override;
 };
 
+/**
+ * @brief Quoted datum
+ * analyze() builds the value once, so every evaluation returns the same
+ * structure and eq? on a literal is consistent; like any literal it must not
+ * be mutated.
+ */
 struct Quote : ExprBase {
-    //Syntax s;
-    Expr ex;
+    Expr ex;                               ///< The datum's value
     Quote(const Expr &);
+    virtual void trace() const override;
     virtual Expr eval(const EnvPtr &) override;
 };
+Expr Quoted(const Expr &);                 ///< Value of a raw datum as produced by parse()
 
 // ================================================================================
 //                             CONDITIONALS
 // ================================================================================
 
-struct If : ExprBase {
+struct If : Trampolined {
   Expr cond;
   Expr conseq;
   Expr alter;
   If(const Expr &, const Expr &, const Expr &);
-  virtual Expr eval(const EnvPtr &) override;
+  virtual void trace() const override;
+  virtual Expr evalTail(const EnvPtr &, TailCall &) override;
 };
 
-struct Cond : ExprBase {
-    std::vector<Expr> clauses;
-    Cond(const std::vector<Expr> &);
-    virtual Expr eval(const EnvPtr &) override;
+/**
+ * @brief One analyzed cond clause
+ * test is null for a trailing else clause; body is null for a clause
+ * consisting of only a test, whose value is returned as is.
+ */
+struct CondClause {
+    Expr test;
+    Expr body;
+};
+
+struct Cond : Trampolined {
+    std::vector<CondClause> clauses;
+    Cond(const std::vector<CondClause> &);
+    virtual void trace() const override;
+    virtual Expr evalTail(const EnvPtr &, TailCall &) override;
 };
 
 // ================================================================================
 //                             VARIABLE AND FUNCITION DEFINITION
 // ================================================================================
 
+/**
+ * @brief Variable reference
+ * A top-level reference caches what it resolved to, the binding's value in
+ * the top-level map (whose elements never move) or the builtin, so later
+ * evaluations are a pointer load until Env::version changes. Futures share
+ * the node, so the cache is atomic and only filled under toplevel_lock.
+ */
 struct Var : ExprBase {
-    std::string x;
-    Var(const std::string &);
+    Symbol x;
+    int depth;                             ///< Frames to walk up from the current one
+    int slot;                              ///< Slot in that frame, -1 for a top-level binding
+    Var(const Symbol &);
+    Var(const Symbol &, int, int);
     virtual void show(std::ostream &os) const override {
-        os << x;
+        os << x.str();
     }
+    virtual void trace() const override;
     virtual Expr eval(const EnvPtr &) override;
+private:
+    std::atomic<const Expr *> cache;       ///< Resolved value, for cache_frame at cache_version
+    std::atomic<Env *> cache_frame;
+    std::atomic<unsigned long> cache_version;   ///< Stored last, so it publishes the other two
+    Expr builtin;                          ///< Primitive or special form cache refers to, set once
+    Expr resolveGlobal(Env *);
 };
 struct SList : ExprBase {
     std::vector<Expr> terms;
     SList(const std::vector<Expr> t);
+    virtual void trace() const override;
     virtual void show(std::ostream &os) const override {
         os << '(';
         for (auto t : terms) {
-            t->show(os);
+            t.show(os);
         }
         os << ')';
     } 
     virtual Expr eval(const EnvPtr &) override;
 };
-struct Apply : ExprBase {
+struct Apply : Trampolined {
     Expr rator;
     std::vector<Expr> rand;
-    Apply(const Expr &, const std::vector<Expr> &);
+    Expr form;                             ///< Raw combination, re-analyzed if rator yields a special form
+    ScopePtr scope;
+    Apply(const Expr &, const std::vector<Expr> &, const Expr &, const ScopePtr &);
+    virtual void trace() const override;
+    virtual Expr evalTail(const EnvPtr &, TailCall &) override;
+};
+
+/**
+ * @brief Combination whose head names a primitive or special form
+ * fast is the specialized node built by the analysis pass, possibly folded to
+ * a constant or to one branch. It is used as long as no define has rebound
+ * any of names; otherwise the form is analyzed again and evaluated as that
+ * says, an ordinary application if the head was rebound.
+ */
+struct Guard : Trampolined {
+    std::vector<Symbol> names;             ///< The head, then the heads of folded subforms fast relies on
+    Expr fast;
+    Expr form;
+    ScopePtr scope;
+    Expr slow;                             ///< form analyzed again, on first use under toplevel_lock
+    Guard(const std::vector<Symbol> &, const Expr &, const Expr &, const ScopePtr &);
+    bool fastApplies(const EnvPtr &) const;   ///< Whether fast is still what the form means
+private:
+    mutable std::atomic<unsigned long> checked_version;   ///< Env::version fastApplies() last decided at, stored last
+    mutable std::atomic<bool> checked_fast;
+    bool decideFast(const EnvPtr &) const;     ///< fastApplies() without the cache, under toplevel_lock
+public:
+    virtual void trace() const override;
+    virtual Expr evalTail(const EnvPtr &, TailCall &) override;
+};
+
+/**
+ * @brief Malformed special form
+ * Analysis errors are reported when the form is evaluated, as they were
+ * before the analysis pass existed.
+ */
+struct BadForm : ExprBase {
+    std::string msg;
+    BadForm(const std::string &);
     virtual Expr eval(const EnvPtr &) override;
 };
 
+/**
+ * @brief lambda
+ * Like Define_f, it keeps the body forms as read and the scope it was
+ * analyzed in, so a heap image can save its procedures as source.
+ */
 struct Lambda : ExprBase {
-    std::vector<std::string> x;
+    std::vector<Symbol> x;
     Expr e;
-    Lambda(const std::vector<std::string> &, const Expr &);
+    size_t frame_size;
+    Symbol name;                           ///< The name a define or let binds it to, else "(lambda (x ...))"
+    std::vector<Expr> source;              ///< Body forms before analysis
+    ScopePtr scope;                        ///< Scope of the lambda expression itself
+    bool reclaimable;                      ///< Call frames are reclaimable, as for Let
+    Lambda(const std::vector<Symbol> &, const Expr &, size_t, const std::vector<Expr> &, const ScopePtr &, bool);
+    virtual void trace() const override;
+    virtual Expr eval(const EnvPtr &) override;
+};
+
+/**
+ * @brief Body of a procedure loaded from a heap image
+ * Analyzed the first time it runs, in the image's scope; the frame comes out
+ * as frame_size, saved with the procedure, says, as analysis lays out the
+ * same names the same way.
+ */
+struct DeferredBody : ExprBase {
+    std::vector<Symbol> x;
+    std::vector<Expr> source;
+    ScopePtr scope;
+    size_t frame_size;
+    DeferredBody(const std::vector<Symbol> &, const std::vector<Expr> &, const ScopePtr &, size_t);
+    Expr body(const EnvPtr &);             ///< The analyzed body; env is a frame it runs in
+    virtual void trace() const override;
     virtual Expr eval(const EnvPtr &) override;
+    virtual Expr evalTail(const EnvPtr &, TailCall &) override;
+private:
+    std::atomic<ExprBase *> analyzed;      ///< Set once, under toplevel_lock
 };
 
 struct Define : ExprBase {
-    std::string var;
+    Symbol var;
+    int slot;                              ///< Slot in the current frame, -1 at top level
     Expr e;
-    Define(const std::string &, const Expr &);
+    Define(const Symbol &, int, const Expr &);
+    virtual void trace() const override;
     virtual Expr eval(const EnvPtr &) override;
 };
 
 struct Define_f : ExprBase {
-    std::string var;
-    std::vector<std::string> x;
-    std::vector<Expr> es;
-    Define_f(const std::string &, std::vector<std::string>&, const std::vector<Expr> &);
+    Symbol var;
+    int slot;                              ///< Slot in the current frame, -1 at top level
+    std::vector<Symbol> x;
+    Expr e;                                ///< Function body (a Begin)
+    size_t frame_size;
+    std::vector<Expr> source;              ///< Body forms before analysis
+    ScopePtr scope;                        ///< Scope of the define
+    bool reclaimable;                      ///< Call frames are reclaimable, as for Let
+    Define_f(const Symbol &, int, const std::vector<Symbol> &, const Expr &, size_t, const std::vector<Expr> &, const ScopePtr &, bool);
+    virtual void trace() const override;
     virtual Expr eval(const EnvPtr &) override;
 };
 
+inline bool Procedure::reclaimable() const {
+    if (origin == nullptr) return false;
+    return origin->e_type == E_LAMBDA ? static_cast<const Lambda*>(origin)->reclaimable
+                                      : static_cast<const Define_f*>(origin)->reclaimable;
+}
+
 struct Primitive : self_evaluating {
     ExprType type;
     Primitive(ExprType);
@@ -543,18 +1118,24 @@ inline Expr SpecialFormE(ExprType et) {return Expr(new SpecialForm(et));};
 //                             BINDING CONSTRUCTS
 // ================================================================================
 
-struct Let : ExprBase {
-    std::vector<std::pair<std::string, Expr>> bind;
-    std::vector<Expr> body;
-    Let(const std::vector<std::pair<std::string, Expr>> &, const std::vector<Expr> &);
-    virtual Expr eval(const EnvPtr &) override;
+struct Let : Trampolined {
+    std::vector<std::pair<int, Expr>> bind;    ///< Slot of each bound name and its init
+    Expr body;                             ///< Body expressions (a Begin)
+    size_t frame_size;
+    bool reclaimable;                      ///< Analysis found no lambda, procedure define or future in the body
+    Let(const std::vector<std::pair<int, Expr>> &, const Expr &, size_t, bool);
+    virtual void trace() const override;
+    virtual Expr evalTail(const EnvPtr &, TailCall &) override;
 };
 
-struct Letrec : ExprBase {
-    std::vector<std::pair<std::string, Expr>> bind;
-    std::vector<Expr> body;
-    Letrec(const std::vector<std::pair<std::string, Expr>> &, const std::vector<Expr> &);
-    virtual Expr eval(const EnvPtr &) override;
+struct Letrec : Trampolined {
+    std::vector<std::pair<int, Expr>> bind;    ///< Slot of each bound name and its init
+    Expr body;                             ///< Body expressions (a Begin)
+    size_t frame_size;
+    bool reclaimable;                      ///< As for Let, with the inits, which run in the frame, counted
+    Letrec(const std::vector<std::pair<int, Expr>> &, const Expr &, size_t, bool);
+    virtual void trace() const override;
+    virtual Expr evalTail(const EnvPtr &, TailCall &) override;
 };
 
 // ================================================================================
@@ -562,9 +1143,13 @@ struct Letrec : ExprBase {
 // ================================================================================
 
 struct Set : ExprBase {
-    std::string var;
+    Symbol var;
+    int depth;                             ///< Lexical address, as in Var
+    int slot;
     Expr e;
-    Set(const std::string &, const Expr &);
+    Set(const Symbol &, int, int, const Expr &);
+    void assign(const EnvPtr &, const Expr &) const;
+    virtual void trace() const override;
     virtual Expr eval(const EnvPtr &) override;
 };
 
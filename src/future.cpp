@@ -0,0 +1,221 @@
+/**
+ * @file future.cpp
+ * @brief Work-stealing pool behind future and touch
+ */
+
+#include "future.hpp"
+#include "output.hpp"
+#include "stats.hpp"
+#include "budget.hpp"
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const size_t MAX_WORKERS = 256;
+
+/**
+ * Lives outside the heap and is a permanent GC root, so queued futures stay
+ * alive. The collector reads the deques while every thread is stopped, and
+ * no thread stops while holding lock.
+ */
+struct Pool : GcObject {
+    std::mutex lock;
+    std::condition_variable cv;            ///< A future was queued or finished, or the pool stops
+    std::vector<std::deque<Future *>> queues;   ///< queues[0] belongs to the main thread, queues[i] to worker i
+    std::vector<std::thread> workers;
+    std::once_flag starting;
+    bool started = false;
+    bool stopping = false;
+    virtual void trace() const override {
+        for (const auto &q : queues) {
+            for (const Future *f : q) gc_mark(f);
+        }
+    }
+};
+
+Pool pool;
+__thread size_t queue_index = 0;           ///< This thread's deque
+
+size_t worker_count() {
+    const char *n = std::getenv("SCHEME_THREADS");
+    if (n != nullptr && *n != '\0') return std::min<size_t>(std::strtoul(n, nullptr, 10), MAX_WORKERS);
+    size_t cores = std::thread::hardware_concurrency();
+    return cores > 1 ? std::min(cores - 1, MAX_WORKERS) : 0;
+}
+
+bool has_work() {
+    for (const auto &q : pool.queues) {
+        if (!q.empty()) return true;
+    }
+    return false;
+}
+
+// A pending future, newest of this thread's first, else oldest of another's.
+// Futures already run by whoever touched them are dropped on the way
+Future *take() {
+    auto &own = pool.queues[queue_index];
+    while (!own.empty()) {
+        Future *f = own.back();
+        own.pop_back();
+        if (f->state == Future::PENDING) return f;
+    }
+    for (size_t i = 1; i < pool.queues.size(); i++) {
+        auto &q = pool.queues[(queue_index + i) % pool.queues.size()];
+        while (!q.empty()) {
+            Future *f = q.front();
+            q.pop_front();
+            if (f->state == Future::PENDING) return f;
+        }
+    }
+    return nullptr;
+}
+
+Future *take_locked() {
+    std::lock_guard<std::mutex> guard(pool.lock);
+    return take();
+}
+
+// Evaluates f here, unless another thread has claimed it, on behalf of its
+// session if it has one
+void run(Future *f) {
+    int pending = Future::PENDING;
+    if (!f->state.compare_exchange_strong(pending, Future::RUNNING)) return;
+    FutureGroup *group = f->group;
+    bool dropped = false;
+    if (group != nullptr) {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        dropped = group->closed;
+        if (!dropped) group->running++;
+    }
+    if (dropped) {
+        f->error = "future of a session that has ended";
+    } else {
+        FutureGroup *outer_group = future_group;
+        std::ostream *outer_output = current_output;
+        if (group != nullptr) {
+            future_group = group;
+            current_output = group->out;
+        }
+        // A future has a step budget of its own, also when its toucher runs it
+        size_t outer_steps = steps_taken;
+        steps_taken = 0;
+        try {
+            f->value = f->body->eval(f->env);
+        } catch (const RuntimeError &RE) {
+            f->error = RE.message();
+        } catch (const std::exception &e) {
+            f->error = e.what();
+        }
+        steps_taken = outer_steps;
+        future_group = outer_group;
+        current_output = outer_output;
+    }
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        f->state.store(Future::DONE, std::memory_order_release);
+        if (group != nullptr && !dropped) group->running--;
+    }
+    pool.cv.notify_all();
+}
+
+void work(size_t index, GcThread *gc) {
+    gc_thread_start(gc, __builtin_frame_address(0));
+    queue_index = index;
+    while (true) {
+        Future *f;
+        {
+            std::lock_guard<std::mutex> guard(pool.lock);
+            if (pool.stopping) break;
+            f = take();
+        }
+        if (f != nullptr) {
+            run(f);
+            runtime_stats_merge();
+            continue;
+        }
+        gc_blocking([] {
+            std::unique_lock<std::mutex> lock(pool.lock);
+            pool.cv.wait(lock, [] { return pool.stopping || has_work(); });
+        });
+    }
+    runtime_stats_merge();
+    gc_thread_exit();
+}
+
+void start() {
+    pool.started = true;
+    size_t n = worker_count();
+    pool.queues.resize(n + 1);
+    gc_add_root(pool);
+    for (size_t i = 1; i <= n; i++) pool.workers.emplace_back(work, i, gc_add_thread());
+}
+
+} // namespace
+
+__thread FutureGroup *future_group = nullptr;
+
+void future_submit(Future *f) {
+    // Server sessions may make their first futures at the same time
+    std::call_once(pool.starting, start);
+    f->group = future_group;
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        auto &own = pool.queues[queue_index];
+        // Futures touched right after they were made are done by now
+        while (!own.empty() && own.back()->state != Future::PENDING) own.pop_back();
+        own.push_back(f);
+    }
+    pool.cv.notify_one();
+}
+
+Expr future_touch(Future *f) {
+    while (true) {
+        int state = f->state.load(std::memory_order_acquire);
+        if (state == Future::DONE) break;
+        if (state == Future::PENDING) {
+            run(f);
+            continue;
+        }
+        // Another thread runs it: help with the queue meanwhile
+        if (Future *other = take_locked()) {
+            run(other);
+            continue;
+        }
+        gc_blocking([f] {
+            std::unique_lock<std::mutex> lock(pool.lock);
+            pool.cv.wait(lock, [f] { return f->state == Future::DONE || has_work(); });
+        });
+    }
+    if (f->value.null()) throw(RuntimeError(f->error));
+    return f->value;
+}
+
+void future_shutdown() {
+    if (!pool.started) return;
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        pool.stopping = true;
+    }
+    pool.cv.notify_all();
+    gc_blocking([] {
+        for (std::thread &t : pool.workers) t.join();
+    });
+    pool.workers.clear();
+}
+
+void future_group_close(FutureGroup *group) {
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        group->closed = true;
+    }
+    gc_blocking([group] {
+        std::unique_lock<std::mutex> lock(pool.lock);
+        pool.cv.wait(lock, [group] { return group->running == 0; });
+    });
+}
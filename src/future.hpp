@@ -0,0 +1,70 @@
+#ifndef FUTURE_HPP
+#define FUTURE_HPP
+
+/**
+ * @file future.hpp
+ * @brief (future e) and (touch f) on a work-stealing pool of threads
+ *
+ * (future e) returns a Future at once and e is evaluated on another thread;
+ * (touch f) waits for it and returns its value, or raises the error e
+ * raised. touch of anything that is not a future returns it unchanged.
+ *
+ * Every thread has a deque of futures. A new future goes on the back of its
+ * creator's deque; a worker takes from the back of its own and, when that is
+ * empty, steals from the front of the others'. A thread touching a future
+ * that has not started runs it itself, and one touching a future another
+ * thread is running runs queued futures until it is done. So recursive
+ * fork-join, such as both halves of a tree fold, spreads over the workers,
+ * and touching a future nobody has picked up yet costs no thread switch. One
+ * lock guards all deques, so a future should do more work than a few
+ * allocations.
+ *
+ * The pool starts with the first future, with SCHEME_THREADS workers, by
+ * default one per hardware thread but one. With SCHEME_THREADS=0 futures run
+ * when they are touched. Futures are evaluated by the tree walker whichever
+ * engine created them, and unprofiled unless the main thread runs them.
+ *
+ * What tasks share: a future's body runs in the frame it was created in, so
+ * it reads the same variables, pairs, vectors and hash tables as its creator
+ * and any other future. touch is the synchronization point: everything done
+ * before (future e) is seen by e, and everything e did is seen after
+ * (touch f) returns.
+ *   - define at top level and set! of a top-level name take a lock and may be
+ *     used from any task; a new name is seen by every thread.
+ *   - set! of a local variable, set-car!, set-cdr!, vector-set!,
+ *     vector-fill!, hash-set! and hash-remove! are not synchronized. While
+ *     tasks run concurrently, none may mutate what another reads or writes:
+ *     mutate before creating the futures or after touching them. A racing
+ *     set! or set-car! leaves readers an unspecified one of the values;
+ *     racing changes to a vector's or hash table's contents can break it.
+ *   - display writes each value whole, but output of concurrent tasks is
+ *     interleaved in no particular order.
+ *   - An error in a future is raised by touch, on the touching thread, each
+ *     time it is touched.
+ *   - When the session ends, running futures are finished and those not
+ *     started are dropped; the same holds for each server session.
+ */
+
+#include "expr.hpp"
+#include <cstddef>
+#include <iostream>
+
+void future_submit(Future *);              ///< Queue a new future
+Expr future_touch(Future *);
+void future_shutdown();                    ///< Stop the workers once their current futures are done
+
+/**
+ * @brief The futures of one server session
+ * They print to the session's connection, and must be done before it is
+ * closed: future_group_close() drops those not started and waits for the
+ * others. A dropped future raises an error if touched.
+ */
+struct FutureGroup {
+    std::ostream *out;
+    std::size_t running;                   ///< Under the pool's lock
+    bool closed;
+};
+extern __thread FutureGroup *future_group;   ///< Of the session this thread works for, or null
+void future_group_close(FutureGroup *);
+
+#endif
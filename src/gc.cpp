@@ -0,0 +1,852 @@
+/**
+ * @file gc.cpp
+ * @brief Mark-sweep collector
+ */
+
+#include "gc.hpp"
+#include "expr.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <unordered_set>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+GcStats gc_stats = {0, 0, 0, 0, 0, 0};
+__thread size_t gc_allocated = 0;
+__thread const char *gc_stack_limit = nullptr;
+size_t gc_threshold = 0;
+std::atomic<bool> gc_stop_world(false);
+size_t gc_max_heap = 0;
+__thread bool gc_heap_exceeded = false;
+
+namespace {
+
+// Small enough that freed objects are reused while still in cache
+const size_t MIN_THRESHOLD = 256 << 10;
+
+const size_t SLAB_SIZE = 64 << 10;
+const size_t CELL_ALIGN = 16;
+const size_t NUM_CLASSES = GC_MAX_CELL / CELL_ALIGN;
+
+const size_t SEGMENT_SIZE = 8 << 20;
+// Stack left when gc_stack_low() turns true, for the C++ between two checks
+const size_t STACK_MARGIN = 256 << 10;
+
+/**
+ * A slab's header sits at the start of its SLAB_SIZE-aligned memory, so any
+ * address inside the slab finds it by masking. Cells [0, limit) have been
+ * handed out; each is either an object or, when the low bit of its first
+ * word is set, a free cell whose first word links to the next free one.
+ * A constructed object's first word is its vtable pointer, never odd.
+ */
+struct SizeClass;
+
+struct Slab {
+    size_t cell;
+    size_t count;
+    size_t limit;
+    SizeClass *owner;                      ///< Size classes of the thread whose free lists get its cells
+    char *cells() { return reinterpret_cast<char *>(this) + header_size(); }
+    static size_t header_size() { return (sizeof(Slab) + CELL_ALIGN - 1) / CELL_ALIGN * CELL_ALIGN; }
+};
+
+struct SizeClass {
+    uintptr_t free;                        ///< First free cell, 0 if none
+    Slab *current;                         ///< Slab new cells are taken from
+};
+
+struct Block {
+    GcObject *p;
+    size_t size;
+};
+
+enum RootKind { ROOT_EXPR, ROOT_ENV, ROOT_VECTOR, ROOT_OBJECT };
+
+struct Root {
+    RootKind kind;
+    const void *p;
+};
+
+/// Part of a thread's stack it left for a deeper segment: from top, where
+/// gc_deeper_stack() switched, to bottom
+struct StackRange {
+    const char *top;
+    const char *bottom;
+    bool scanned;                          ///< found and digest hold what the last collection scanned
+    uint64_t digest;                       ///< Of the words then
+    std::vector<const GcObject *> found;   ///< Objects the scan marked first, in scan order
+};
+
+} // namespace
+
+/**
+ * What the collector needs of a mutator thread, pointing to its thread-local
+ * state. Only read while the thread is stopped.
+ */
+struct GcThread {
+    const char *stack_bottom;              ///< Null until the thread starts; the end of the segment it is on
+    const char *stack_top;                 ///< Where its stack scan starts while it is stopped
+    bool stopped;                          ///< Parked at a safepoint or in gc_blocking()
+    SizeClass *classes;
+    std::vector<Root> *roots;
+    std::vector<StackRange> *suspended;    ///< Stacks it ran on before its current segment, oldest first
+    TailCall *const *active;
+    size_t *allocated;
+    bool *heap_exceeded;
+    size_t *objects;
+    size_t *bytes;
+};
+
+namespace {
+
+// This thread's allocation state
+__thread SizeClass classes[NUM_CLASSES];
+__thread size_t thread_objects = 0;        ///< Not yet added to gc_stats
+__thread size_t thread_bytes = 0;
+thread_local std::vector<Root> roots;
+thread_local std::vector<StackRange> suspended;
+__thread char *spare_segment = nullptr;    ///< Last segment this thread left, kept for the next one
+__thread GcThread *self = nullptr;
+
+std::mutex world_lock;                     ///< Guards threads and the stopped flags
+std::condition_variable world_cv;          ///< A thread stopped, or the world resumed
+std::vector<GcThread *> threads;           ///< The main thread first
+GcThread main_thread;
+std::vector<const GcObject *> permanent_roots;
+
+std::mutex heap_lock;                      ///< Guards the slab pool and large blocks while threads allocate
+std::vector<Slab *> slabs;                 ///< Slabs holding objects
+std::vector<Slab *> empty_slabs;           ///< Slabs left empty by the last sweep, for any size class
+std::unordered_set<uintptr_t> slab_set;    ///< Addresses of all slabs
+std::vector<Block> blocks;                 ///< Objects too large for a slab, in no particular order
+std::vector<const GcObject *> mark_stack;
+std::vector<uintptr_t> slab_index;         ///< Addresses of the slabs holding objects, sorted while collecting
+size_t stack_bytes = 0;                    ///< Size of the last stack scan, all threads together
+size_t payload_bytes = 0;                  ///< What the objects marked so far hold outside the heap
+uintptr_t heap_low = UINTPTR_MAX;          ///< Addresses of all slabs and blocks lie in [heap_low, heap_high)
+uintptr_t heap_high = 0;
+bool sweeping = false;
+bool stress = false;                       ///< SCHEME_GC_STRESS: collect at every safepoint
+std::atomic<size_t> segment_bytes(0);      ///< Stack segments mapped, all threads together
+
+size_t class_index(size_t size) {
+    return (size + CELL_ALIGN - 1) / CELL_ALIGN - 1;
+}
+
+SizeClass &class_of(size_t size) {
+    return classes[class_index(size)];
+}
+
+Slab *slab_of(uintptr_t p) {
+    return reinterpret_cast<Slab *>(p & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+void push_free(SizeClass &c, char *cell) {
+    *reinterpret_cast<uintptr_t *>(cell) = c.free | 1;
+    c.free = reinterpret_cast<uintptr_t>(cell);
+}
+
+void note_range(void *p, size_t size) {
+    heap_low = std::min(heap_low, reinterpret_cast<uintptr_t>(p));
+    heap_high = std::max(heap_high, reinterpret_cast<uintptr_t>(p) + size);
+}
+
+// A slab for this thread's cells of the given size
+Slab *new_slab(size_t cell) {
+    std::lock_guard<std::mutex> guard(heap_lock);
+    Slab *slab;
+    if (!empty_slabs.empty()) {
+        slab = empty_slabs.back();
+        empty_slabs.pop_back();
+    } else {
+        void *mem = nullptr;
+        if (posix_memalign(&mem, SLAB_SIZE, SLAB_SIZE) != 0) throw std::bad_alloc();
+        slab = static_cast<Slab *>(mem);
+        slab_set.insert(reinterpret_cast<uintptr_t>(slab));
+        note_range(mem, SLAB_SIZE);
+    }
+    slab->cell = cell;
+    slab->count = (SLAB_SIZE - Slab::header_size()) / cell;
+    slab->limit = 0;
+    slab->owner = classes;
+    slabs.push_back(slab);
+    return slab;
+}
+
+// The object in the handed-out cell containing p, or null
+GcObject *cell_object(Slab *slab, uintptr_t p) {
+    uintptr_t first = reinterpret_cast<uintptr_t>(slab->cells());
+    if (p < first) return nullptr;
+    size_t i = (p - first) / slab->cell;
+    if (i >= slab->limit) return nullptr;
+    char *cell = slab->cells() + i * slab->cell;
+    if (*reinterpret_cast<uintptr_t *>(cell) & 1) return nullptr;
+    return reinterpret_cast<GcObject *>(cell);
+}
+
+// Sorts what stack words are looked up in, for binary search
+void index_heap() {
+    slab_index.clear();
+    for (const Slab *slab : slabs) slab_index.push_back(reinterpret_cast<uintptr_t>(slab));
+    std::sort(slab_index.begin(), slab_index.end());
+    std::sort(blocks.begin(), blocks.end(), [](const Block &a, const Block &b) { return a.p < b.p; });
+}
+
+bool indexed_slab(uintptr_t slab) {
+    size_t lo = 0, hi = slab_index.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (slab_index[mid] < slab) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < slab_index.size() && slab_index[lo] == slab;
+}
+
+// The large block containing p, or null
+GcObject *block_object(uintptr_t p) {
+    size_t lo = 0, hi = blocks.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (reinterpret_cast<uintptr_t>(blocks[mid].p) <= p) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return nullptr;
+    const Block &b = blocks[lo - 1];
+    return p - reinterpret_cast<uintptr_t>(b.p) < b.size ? b.p : nullptr;
+}
+
+// Reading whole stack words, of this and other threads, is deliberate, so
+// keep AddressSanitizer out of it, and ThreadSanitizer too: a thread in
+// gc_blocking() goes on writing its frames meanwhile, though nothing there
+// refers to the heap. A word pointing anywhere inside an object keeps it
+// alive. Objects marked here first are added to found, if given
+__attribute__((no_sanitize_address, no_sanitize_thread)) void scan_range(const char *top, const char *bottom, std::vector<const GcObject *> *found) {
+    uintptr_t p = reinterpret_cast<uintptr_t>(top) & ~(uintptr_t)(sizeof(uintptr_t) - 1);
+    // Neighbouring words mostly point into the same few slabs
+    Slab *known = nullptr;
+    for (; p + sizeof(uintptr_t) <= reinterpret_cast<uintptr_t>(bottom); p += sizeof(uintptr_t)) {
+        uintptr_t w = *reinterpret_cast<const uintptr_t *>(p);
+        if (w - heap_low >= heap_high - heap_low) continue;
+        Slab *slab = slab_of(w);
+        GcObject *o;
+        if (slab == known || indexed_slab(reinterpret_cast<uintptr_t>(slab))) {
+            known = slab;
+            o = cell_object(slab, w);
+        } else {
+            o = block_object(w);
+        }
+        if (o == nullptr || o->marked) continue;
+        gc_mark(o);
+        if (found != nullptr) found->push_back(o);
+    }
+}
+
+// Each step is a bijection of the digest so far, so a change to any one word
+// always changes the result
+__attribute__((no_sanitize_address)) uint64_t range_digest(const char *top, const char *bottom) {
+    uintptr_t p = reinterpret_cast<uintptr_t>(top) & ~(uintptr_t)(sizeof(uintptr_t) - 1);
+    uint64_t h = 0;
+    for (; p + sizeof(uintptr_t) <= reinterpret_cast<uintptr_t>(bottom); p += sizeof(uintptr_t)) {
+        h = (h ^ *reinterpret_cast<const uintptr_t *>(p)) * 0x9e3779b97f4a7c15ull;
+    }
+    return h;
+}
+
+// A suspended stack that has not changed since the last collection marks
+// again what it marked first then, without being scanned: deep recursion
+// leaves most of its stack suspended, and only the segment it runs on is
+// scanned each cycle. That holds only while every range scanned before it is
+// reused too, and so marks the same objects ahead of it; after a range is
+// rescanned, the ones that follow are as well. True when r was rescanned
+bool scan_suspended(StackRange &r, bool rescanning) {
+    stack_bytes += r.bottom - r.top;
+    uint64_t digest = range_digest(r.top, r.bottom);
+    if (r.scanned && !rescanning && digest == r.digest) {
+        // Cells freed since by gc_free() are dropped: what the range points
+        // to there now is newer than the range, and none of its business
+        size_t out = 0;
+        for (const GcObject *o : r.found) {
+            uintptr_t a = reinterpret_cast<uintptr_t>(o);
+            if (indexed_slab(reinterpret_cast<uintptr_t>(slab_of(a))) && (*reinterpret_cast<const uintptr_t *>(a) & 1)) continue;
+            gc_mark(o);
+            r.found[out++] = o;
+        }
+        r.found.resize(out);
+        return false;
+    }
+    r.scanned = true;
+    r.digest = digest;
+    r.found.clear();
+    scan_range(r.top, r.bottom, &r.found);
+    return true;
+}
+
+// Suspended ranges come first, in the same order every time
+void scan_stacks() {
+    bool rescanning = false;
+    for (const GcThread *t : threads) {
+        if (t->stack_bottom == nullptr) continue;
+        for (StackRange &r : *t->suspended) rescanning = scan_suspended(r, rescanning) || rescanning;
+    }
+    for (const GcThread *t : threads) {
+        if (t->stack_bottom == nullptr) continue;
+        stack_bytes += t->stack_bottom - t->stack_top;
+        scan_range(t->stack_top, t->stack_bottom, nullptr);
+    }
+}
+
+void mark_roots(const GcThread *t) {
+    for (const Root &r : *t->roots) {
+        switch (r.kind) {
+            case ROOT_EXPR: gc_mark(*static_cast<const Expr *>(r.p)); break;
+            case ROOT_ENV: gc_mark(*static_cast<Env *const *>(r.p)); break;
+            case ROOT_VECTOR: gc_mark(*static_cast<const std::vector<Expr> *>(r.p)); break;
+            case ROOT_OBJECT: static_cast<const GcObject *>(r.p)->trace(); break;
+        }
+    }
+    for (const TailCall *k = *t->active; k != nullptr; k = k->prev) {
+        gc_mark(k->expr);
+        gc_mark(k->env);
+        gc_mark(k->running);
+        gc_mark(k->running_env);
+    }
+}
+
+void drain() {
+    while (!mark_stack.empty()) {
+        const GcObject *o = mark_stack.back();
+        mark_stack.pop_back();
+        o->trace();
+    }
+}
+
+void sweep() {
+    sweeping = true;
+    for (GcThread *t : threads) {
+        if (t->stack_bottom == nullptr) continue;
+        for (size_t i = 0; i < NUM_CLASSES; i++) t->classes[i].free = 0;
+    }
+    size_t live = 0;
+    std::vector<Slab *> kept;
+    // Backwards, so the free lists hand out cells in address order
+    for (size_t s = slabs.size(); s-- > 0; ) {
+        Slab *slab = slabs[s];
+        SizeClass &c = slab->owner[class_index(slab->cell)];
+        size_t used = 0;
+        for (size_t i = 0; i < slab->limit; i++) {
+            uintptr_t *cell = reinterpret_cast<uintptr_t *>(slab->cells() + i * slab->cell);
+            if (*cell & 1) continue;
+            GcObject *o = reinterpret_cast<GcObject *>(cell);
+            if (o->marked) {
+                o->marked = false;
+                used++;
+            } else {
+                o->~GcObject();
+                *cell = 1;
+            }
+        }
+        if (used == 0) {
+            // Whole slabs go back to the pool, where runs of adjacent cells come from
+            if (c.current == slab) c.current = nullptr;
+            empty_slabs.push_back(slab);
+            continue;
+        }
+        for (size_t i = slab->limit; i-- > 0; ) {
+            char *cell = slab->cells() + i * slab->cell;
+            if (*reinterpret_cast<uintptr_t *>(cell) & 1) push_free(c, cell);
+        }
+        live += used * slab->cell;
+        kept.push_back(slab);
+    }
+    std::reverse(kept.begin(), kept.end());
+    slabs.swap(kept);
+    size_t out = 0;
+    for (const Block &b : blocks) {
+        if (b.p->marked) {
+            b.p->marked = false;
+            live += b.size;
+            blocks[out++] = b;
+        } else {
+            delete b.p;
+        }
+    }
+    blocks.resize(out);
+    sweeping = false;
+    for (GcThread *t : threads) {
+        if (t->stack_bottom == nullptr) continue;
+        *t->allocated = 0;
+        gc_stats.objects += *t->objects;
+        gc_stats.bytes += *t->bytes;
+        *t->objects = *t->bytes = 0;
+    }
+    gc_stats.collections++;
+    gc_stats.live = live;
+    gc_stats.payload = payload_bytes;
+    gc_stats.segments = segment_bytes.load(std::memory_order_relaxed);
+    // Payloads and native stack segments are memory the program's live state
+    // takes as well, though not allocated from the heap
+    live += gc_stats.payload + gc_stats.segments;
+    // Let the heap double before the next collection, and do not rescan a deep
+    // stack before four times its size is allocated: with the scan linear in
+    // the stack, deep recursion then pays a constant share per frame
+    gc_threshold = stress ? 0 : std::max(std::max(MIN_THRESHOLD, live), 4 * stack_bytes);
+    if (gc_max_heap != 0) {
+        // Unless that would go past the limit
+        size_t room = gc_max_heap - std::min(live, gc_max_heap);
+        gc_threshold = std::min(gc_threshold, std::max(room, MIN_THRESHOLD));
+        if (live > gc_max_heap) {
+            for (GcThread *t : threads) {
+                if (t->stack_bottom != nullptr) *t->heap_exceeded = true;
+            }
+        }
+    }
+
+    // Keep about as many empty slabs as the next cycle can use
+    while (empty_slabs.size() > gc_threshold / SLAB_SIZE + 1) {
+        slab_set.erase(reinterpret_cast<uintptr_t>(empty_slabs.back()));
+        std::free(empty_slabs.back());
+        empty_slabs.pop_back();
+    }
+}
+
+// Gives back memory whose constructor threw. It came from this thread's own
+// free lists or slabs
+void release(void *p) {
+    std::lock_guard<std::mutex> guard(heap_lock);
+    uintptr_t a = reinterpret_cast<uintptr_t>(p);
+    if (slab_set.count(reinterpret_cast<uintptr_t>(slab_of(a)))) {
+        Slab *slab = slab_of(a);
+        push_free(class_of(slab->cell), static_cast<char *>(p));
+        gc_allocated -= std::min(gc_allocated, slab->cell);
+        return;
+    }
+    for (size_t i = blocks.size(); i-- > 0; ) {
+        if (blocks[i].p == p) {
+            gc_allocated -= std::min(gc_allocated, blocks[i].size);
+            blocks.erase(blocks.begin() + i);
+            break;
+        }
+    }
+    std::free(p);
+}
+
+void collect() {
+    // Threads not started yet have nothing to scan
+    stack_bytes = 0;
+    payload_bytes = 0;
+    index_heap();
+    scan_stacks();
+    for (const GcThread *t : threads) {
+        if (t->stack_bottom != nullptr) mark_roots(t);
+    }
+    for (const GcObject *o : permanent_roots) o->trace();
+    drain();
+    sweep();
+}
+
+bool others_stopped() {
+    for (const GcThread *t : threads) {
+        if (t != self && !t->stopped) return false;
+    }
+    return true;
+}
+
+// Waits, stopped, for the collection another thread started to end
+void park(std::unique_lock<std::mutex> &lock) {
+    self->stopped = true;
+    world_cv.notify_all();
+    world_cv.wait(lock, [] { return !gc_stop_world; });
+    self->stopped = false;
+}
+
+// Not inlined, so its frame lies below the caller's spilled registers, and
+// scanning this thread's stack from here covers them
+__attribute__((noinline)) void collect_or_park() {
+    std::unique_lock<std::mutex> lock(world_lock);
+    self->stack_top = static_cast<const char *>(__builtin_frame_address(0));
+    if (gc_stop_world) {
+        park(lock);
+        return;
+    }
+    // Woken by a stop that has ended already
+    if (gc_allocated < gc_threshold) return;
+    gc_stop_world = true;
+    world_cv.wait(lock, others_stopped);
+    collect();
+    gc_stop_world = false;
+    world_cv.notify_all();
+}
+
+void resume() {
+    std::unique_lock<std::mutex> lock(world_lock);
+    world_cv.wait(lock, [] { return !gc_stop_world; });
+    self->stopped = false;
+}
+
+__attribute__((noinline)) void run_blocking(const std::function<void()> &f) {
+    {
+        std::lock_guard<std::mutex> guard(world_lock);
+        self->stack_top = static_cast<const char *>(__builtin_frame_address(0));
+        self->stopped = true;
+        world_cv.notify_all();
+    }
+    try {
+        f();
+    } catch (...) {
+        resume();
+        throw;
+    }
+    resume();
+}
+
+void attach(GcThread *t, void *bottom) {
+    t->stack_bottom = static_cast<const char *>(bottom);
+    t->classes = classes;
+    t->roots = &roots;
+    t->suspended = &suspended;
+    t->active = &TailCall::active;
+    t->allocated = &gc_allocated;
+    t->heap_exceeded = &gc_heap_exceeded;
+    t->objects = &thread_objects;
+    t->bytes = &thread_bytes;
+    self = t;
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        void *low;
+        size_t size;
+        if (pthread_attr_getstack(&attr, &low, &size) == 0) {
+            gc_stack_limit = static_cast<const char *>(low) + std::min(STACK_MARGIN, size / 2);
+        }
+        pthread_attr_destroy(&attr);
+    }
+}
+
+// A segment's lowest page is left unmapped, so running past its end faults
+// rather than writing into whatever lies below
+char *take_segment() {
+    if (spare_segment != nullptr) {
+        char *lo = spare_segment;
+        spare_segment = nullptr;
+        return lo;
+    }
+    static const size_t budget = gc_stack_budget();
+    if (segment_bytes.fetch_add(SEGMENT_SIZE) + SEGMENT_SIZE > budget) {
+        segment_bytes -= SEGMENT_SIZE;
+        return nullptr;
+    }
+    void *mem = mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (mem == MAP_FAILED) {
+        segment_bytes -= SEGMENT_SIZE;
+        return nullptr;
+    }
+    mprotect(mem, sysconf(_SC_PAGESIZE), PROT_NONE);
+    // It counts as live, so it brings the next collection closer too
+    gc_allocate_payload(SEGMENT_SIZE);
+    return static_cast<char *>(mem);
+}
+
+void drop_segment(char *lo) {
+    munmap(lo, SEGMENT_SIZE);
+    segment_bytes -= SEGMENT_SIZE;
+}
+
+void give_back_segment(char *lo) {
+    if (spare_segment == nullptr) spare_segment = lo;
+    else drop_segment(lo);
+}
+
+// AddressSanitizer has to be told when a thread moves to another stack
+#if defined(__SANITIZE_ADDRESS__)
+void start_switch(void **save, const void *bottom, size_t size) { __sanitizer_start_switch_fiber(save, bottom, size); }
+void finish_switch(void *save, const void **bottom, size_t *size) { __sanitizer_finish_switch_fiber(save, bottom, size); }
+#else
+void start_switch(void **, const void *, size_t) {}
+void finish_switch(void *, const void **, size_t *) {}
+#endif
+
+struct SegmentCall {
+    const std::function<void()> *f;
+    std::exception_ptr error;              ///< What f threw, rethrown on the stack it was called from
+    ucontext_t back;
+    const void *from_bottom;               ///< The stack switched from, for AddressSanitizer
+    size_t from_size;
+};
+__thread SegmentCall *segment_call = nullptr;
+
+void segment_main() {
+    SegmentCall *call = segment_call;
+    finish_switch(nullptr, &call->from_bottom, &call->from_size);
+    try {
+        (*call->f)();
+    } catch (...) {
+        call->error = std::current_exception();
+    }
+    // Back through uc_link, leaving this segment for good
+    start_switch(nullptr, call->from_bottom, call->from_size);
+}
+
+// Not inlined, so the stack left behind is scanned from its frame up, which
+// covers the registers gc_deeper_stack() spilled
+__attribute__((noinline)) bool run_on_segment(const std::function<void()> &f) {
+    char *lo = take_segment();
+    if (lo == nullptr) return false;
+    SegmentCall call;
+    call.f = &f;
+    ucontext_t ctx;
+    getcontext(&ctx);
+    ctx.uc_stack.ss_sp = lo;
+    ctx.uc_stack.ss_size = SEGMENT_SIZE;
+    ctx.uc_link = &call.back;
+    makecontext(&ctx, segment_main, 0);
+
+    const char *limit = gc_stack_limit;
+    SegmentCall *outer = segment_call;
+    suspended.push_back(StackRange{static_cast<const char *>(__builtin_frame_address(0)), self->stack_bottom, false, 0, {}});
+    self->stack_bottom = lo + SEGMENT_SIZE;
+    gc_stack_limit = lo + STACK_MARGIN;
+    segment_call = &call;
+    void *fake = nullptr;
+    start_switch(&fake, lo, SEGMENT_SIZE);
+    swapcontext(&call.back, &ctx);
+    finish_switch(fake, nullptr, nullptr);
+    segment_call = outer;
+    gc_stack_limit = limit;
+    self->stack_bottom = suspended.back().bottom;
+    suspended.pop_back();
+    give_back_segment(lo);
+    if (call.error) std::rethrow_exception(call.error);
+    return true;
+}
+
+} // namespace
+
+GcObject::GcObject() : marked(false) {}
+
+// A copy is a separate allocation with its own mark
+GcObject::GcObject(const GcObject &) : marked(false) {}
+
+GcObject &GcObject::operator=(const GcObject &) {
+    return *this;
+}
+
+void GcObject::trace() const {}
+
+void *GcObject::operator new(size_t size) {
+    return gc_allocate(size);
+}
+
+void *GcObject::operator new(size_t, void *p) {
+    return p;
+}
+
+void GcObject::operator delete(void *p) {
+    // Large blocks are freed here by the sweep; otherwise a constructor threw
+    if (sweeping) {
+        std::free(p);
+        return;
+    }
+    release(p);
+}
+
+void GcObject::operator delete(void *p, void *) {
+    release(p);
+}
+
+void *gc_allocate(size_t size) {
+    if (size > GC_MAX_CELL) {
+        void *p = std::malloc(size);
+        if (p == nullptr) throw std::bad_alloc();
+        {
+            std::lock_guard<std::mutex> guard(heap_lock);
+            blocks.push_back(Block{static_cast<GcObject *>(p), size});
+            note_range(p, size);
+        }
+        gc_allocated += size;
+        thread_objects++;
+        thread_bytes += size;
+        return p;
+    }
+    SizeClass &c = class_of(size);
+    size_t cell = (size + CELL_ALIGN - 1) / CELL_ALIGN * CELL_ALIGN;
+    gc_allocated += cell;
+    thread_objects++;
+    thread_bytes += cell;
+    if (c.free != 0) {
+        char *p = reinterpret_cast<char *>(c.free);
+        c.free = *reinterpret_cast<uintptr_t *>(p) & ~(uintptr_t)1;
+        return p;
+    }
+    if (c.current == nullptr || c.current->limit == c.current->count) c.current = new_slab(cell);
+    return c.current->cells() + cell * c.current->limit++;
+}
+
+void gc_free(void *p, size_t size) {
+    push_free(class_of(size), static_cast<char *>(p));
+    gc_allocated -= std::min(gc_allocated, (size + CELL_ALIGN - 1) / CELL_ALIGN * CELL_ALIGN);
+}
+
+char *gc_allocate_run(size_t size, size_t &n, size_t &stride) {
+    SizeClass &c = class_of(size);
+    stride = (size + CELL_ALIGN - 1) / CELL_ALIGN * CELL_ALIGN;
+    Slab *slab = c.current;
+    if (slab == nullptr || slab->count - slab->limit < std::min(n, (SLAB_SIZE - Slab::header_size()) / stride)) {
+        bool pooled;
+        {
+            std::lock_guard<std::mutex> guard(heap_lock);
+            pooled = !empty_slabs.empty();
+        }
+        if (!pooled && c.free != 0) {
+            // Reuse a free cell rather than grow the heap for the sake of adjacency
+            n = 1;
+            return static_cast<char *>(gc_allocate(size));
+        }
+        // Leave what is left of the current slab to the free list
+        for (; slab != nullptr && slab->limit < slab->count; slab->limit++) {
+            push_free(c, slab->cells() + slab->limit * stride);
+        }
+        slab = c.current = new_slab(stride);
+    }
+    n = std::min(n, slab->count - slab->limit);
+    char *run = slab->cells() + slab->limit * stride;
+    slab->limit += n;
+    gc_allocated += n * stride;
+    thread_objects += n;
+    thread_bytes += n * stride;
+    return run;
+}
+
+void gc_mark(const GcObject *o) {
+    if (o == nullptr || o->marked) return;
+    o->marked = true;
+    mark_stack.push_back(o);
+}
+
+void gc_mark_payload(size_t bytes) {
+    payload_bytes += bytes;
+}
+
+bool gc_within_budget(size_t bytes) {
+    size_t live = gc_stats.live + gc_stats.payload + gc_stats.segments;
+    return gc_max_heap == 0 || (bytes <= gc_max_heap && live <= gc_max_heap - bytes);
+}
+
+void gc_mark(const Expr &e) {
+    gc_mark(static_cast<const GcObject *>(e.get()));
+}
+
+void gc_mark(const std::vector<Expr> &v) {
+    for (const Expr &e : v) gc_mark(e);
+}
+
+GcRoot::GcRoot(const Expr &e) {
+    roots.push_back(Root{ROOT_EXPR, &e});
+}
+
+GcRoot::GcRoot(Env *const &env) {
+    roots.push_back(Root{ROOT_ENV, &env});
+}
+
+GcRoot::GcRoot(const std::vector<Expr> &v) {
+    roots.push_back(Root{ROOT_VECTOR, &v});
+}
+
+GcRoot::GcRoot(const GcObject &o) {
+    roots.push_back(Root{ROOT_OBJECT, &o});
+}
+
+GcRoot::~GcRoot() {
+    roots.pop_back();
+}
+
+void gc_add_root(const GcObject &o) {
+    std::lock_guard<std::mutex> guard(world_lock);
+    permanent_roots.push_back(&o);
+}
+
+void gc_init(void *bottom) {
+    attach(&main_thread, bottom);
+    threads.push_back(&main_thread);
+    stress = std::getenv("SCHEME_GC_STRESS") != nullptr;
+    gc_threshold = stress ? 0 : MIN_THRESHOLD;
+}
+
+void gc_collect() {
+    // Spill callee-saved registers into this frame so the stack scan sees them.
+    // The empty asm keeps the call out of tail position: a tail call would pop
+    // this frame, and the spilled registers with it, before the scan
+    __builtin_unwind_init();
+    collect_or_park();
+    __asm__ volatile("");
+}
+
+GcThread *gc_add_thread() {
+    GcThread *t = new GcThread();
+    t->stopped = true;
+    std::lock_guard<std::mutex> guard(world_lock);
+    threads.push_back(t);
+    return t;
+}
+
+void gc_thread_start(GcThread *t, void *bottom) {
+    std::unique_lock<std::mutex> lock(world_lock);
+    world_cv.wait(lock, [] { return !gc_stop_world; });
+    attach(t, bottom);
+    t->stopped = false;
+}
+
+void gc_thread_exit() {
+    std::unique_lock<std::mutex> lock(world_lock);
+    world_cv.wait(lock, [] { return !gc_stop_world; });
+    gc_stats.objects += thread_objects;
+    gc_stats.bytes += thread_bytes;
+    {
+        // Other threads add slabs under heap_lock alone; it nests inside world_lock
+        std::lock_guard<std::mutex> guard(heap_lock);
+        // The main thread's free lists take over this thread's cells at the next sweep
+        for (Slab *slab : slabs) {
+            if (slab->owner == classes) slab->owner = main_thread.classes;
+        }
+    }
+    threads.erase(std::find(threads.begin(), threads.end(), self));
+    if (spare_segment != nullptr) drop_segment(spare_segment);
+    spare_segment = nullptr;
+    delete self;
+    self = nullptr;
+}
+
+void gc_blocking(const std::function<void()> &f) {
+    // As in gc_collect: the frames above run_blocking() are what gets scanned
+    __builtin_unwind_init();
+    run_blocking(f);
+    __asm__ volatile("");
+}
+
+size_t gc_stack_budget() {
+    return static_cast<size_t>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE) / 4;
+}
+
+bool gc_deeper_stack(const std::function<void()> &f) {
+    // As in gc_collect, for the stack left behind
+    __builtin_unwind_init();
+    bool ran = run_on_segment(f);
+    __asm__ volatile("");
+    return ran;
+}
+
+GcStats gc_flush_stats() {
+    std::lock_guard<std::mutex> guard(world_lock);
+    gc_stats.objects += thread_objects;
+    gc_stats.bytes += thread_bytes;
+    thread_objects = thread_bytes = 0;
+    return gc_stats;
+}
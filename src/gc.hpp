@@ -0,0 +1,186 @@
+#ifndef GC_HPP
+#define GC_HPP
+
+/**
+ * @file gc.hpp
+ * @brief Mark-sweep collector for expressions, values and environment frames
+ *
+ * Every ExprBase and Env is allocated through GcObject::operator new and
+ * reclaimed by gc_collect() once nothing reaches it. Objects up to
+ * GC_MAX_CELL bytes live in 64KB slabs of equally sized cells, one size
+ * class per 16 bytes, and freed cells are reused first; larger objects come
+ * from malloc.
+ *
+ * Collection only happens at gc_safepoint(), which the evaluator calls
+ * between trampoline steps and the REPL calls between top-level forms, never
+ * in the middle of building an object. The roots are:
+ *   - the native stack, with any segments deep recursion moved on to, and
+ *     callee-saved registers, scanned conservatively, so Expr and Env*
+ *     locals need no registration;
+ *   - the bodies and frames currently run by the trampoline (TailCall);
+ *   - scoped GcRoot registrations, for values the stack scan cannot see,
+ *     such as the heap buffer of a std::vector<Expr> of temporaries.
+ *
+ * Futures run on other threads (future.hpp), each a mutator with its own
+ * stack, GcRoots, TailCall chain and free lists. A collection stops all of
+ * them: the thread that reaches its threshold sets gc_stop_world and waits
+ * until every other thread has parked at its next safepoint or is blocked in
+ * gc_blocking(), then scans every stack and wakes them. Mutators only
+ * allocate from slabs they own, so the allocation fast path takes no lock.
+ */
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+struct Expr;
+struct Env;
+
+struct GcObject {
+    mutable bool marked;
+    GcObject();
+    GcObject(const GcObject &);
+    GcObject &operator=(const GcObject &);
+    virtual void trace() const;            ///< gc_mark() every Expr and Env held directly
+    virtual ~GcObject() = default;
+    static void *operator new(std::size_t);
+    static void *operator new(std::size_t, void *);   ///< Construct in a cell from gc_allocate_run()
+    static void operator delete(void *);
+    static void operator delete(void *, void *);
+};
+
+const std::size_t GC_MAX_CELL = 256;
+
+void *gc_allocate(std::size_t);
+/**
+ * @brief Allocate adjacent cells, e.g. for the pairs of one list
+ * Hands out up to n consecutive cells for objects of size bytes (at most
+ * GC_MAX_CELL), lowering n to the number obtained; cell i is at
+ * result + i * stride. Objects must be constructed with placement new before
+ * the next safepoint.
+ */
+char *gc_allocate_run(std::size_t size, std::size_t &n, std::size_t &stride);
+
+/**
+ * @brief Give back at once the memory of an object nothing can reach anymore
+ * For an object of size bytes, at most GC_MAX_CELL, that this thread
+ * allocated, no other object refers to, and the caller has destroyed. Its
+ * cell is the next this thread gets for that size, and it no longer counts
+ * toward the next collection. Stale words left on the stack are ignored, as
+ * for any free cell.
+ */
+void gc_free(void *, std::size_t size);
+
+void gc_mark(const GcObject *);
+void gc_mark(const Expr &);
+void gc_mark(const std::vector<Expr> &);
+
+/**
+ * @brief Scoped GC root
+ * Roots are released in reverse order of registration, which scoping gives.
+ */
+class GcRoot {
+public:
+    explicit GcRoot(const Expr &);
+    explicit GcRoot(Env *const &);
+    explicit GcRoot(const std::vector<Expr> &);
+    explicit GcRoot(const GcObject &);     ///< An object outside the heap; its trace() is the root set
+    ~GcRoot();
+    GcRoot(const GcRoot &) = delete;
+    GcRoot &operator=(const GcRoot &) = delete;
+};
+
+/// Root for the rest of the run, belonging to no thread: an object outside the heap whose trace() is the root set
+void gc_add_root(const GcObject &);
+
+void gc_init(void *stack_bottom);          ///< Call from main with its own frame address
+/// Collect, or with other threads running, stop them first or join the collection one of them started
+void gc_collect();
+
+/**
+ * @brief Another thread that will allocate
+ * gc_add_thread() is called by the thread starting it, before it starts, so
+ * no collection can miss it; the new thread then calls gc_thread_start()
+ * first thing and gc_thread_exit() last.
+ */
+struct GcThread;
+GcThread *gc_add_thread();
+void gc_thread_start(GcThread *, void *stack_bottom);
+void gc_thread_exit();
+
+/**
+ * @brief Run f, which blocks and does not touch the heap, letting other threads collect meanwhile
+ * Objects only f's own frames refer to are not roots while it runs.
+ */
+void gc_blocking(const std::function<void()> &f);
+
+/**
+ * @brief Native stack segments, for evaluation nested deeper than a thread's stack
+ * gc_stack_low() is true once the calling thread has less than a safety
+ * margin of stack left. gc_deeper_stack() then runs f on a fresh segment,
+ * which the collector scans along with the stacks it was entered from, and
+ * rethrows any exception f throws. Segments come from the process's memory,
+ * up to gc_stack_budget() in all, rather than from ulimit -s; when none can
+ * be had it returns false without running f.
+ */
+extern __thread const char *gc_stack_limit;
+inline bool gc_stack_low() {
+    char probe;
+    return &probe < gc_stack_limit;
+}
+bool gc_deeper_stack(const std::function<void()> &f);
+std::size_t gc_stack_budget();             ///< A quarter of the physical memory
+
+/**
+ * @brief Running totals since gc_init(), reported by --stats
+ * Other threads' allocations are added in at each collection and when they
+ * exit; gc_flush_stats() adds the calling thread's and returns a copy.
+ */
+struct GcStats {
+    std::size_t objects;                   ///< Objects allocated
+    std::size_t bytes;                     ///< Bytes allocated, rounded up to whole cells
+    std::size_t collections;
+    std::size_t live;                      ///< Bytes of cells and large objects the last collection kept
+    std::size_t payload;                   ///< Bytes outside the heap those objects held then
+    std::size_t segments;                  ///< Bytes of stack segments mapped then
+};
+extern GcStats gc_stats;
+GcStats gc_flush_stats();
+
+extern __thread std::size_t gc_allocated;  ///< Bytes this thread allocated since the last collection
+extern std::size_t gc_threshold;           ///< Collect once gc_allocated reaches this
+extern std::atomic<bool> gc_stop_world;    ///< Another thread waits to collect
+
+inline void gc_safepoint() {
+    if (gc_allocated >= gc_threshold || gc_stop_world.load(std::memory_order_relaxed)) gc_collect();
+}
+
+/**
+ * @brief Memory outside the heap that objects own, such as a vector's items
+ * A constructor passes what it took to gc_allocate_payload(), so making such
+ * objects brings the next collection closer as allocating cells does, and
+ * trace() passes what the object holds to gc_mark_payload(), so it counts as
+ * live. Vectors, fxvectors, strings, hash tables, bignums and the VM's
+ * stacks are counted.
+ */
+inline void gc_allocate_payload(std::size_t bytes) {
+    gc_allocated += bytes;
+}
+void gc_mark_payload(std::size_t bytes);
+
+/**
+ * @brief --max-heap: a limit on the bytes a collection may find live
+ * These are the cells and large objects marked, their payloads and the native
+ * stack segments mapped for deep recursion, gc_stats' live, payload and
+ * segments together.
+ * Collections come early enough that the heap stays within about the limit.
+ * One that finds more live sets gc_heap_exceeded in every thread, and the
+ * evaluators fail the form each is running (see budget.hpp). The limit is on
+ * the whole process, so every server session's form fails, whichever grew.
+ * Zero for no limit.
+ */
+extern std::size_t gc_max_heap;
+extern __thread bool gc_heap_exceeded;
+bool gc_within_budget(std::size_t bytes);  ///< Whether bytes more could be live
+
+#endif
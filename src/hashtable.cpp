@@ -0,0 +1,164 @@
+/**
+ * @file hashtable.cpp
+ * @brief Open-addressing hash table behind make-hash-table
+ */
+
+#include "expr.hpp"
+#include <functional>
+
+namespace {
+
+// Final mix of murmur3: spreads pointer and small-integer words over all bits
+size_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+size_t combine(size_t seed, size_t h) {
+    return mix(seed ^ (h + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2)));
+}
+
+// Consistent with H_IsEq: symbols by name, everything else by identity
+size_t eqHash(const Expr &v) {
+    if (v.type() == E_VAR) return mix(static_cast<Var*>(v.get())->x.hash());
+    return mix(v.word());
+}
+
+// Consistent with H_IsEqual. Looks at no more than a bounded number of
+// elements, so hashing a long list costs O(1) and never recurses.
+size_t equalHash(const Expr &root) {
+    const int BUDGET = 32;
+    const Expr *pending[BUDGET];           // Point into the objects, which do not change while hashing
+    int n = 0, budget = BUDGET;
+    pending[n++] = &root;
+    size_t h = 0;
+    while (n > 0 && budget-- > 0) {
+        const Expr &v = *pending[--n];
+        ExprType t = v.type();
+        h = combine(h, t);
+        switch (t) {
+            case E_PAIR: {
+                Pair *p = static_cast<Pair*>(v.get());
+                // The cdr is looked at next, then the car
+                if (n + 2 <= BUDGET) pending[n++] = &p->car;
+                if (n + 1 <= BUDGET) pending[n++] = &p->cdr;
+                break;
+            }
+            case E_VECTOR: {
+                const std::vector<Expr> &items = static_cast<Vector*>(v.get())->items;
+                h = combine(h, items.size());
+                for (size_t i = 0; i < items.size() && n < BUDGET; i++) pending[n++] = &items[i];
+                break;
+            }
+            case E_FXVECTOR: {
+                const std::vector<int64_t> &items = static_cast<FxVector*>(v.get())->items;
+                h = combine(h, items.size());
+                for (size_t i = 0; i < items.size() && i < static_cast<size_t>(BUDGET); i++) h = combine(h, items[i]);
+                break;
+            }
+            case E_STRING: h = combine(h, std::hash<std::string>()(static_cast<StringExpr*>(v.get())->s)); break;
+            // Numbers are kept normalized, so equal values print alike
+            case E_BIGNUM: h = combine(h, std::hash<std::string>()(static_cast<Bignum*>(v.get())->n.toString())); break;
+            case E_RATIONAL: {
+                RationalNum *r = static_cast<RationalNum*>(v.get());
+                h = combine(h, std::hash<std::string>()(r->numerator.toString() + "/" + r->denominator.toString()));
+                break;
+            }
+            default: h = combine(h, eqHash(v));
+        }
+    }
+    return h;
+}
+
+const size_t MIN_SLOTS = 8;
+
+} // namespace
+
+HashTable::HashTable(bool equal)
+    : self_evaluating(E_HASHTABLE), equal(equal), slots(MIN_SLOTS, Slot{Expr(nullptr), Expr(nullptr), 0, false}), count(0), used(0) {
+    gc_allocate_payload(slots.capacity() * sizeof(Slot));
+}
+
+size_t HashTable::hashOf(const Expr &key) const {
+    return equal ? equalHash(key) : eqHash(key);
+}
+
+size_t HashTable::probe(const Expr &key, size_t hash) const {
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        const Slot &s = slots[i];
+        if (s.key.null()) {
+            if (!s.removed) return i;
+        } else if (s.hash == hash && (equal ? H_IsEqual(s.key, key) : H_IsEq(s.key, key))) {
+            return i;
+        }
+    }
+}
+
+const Expr *HashTable::find(const Expr &key) const {
+    const Slot &s = slots[probe(key, hashOf(key))];
+    return s.key.null() ? nullptr : &s.value;
+}
+
+void HashTable::set(const Expr &key, const Expr &value) {
+    size_t hash = hashOf(key);
+    size_t i = probe(key, hash);
+    if (!slots[i].key.null()) {
+        slots[i].value = value;
+        return;
+    }
+    if ((used + 1) * 2 > slots.size()) {
+        grow();
+        i = probe(key, hash);
+    }
+    // Reuse the first removed slot of the chain, if there is one
+    size_t mask = slots.size() - 1;
+    for (size_t j = hash & mask; j != i; j = (j + 1) & mask) {
+        if (slots[j].removed) {
+            slots[j].removed = false;
+            used--;
+            i = j;
+            break;
+        }
+    }
+    slots[i] = Slot{key, value, hash, false};
+    count++;
+    used++;
+}
+
+bool HashTable::remove(const Expr &key) {
+    Slot &s = slots[probe(key, hashOf(key))];
+    if (s.key.null()) return false;
+    s = Slot{Expr(nullptr), Expr(nullptr), 0, true};
+    count--;
+    return true;
+}
+
+// Rebuilds for count + 1 entries at most a third full, dropping removed slots
+void HashTable::grow() {
+    size_t size = MIN_SLOTS;
+    while (size < (count + 1) * 3) size *= 2;
+    std::vector<Slot> old(size, Slot{Expr(nullptr), Expr(nullptr), 0, false});
+    gc_allocate_payload(size * sizeof(Slot));
+    old.swap(slots);
+    size_t mask = size - 1;
+    for (const Slot &s : old) {
+        if (s.key.null()) continue;
+        size_t i = s.hash & mask;
+        while (!slots[i].key.null()) i = (i + 1) & mask;
+        slots[i] = s;
+    }
+    used = count;
+}
+
+void HashTable::trace() const {
+    gc_mark_payload(slots.capacity() * sizeof(Slot));
+    for (const Slot &s : slots) {
+        gc_mark(s.key);
+        gc_mark(s.value);
+    }
+}
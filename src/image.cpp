@@ -0,0 +1,662 @@
+/**
+ * @file image.cpp
+ * @brief Writing and mapping heap image files
+ */
+
+#include "image.hpp"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern std::unordered_map<Symbol, ExprType> primitives;
+extern std::unordered_map<Symbol, ExprType> reserved_words;
+
+namespace {
+
+const char MAGIC[8] = {'S', 'C', 'M', 'I', 'M', 'G', '2', '\n'};
+const char FORMS_MAGIC[8] = {'S', 'C', 'M', 'F', 'R', 'M', '1', '\n'};
+
+/**
+ * @brief Sections and records
+ * A section is a count of records, the records, and a count of roots and
+ * their references. Each record is its kind, its length in bytes and the fields below. Numbers are
+ * 64-bit in host byte order, strings a length and their bytes, references
+ * 0 for null, an immediate's word, or (n + 1) << 3 for object n. Object 0 is
+ * the top-level frame and has no record. A scope comes after its parent, so
+ * scopes are made in the first pass; everything else may refer forwards.
+ */
+enum Kind : uint8_t {
+    K_PAIR,                    ///< car cdr
+    K_STRING,                  ///< string
+    K_SYMBOL,                  ///< name
+    K_BIGNUM,                  ///< decimal string
+    K_RATIONAL,                ///< numerator denominator, reduced
+    K_VECTOR,                  ///< n, n references
+    K_FXVECTOR,                ///< n, n numbers
+    K_HASHTABLE,               ///< equal?, n, n keys and values
+    K_PRIMITIVE,               ///< name
+    K_SPECIALFORM,             ///< name
+    K_PROCEDURE,               ///< name, parameters, frame size, scope, frame, body forms
+    K_FRAME,                   ///< size, parent, size slots
+    K_SCOPE,                   ///< parent, names
+    K_FORM,                    ///< n, n terms of a combination as read
+    K_NUMBER_LITERAL,          ///< number, a fixnum as read
+    K_BOOLEAN_LITERAL,         ///< 0 or 1, as read
+};
+
+// Writes a section; procedures may refer to top_level, if it is not null
+class Writer {
+public:
+    Writer(const Env *top_level) : top(top_level) {}
+    std::string write(const std::vector<Expr> &roots);
+private:
+    struct Item {
+        Kind kind;
+        const void *p;
+        Expr value;
+    };
+    const Env *top;
+    std::vector<Item> items;               ///< Objects 1 and up
+    std::unordered_map<const void *, uint64_t> numbers;
+    std::unordered_map<Symbol, uint64_t> symbols;   ///< Symbols are saved once per name
+    std::string out;
+
+    void u64(uint64_t n) { out.append(reinterpret_cast<const char *>(&n), sizeof n); }
+    void str(const std::string &s) {
+        u64(s.size());
+        out += s;
+    }
+    uint64_t number(Kind, const void *, const Expr &);
+    uint64_t ref(const Expr &);
+    uint64_t frame(const Env *);
+    uint64_t scope(const ScopePtr &);
+    void record(const Item &);
+};
+
+uint64_t Writer::number(Kind kind, const void *p, const Expr &value) {
+    auto it = numbers.find(p);
+    if (it != numbers.end()) return it->second;
+    items.push_back(Item{kind, p, value});
+    uint64_t n = items.size();
+    numbers.emplace(p, n);
+    return n;
+}
+
+uint64_t Writer::ref(const Expr &v) {
+    if (v.null()) return 0;
+    if (v.is_fixnum() || v.word() & 7) return v.word();
+    Kind kind;
+    switch (v.type()) {
+        case E_PAIR: kind = K_PAIR; break;
+        case E_STRING: kind = K_STRING; break;
+        case E_VAR: {
+            const Symbol &x = static_cast<Var*>(v.get())->x;
+            auto it = symbols.find(x);
+            if (it != symbols.end()) return (it->second + 1) << 3;
+            uint64_t n = number(K_SYMBOL, v.get(), v);
+            symbols.emplace(x, n);
+            return (n + 1) << 3;
+        }
+        case E_BIGNUM: kind = K_BIGNUM; break;
+        case E_RATIONAL: kind = K_RATIONAL; break;
+        case E_VECTOR: kind = K_VECTOR; break;
+        case E_FXVECTOR: kind = K_FXVECTOR; break;
+        case E_HASHTABLE: kind = K_HASHTABLE; break;
+        case E_PRIMITIVE: kind = K_PRIMITIVE; break;
+        case E_SPECIALFORM: kind = K_SPECIALFORM; break;
+        case E_PROC: kind = K_PROCEDURE; break;
+        case E_SLIST: kind = K_FORM; break;
+        case E_FIXNUM: kind = K_NUMBER_LITERAL; break;
+        case E_BOOLEAN: kind = K_BOOLEAN_LITERAL; break;
+        default:
+            throw(RuntimeError(std::string("cannot save a ") + type_name(v.type()) + " in an image"));
+    }
+    return (number(kind, v.get(), v) + 1) << 3;
+}
+
+uint64_t Writer::frame(const Env *e) {
+    if (e == nullptr) return 0;
+    if (e->top) {
+        // Only the frame being saved and its prelude can be reached
+        if (top == nullptr || (e != top && e != top->top->prelude)) throw(RuntimeError("cannot save another top-level frame"));
+        return 1 << 3;
+    }
+    return (number(K_FRAME, e, Expr(nullptr)) + 1) << 3;
+}
+
+uint64_t Writer::scope(const ScopePtr &s) {
+    if (!s) return 0;
+    auto it = numbers.find(s.get());
+    if (it != numbers.end()) return (it->second + 1) << 3;
+    scope(s->parent);
+    return (number(K_SCOPE, s.get(), Expr(nullptr)) + 1) << 3;
+}
+
+// Names of primitives and special forms, by type
+const std::string &builtinName(const std::unordered_map<Symbol, ExprType> &table, ExprType type) {
+    for (const auto &entry : table) {
+        if (entry.second == type) return entry.first.str();
+    }
+    throw(RuntimeError("builtin without a name"));
+}
+
+void Writer::record(const Item &item) {
+    out += static_cast<char>(item.kind);
+    size_t length_at = out.size();
+    u64(0);
+    size_t start = out.size();
+    const Expr &v = item.value;
+    switch (item.kind) {
+        case K_PAIR: {
+            auto p = static_cast<Pair*>(v.get());
+            u64(ref(p->car));
+            u64(ref(p->cdr));
+            break;
+        }
+        case K_STRING: str(static_cast<StringExpr*>(v.get())->s); break;
+        case K_SYMBOL: str(static_cast<Var*>(v.get())->x.str()); break;
+        case K_BIGNUM: str(static_cast<Bignum*>(v.get())->n.toString()); break;
+        case K_RATIONAL: {
+            auto r = static_cast<RationalNum*>(v.get());
+            str(r->numerator.toString());
+            str(r->denominator.toString());
+            break;
+        }
+        case K_VECTOR: {
+            const auto &items = static_cast<Vector*>(v.get())->items;
+            u64(items.size());
+            for (const Expr &x : items) u64(ref(x));
+            break;
+        }
+        case K_FXVECTOR: {
+            const auto &items = static_cast<FxVector*>(v.get())->items;
+            u64(items.size());
+            for (int64_t x : items) u64(x);
+            break;
+        }
+        case K_HASHTABLE: {
+            auto h = static_cast<HashTable*>(v.get());
+            u64(h->equal);
+            u64(h->count);
+            for (const auto &s : h->slots) {
+                if (s.key.null()) continue;
+                u64(ref(s.key));
+                u64(ref(s.value));
+            }
+            break;
+        }
+        case K_PRIMITIVE: str(builtinName(primitives, static_cast<Primitive*>(v.get())->type)); break;
+        case K_SPECIALFORM: str(builtinName(reserved_words, static_cast<SpecialForm*>(v.get())->type)); break;
+        case K_PROCEDURE: {
+            auto p = static_cast<Procedure*>(v.get());
+            const std::vector<Expr> *source;
+            const ScopePtr *s;
+            if (p->origin->e_type == E_LAMBDA) {
+                auto l = static_cast<const Lambda*>(p->origin);
+                source = &l->source;
+                s = &l->scope;
+            } else {
+                auto f = static_cast<const Define_f*>(p->origin);
+                source = &f->source;
+                s = &f->scope;
+            }
+            str(p->name().str());
+            u64(p->parameters->size());
+            for (const Symbol &x : *p->parameters) str(x.str());
+            u64(p->frame_size);
+            u64(scope(*s));
+            u64(frame(p->env));
+            u64(source->size());
+            for (const Expr &x : *source) u64(ref(x));
+            break;
+        }
+        case K_FRAME: {
+            auto e = static_cast<const Env*>(item.p);
+            u64(e->size);
+            u64(frame(e->parent));
+            for (size_t i = 0; i < e->size; i++) u64(ref(e->slots[i]));
+            break;
+        }
+        case K_SCOPE: {
+            auto s = static_cast<const Scope*>(item.p);
+            u64(scope(s->parent));
+            u64(s->names.size());
+            for (const Symbol &x : s->names) str(x.str());
+            break;
+        }
+        case K_FORM: {
+            const auto &terms = static_cast<SList*>(v.get())->terms;
+            u64(terms.size());
+            for (const Expr &x : terms) u64(ref(x));
+            break;
+        }
+        case K_NUMBER_LITERAL: u64(static_cast<Fixnum*>(v.get())->n); break;
+        case K_BOOLEAN_LITERAL: u64(static_cast<Boolean*>(v.get())->b); break;
+    }
+    uint64_t length = out.size() - start;
+    std::memcpy(&out[length_at], &length, sizeof length);
+}
+
+std::string Writer::write(const std::vector<Expr> &roots) {
+    std::vector<uint64_t> refs;
+    for (const Expr &x : roots) refs.push_back(ref(x));
+    // Recording an object numbers those it refers to
+    for (size_t i = 0; i < items.size(); i++) record(items[i]);
+    std::string records;
+    records.swap(out);
+    u64(items.size());
+    out += records;
+    u64(refs.size());
+    for (uint64_t r : refs) u64(r);
+    return out;
+}
+
+/**
+ * @brief Objects made while loading, by number
+ * A GC root until something else holds the section's roots.
+ */
+struct Loaded : GcObject {
+    std::vector<Expr> values;
+    std::vector<Expr> origins;             ///< Lambdas standing for the procedures' origins
+    std::vector<Env *> frames;
+    std::vector<ScopePtr> scopes;
+    virtual void trace() const override {
+        gc_mark(values);
+        gc_mark(origins);
+        for (const Env *e : frames) gc_mark(e);
+    }
+};
+
+class Fields {
+public:
+    Fields(const char *b, const char *e) : p(b), end(e) {}
+    const char *p;
+    const char *end;
+    uint64_t u64() {
+        need(sizeof(uint64_t));
+        uint64_t n;
+        std::memcpy(&n, p, sizeof n);
+        p += sizeof n;
+        return n;
+    }
+    std::string str() {
+        uint64_t n = u64();
+        need(n);
+        std::string s(p, n);
+        p += n;
+        return s;
+    }
+    /// Length of an array of words that follows
+    uint64_t count() {
+        uint64_t n = u64();
+        need(n > UINT64_MAX / sizeof(uint64_t) ? UINT64_MAX : n * sizeof(uint64_t));
+        return n;
+    }
+    void need(uint64_t n) {
+        if (static_cast<uint64_t>(end - p) < n) throw(RuntimeError("truncated image"));
+    }
+};
+
+class Loader {
+public:
+    Loader(Loaded &l, Env *top_level) : loaded(l), top(top_level) {}
+    std::vector<Expr> load(Fields &);      ///< Reads a section; its roots
+private:
+    Loaded &loaded;
+    Env *top;
+    std::vector<std::pair<const char *, const char *>> records;     ///< Fields of object n, for objects 1 and up
+    std::vector<Kind> kinds;
+
+    uint64_t index(uint64_t r) {
+        uint64_t n = (r >> 3) - 1;
+        if (n == 0 || n > kinds.size()) throw(RuntimeError("bad reference in image"));
+        return n;
+    }
+    Expr value(uint64_t r) {
+        if (r == 0) return Expr(nullptr);
+        if (r & 1) return Expr::fromFixnum(static_cast<intptr_t>(r) >> 1);
+        if (r & 7) {
+            if ((r & 7) != (Expr::fromConstant(Expr::C_FALSE).word() & 7) || (r >> 3) > Expr::C_EMPTY) throw(RuntimeError("bad constant in image"));
+            return Expr::fromConstant(static_cast<Expr::Constant>(r >> 3));
+        }
+        Expr v = loaded.values[index(r)];
+        if (v.null()) throw(RuntimeError("bad reference in image"));
+        return v;
+    }
+    Env *frame(uint64_t r) {
+        if (r == 0) return nullptr;
+        if (r == 1 << 3) return top;
+        Env *e = loaded.frames[index(r)];
+        if (e == nullptr) throw(RuntimeError("bad reference in image"));
+        return e;
+    }
+    ScopePtr scope(uint64_t r) {
+        if (r == 0) return nullptr;
+        ScopePtr s = loaded.scopes[index(r)];
+        if (!s) throw(RuntimeError("bad reference in image"));
+        return s;
+    }
+    BigInt bigint(Fields &in) {
+        std::string s = in.str();
+        BigInt n;
+        if (!BigInt::parse(s.data(), s.data() + s.size(), n)) throw(RuntimeError("bad number in image"));
+        return n;
+    }
+    ExprType builtin(const std::unordered_map<Symbol, ExprType> &table, const std::string &name) {
+        auto it = table.find(Symbol(name));
+        if (it == table.end()) throw(RuntimeError("image refers to unknown builtin " + name));
+        return it->second;
+    }
+    std::vector<Symbol> names(Fields &in) {
+        uint64_t n = in.u64();
+        std::vector<Symbol> xs;
+        for (uint64_t i = 0; i < n; i++) xs.push_back(Symbol(in.str()));
+        return xs;
+    }
+    void make(uint64_t n, Kind, Fields &);
+    void fill(uint64_t n, Kind, Fields &);
+};
+
+// Makes object n, complete unless it refers to others
+void Loader::make(uint64_t n, Kind kind, Fields &in) {
+    Expr &v = loaded.values[n];
+    switch (kind) {
+        case K_PAIR: v = PairE(Expr(nullptr), Expr(nullptr)); break;
+        case K_STRING: v = StringExprE(in.str()); break;
+        case K_SYMBOL: v = Expr(new Var(Symbol(in.str()))); break;
+        case K_BIGNUM: v = Expr(new Bignum(bigint(in))); break;
+        case K_RATIONAL: {
+            BigInt num = bigint(in);
+            v = Expr(new RationalNum(num, bigint(in)));
+            break;
+        }
+        case K_VECTOR: v = VectorE(std::vector<Expr>(in.count(), Expr(nullptr))); break;
+        case K_FXVECTOR: {
+            std::vector<int64_t> items(in.count());
+            for (int64_t &x : items) x = in.u64();
+            v = FxVectorE(std::move(items));
+            break;
+        }
+        case K_HASHTABLE: v = Expr(new HashTable(in.u64() != 0)); break;
+        case K_PRIMITIVE: v = PrimitiveE(builtin(primitives, in.str())); break;
+        case K_SPECIALFORM: v = SpecialFormE(builtin(reserved_words, in.str())); break;
+        case K_PROCEDURE: {
+            std::string name = in.str();
+            std::vector<Symbol> parameters = names(in);
+            size_t frame_size = in.u64();
+            auto body = new DeferredBody(parameters, std::vector<Expr>(), nullptr, frame_size);
+            Expr body_root(body);
+            auto lambda = new Lambda(parameters, body_root, frame_size, std::vector<Expr>(), nullptr, false);
+            lambda->name = Symbol(name);
+            Expr lambda_root(lambda);
+            loaded.origins.push_back(lambda_root);
+            v = ProcedureE(&lambda->x, body_root, nullptr, frame_size, lambda);
+            break;
+        }
+        case K_FRAME: loaded.frames[n] = Env::make(nullptr, in.count()); break;
+        case K_SCOPE: {
+            ScopePtr parent = scope(in.u64());
+            loaded.scopes[n] = std::make_shared<Scope>(names(in), parent);
+            break;
+        }
+        case K_FORM: v = Expr(new SList(std::vector<Expr>(in.count(), Expr(nullptr)))); break;
+        case K_NUMBER_LITERAL: v = Expr(new Fixnum(static_cast<int64_t>(in.u64()))); break;
+        case K_BOOLEAN_LITERAL: v = Expr(new Boolean(in.u64() != 0)); break;
+        default: throw(RuntimeError("bad record in image"));
+    }
+}
+
+// Sets the references of object n
+void Loader::fill(uint64_t n, Kind kind, Fields &in) {
+    const Expr &v = loaded.values[n];
+    switch (kind) {
+        case K_PAIR: {
+            auto p = static_cast<Pair*>(v.get());
+            p->car = value(in.u64());
+            p->cdr = value(in.u64());
+            break;
+        }
+        case K_VECTOR: {
+            auto &items = static_cast<Vector*>(v.get())->items;
+            in.u64();
+            for (Expr &x : items) x = value(in.u64());
+            break;
+        }
+        case K_PROCEDURE: {
+            auto p = static_cast<Procedure*>(v.get());
+            in.str();
+            names(in);
+            in.u64();
+            ScopePtr s = scope(in.u64());
+            p->env = frame(in.u64());
+            uint64_t forms = in.u64();
+            std::vector<Expr> source;
+            for (uint64_t i = 0; i < forms; i++) source.push_back(value(in.u64()));
+            auto body = static_cast<DeferredBody*>(p->e.get());
+            body->source = source;
+            body->scope = s;
+            auto lambda = const_cast<Lambda*>(static_cast<const Lambda*>(p->origin));
+            lambda->source = source;
+            lambda->scope = s;
+            break;
+        }
+        case K_FRAME: {
+            Env *e = loaded.frames[n];
+            in.u64();
+            e->parent = frame(in.u64());
+            for (size_t i = 0; i < e->size; i++) e->slots[i] = value(in.u64());
+            break;
+        }
+        case K_FORM: {
+            auto &terms = static_cast<SList*>(v.get())->terms;
+            in.u64();
+            for (Expr &x : terms) x = value(in.u64());
+            break;
+        }
+        default: break;
+    }
+}
+
+std::vector<Expr> Loader::load(Fields &in) {
+    uint64_t count = in.u64();
+    if (count > static_cast<uint64_t>(in.end - in.p)) throw(RuntimeError("truncated image"));
+    loaded.values.assign(count + 1, Expr(nullptr));
+    loaded.frames.assign(count + 1, nullptr);
+    loaded.scopes.assign(count + 1, nullptr);
+    kinds.reserve(count);
+    records.reserve(count);
+    for (uint64_t n = 1; n <= count; n++) {
+        in.need(1);
+        Kind kind = static_cast<Kind>(*in.p++);
+        uint64_t length = in.u64();
+        in.need(length);
+        kinds.push_back(kind);
+        records.push_back(std::make_pair(in.p, in.p + length));
+        Fields fields(in.p, in.p + length);
+        make(n, kind, fields);
+        in.p += length;
+    }
+    for (uint64_t n = 1; n <= count; n++) {
+        Fields fields(records[n - 1].first, records[n - 1].second);
+        fill(n, kinds[n - 1], fields);
+    }
+    // Keys are complete only now
+    for (uint64_t n = 1; n <= count; n++) {
+        if (kinds[n - 1] != K_HASHTABLE) continue;
+        Fields fields(records[n - 1].first, records[n - 1].second);
+        auto h = static_cast<HashTable*>(loaded.values[n].get());
+        fields.u64();
+        uint64_t entries = fields.u64();
+        for (uint64_t i = 0; i < entries; i++) {
+            Expr key = value(fields.u64());
+            h->set(key, value(fields.u64()));
+        }
+    }
+    uint64_t n = in.count();
+    std::vector<Expr> roots;
+    for (uint64_t i = 0; i < n; i++) roots.push_back(value(in.u64()));
+    return roots;
+}
+
+void put_u64(std::string &out, uint64_t n) {
+    out.append(reinterpret_cast<const char *>(&n), sizeof n);
+}
+
+void put_str(std::string &out, const std::string &s) {
+    put_u64(out, s.size());
+    out += s;
+}
+
+void write_file(const char *file, const std::string &data) {
+    std::ofstream out(file, std::ios::binary);
+    out.write(data.data(), data.size());
+    if (!out.flush()) throw(RuntimeError(std::string("cannot write ") + file));
+}
+
+void check_magic(Fields &in, const char (&magic)[8], const char *what) {
+    in.need(sizeof magic);
+    if (std::memcmp(in.p, magic, sizeof magic) != 0) throw(RuntimeError(std::string("not ") + what));
+    in.p += sizeof magic;
+}
+
+} // namespace
+
+// A file mapped read-only, for as long as this lives
+class MappedFile {
+public:
+    explicit MappedFile(const char *file) {
+        int fd = ::open(file, O_RDONLY);
+        if (fd < 0) throw(RuntimeError(std::string("cannot read ") + file + ": " + std::strerror(errno)));
+        struct stat st;
+        if (::fstat(fd, &st) < 0 || st.st_size == 0) {
+            ::close(fd);
+            throw(RuntimeError(std::string("cannot read ") + file));
+        }
+        size = st.st_size;
+        void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) throw(RuntimeError(std::string("cannot map ") + file + ": " + std::strerror(errno)));
+        base = static_cast<const char *>(map);
+    }
+    ~MappedFile() { ::munmap(const_cast<char *>(base), size); }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    const char *base;
+    size_t size;
+};
+
+void save_image(const char *file, const EnvPtr &top_level) {
+    std::vector<Symbol> names;
+    std::vector<Expr> values;
+    {
+        std::lock_guard<std::recursive_mutex> guard(toplevel_lock);
+        // The frame's own bindings hide its prelude's
+        Env *prelude = top_level->top->prelude;
+        if (prelude != nullptr) {
+            for (const auto &b : prelude->top->bindings) {
+                if (top_level->top->bindings.count(b.first)) continue;
+                names.push_back(b.first);
+                values.push_back(b.second);
+            }
+        }
+        for (const auto &b : top_level->top->bindings) {
+            names.push_back(b.first);
+            values.push_back(b.second);
+        }
+    }
+    GcRoot root(values);
+    std::string image(MAGIC, sizeof MAGIC);
+    image += Writer(top_level).write(values);
+    for (const Symbol &x : names) put_str(image, x.str());
+    write_file(file, image);
+}
+
+void load_image(const char *file, const EnvPtr &top_level) {
+    MappedFile map(file);
+    Fields in(map.base, map.base + map.size);
+    check_magic(in, MAGIC, "an image file");
+    Loaded loaded;
+    GcRoot root(loaded);
+    std::vector<Expr> values = Loader(loaded, top_level).load(in);
+    std::lock_guard<std::recursive_mutex> guard(toplevel_lock);
+    for (const Expr &v : values) define_var(Symbol(in.str()), -1, v, top_level);
+}
+
+uint64_t form_cache_key(const std::string &source) {
+    // FNV-1a, over the interpreter's identity and then the text
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&h](const char *p, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            h ^= static_cast<unsigned char>(p[i]);
+            h *= 1099511628211ull;
+        }
+    };
+    mix(FORMS_MAGIC, sizeof FORMS_MAGIC);
+    struct stat st;
+    if (::stat("/proc/self/exe", &st) == 0) {
+        int64_t identity[3] = {static_cast<int64_t>(st.st_size), static_cast<int64_t>(st.st_mtim.tv_sec), static_cast<int64_t>(st.st_mtim.tv_nsec)};
+        mix(reinterpret_cast<const char *>(identity), sizeof identity);
+    }
+    mix(source.data(), source.size());
+    return h;
+}
+
+void save_forms(const char *file, uint64_t key, const std::vector<Expr> &forms) {
+    std::string sections;
+    std::vector<uint64_t> offsets;
+    size_t header = sizeof FORMS_MAGIC + (2 + forms.size()) * sizeof(uint64_t);
+    for (const Expr &x : forms) {
+        offsets.push_back(header + sections.size());
+        sections += Writer(nullptr).write(std::vector<Expr>{x});
+    }
+    std::string data(FORMS_MAGIC, sizeof FORMS_MAGIC);
+    put_u64(data, key);
+    put_u64(data, forms.size());
+    for (uint64_t offset : offsets) put_u64(data, offset);
+    data += sections;
+    // Rename into place, so a run started meanwhile sees all of it or none
+    std::string temporary = std::string(file) + "." + std::to_string(::getpid());
+    write_file(temporary.c_str(), data);
+    if (::rename(temporary.c_str(), file) < 0) {
+        ::unlink(temporary.c_str());
+        throw(RuntimeError(std::string("cannot write ") + file + ": " + std::strerror(errno)));
+    }
+}
+
+FormCache::FormCache(const char *file, uint64_t key) : map(new MappedFile(file)), next_form(0) {
+    Fields in(map->base, map->base + map->size);
+    check_magic(in, FORMS_MAGIC, "a form cache");
+    if (in.u64() != key) throw(RuntimeError("form cache is for another script"));
+    count = in.count();
+    offsets = in.p;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t offset = in.u64();
+        if (offset > map->size) throw(RuntimeError("truncated form cache"));
+    }
+}
+
+FormCache::~FormCache() = default;
+
+Expr FormCache::next() {
+    if (next_form == count) return Expr(nullptr);
+    uint64_t begin, end = map->size;
+    std::memcpy(&begin, offsets + next_form * sizeof begin, sizeof begin);
+    if (next_form + 1 < count) std::memcpy(&end, offsets + (next_form + 1) * sizeof end, sizeof end);
+    if (begin > end) throw(RuntimeError("bad form cache"));
+    next_form++;
+    Fields in(map->base + begin, map->base + end);
+    Loaded loaded;
+    GcRoot root(loaded);
+    std::vector<Expr> roots = Loader(loaded, nullptr).load(in);
+    if (roots.size() != 1 || roots[0].null()) throw(RuntimeError("bad form cache"));
+    return roots[0];
+}
@@ -0,0 +1,61 @@
+#ifndef IMAGE_HPP
+#define IMAGE_HPP
+
+/**
+ * @file image.hpp
+ * @brief Heap images and form caches: what startup would build, saved to a file
+ *
+ * save_image() writes every binding of a top-level frame and of its prelude,
+ * and everything their values reach: pairs, strings, numbers, symbols,
+ * vectors, hash tables, primitives, procedures and the frames they closed
+ * over. A procedure is saved as its body forms as read and the names of the
+ * scopes around it, not as analyzed nodes. load_image() gives it a
+ * DeferredBody, so loading reads no text and analyzes and evaluates nothing;
+ * each body is analyzed when it is first called.
+ *
+ * The file is mapped and read in place. Objects are numbered in the file, and
+ * a reference is either the word of an immediate or an object's number, which
+ * loading relocates to the object made for it. References to the top-level
+ * frame the image was saved from go to the frame it is loaded into. Hash
+ * tables are rebuilt on load, as eq? hashes are addresses.
+ *
+ * Loading checks that the file is whole and its references are in range, not
+ * that it is what save_image() wrote: run only images you would run the
+ * program of. Futures cannot be saved. Quoted constants inside procedure bodies are built
+ * again when the body is analyzed, so they are no longer eq? to data taken
+ * from them before the image was saved.
+ *
+ * A form cache holds the top-level forms of a script as parse() made them,
+ * in the same format, one section per form, so running a script again reads
+ * and parses nothing. Analysis is not cached: what a form analyzes to depends
+ * on the definitions run before it. Its key is a hash of the interpreter
+ * binary's size and time and of the text, and FormCache loads one form at a
+ * time, as the REPL asks for it.
+ */
+
+#include "expr.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+void save_image(const char *file, const EnvPtr &top_level);   ///< Throws RuntimeError
+void load_image(const char *file, const EnvPtr &top_level);   ///< Defines the image's names in top_level; throws RuntimeError
+
+uint64_t form_cache_key(const std::string &source);
+void save_forms(const char *file, uint64_t key, const std::vector<Expr> &forms);   ///< Throws RuntimeError
+
+class MappedFile;
+
+class FormCache {
+public:
+    FormCache(const char *file, uint64_t key);     ///< Throws RuntimeError if unreadable or for another key
+    ~FormCache();
+    Expr next();                                   ///< The next form, or null after the last; throws RuntimeError
+private:
+    std::unique_ptr<MappedFile> map;
+    const char *offsets;                           ///< Where each form's section starts
+    size_t count;
+    size_t next_form;
+};
+
+#endif
@@ -2,53 +2,346 @@
 #include "syntax.hpp"
 #include "expr.hpp"
 #include "RE.hpp"
+#include "vm.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
+#include "output.hpp"
+#include "future.hpp"
+#include "server.hpp"
+#include "image.hpp"
+#include "pipeline.hpp"
+#include "budget.hpp"
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <cstdint>
+#include <functional>
+#include <unistd.h>
+#include <sys/resource.h>
 
-extern std::unordered_map<std::string, ExprType> primitives;
-extern std::unordered_map<std::string, ExprType> reserved_words;
+extern std::unordered_map<Symbol, ExprType> primitives;
+extern std::unordered_map<Symbol, ExprType> reserved_words;
 
-void REPL(){
-    // read - evaluation - print loop
-    EnvPtr global_env = std::make_shared<Env>();
+// How run() stopped
+enum RunEnd { END_OF_INPUT, EXITED, FAILED };
 
+// Evaluates each form next() gives, until it gives null. With a script name,
+// as in batch mode, there is no prompt, and the first error is reported on
+// stderr under that name and ends the run
+static RunEnd run(const std::function<Expr()> &next, std::ostream &out, const EnvPtr &global_env, bool use_vm, bool session, bool interactive, const char *script = nullptr){
+    // read - evaluation - print loop
     while (1){
-        #ifndef ONLINE_JUDGE
-            std::cout << "scm> ";
-        #endif
-        Syntax stx = readSyntax(std :: cin); // read
+        if (!session && script == nullptr) {
+            #ifndef ONLINE_JUDGE
+            std::lock_guard<std::mutex> guard(output_lock);
+            out << "scm> ";
+            #endif
+        }
+        // Output is only pushed out when someone is waiting for it
+        if (interactive) output_flush();
         try{
-            Expr expr = stx -> parse(); // parse
+            // Input that ends inside a form fails like the form would
+            Expr form = next(); // read
+            if (form.null()) return END_OF_INPUT;
+            budget_start();
+            Expr expr = analyze(form, global_env);
+            GcRoot expr_root(expr);
 
-            Expr val = expr -> eval(global_env);
-            if (val.ptr == nullptr)
+            Expr val = use_vm ? vm_eval(expr, global_env) : expr -> eval(global_env);
+            GcRoot val_root(val);
+            gc_safepoint();
+            if (val.null())
             {   
                 continue;
             }
-            if (val->e_type == E_EXIT)
+            if (val.type() == E_EXIT)
             {
-                puts("");
-                break;
+                if (script == nullptr) {
+                    std::lock_guard<std::mutex> guard(output_lock);
+                    out << '\n';
+                }
+                return EXITED;
             }
-            if (val->e_type == E_EMPTY) {
+            if (val.type() == E_EMPTY) {
                 continue;
             }
-            val.show(std :: cout); // value print
-            puts("");
+            std::lock_guard<std::mutex> guard(output_lock);
+            val.show(out); // value print
+            out << '\n';
         }
         catch (const RuntimeError &RE){
+            if (script != nullptr) {
+                // After what the script printed before it
+                output_flush();
+                std::cerr << script << ": " << RE.message() << std::endl;
+                return FAILED;
+            }
+            std::lock_guard<std::mutex> guard(output_lock);
             #ifndef ONLINE_JUDGE
-            std :: cout << "DEBUG: " << RE.message() << std::endl;
+            out << "DEBUG: " << RE.message() << '\n';
             #endif
-            std :: cout << "RuntimeError";
-            puts("");
+            out << "RuntimeError\n";
         }
     }
 }
 
+void REPL(std::istream &in, std::ostream &out, const EnvPtr &global_env, bool use_vm, bool session){
+    bool interactive = !session && &in == &std::cin && isatty(STDIN_FILENO);
+    Reader reader(in, interactive);
+    run([&reader] {
+        // Futures may collect while this waits for input
+        Syntax stx(nullptr);
+        gc_blocking([&] { stx = reader.read(); });
+        return stx.get() == nullptr ? Expr(nullptr) : stx->parse();
+    }, out, global_env, use_vm, session, interactive);
+}
 
-int main(int argc, char *argv[]) {
-    REPL();
+// --cache=DIR: standard input through the form cache for its text, made if missing
+static void cachedREPL(const std::string &dir, const EnvPtr &global_env, bool use_vm) {
+    std::string script;
+    gc_blocking([&script] {
+        std::ostringstream text;
+        text << std::cin.rdbuf();
+        script = text.str();
+    });
+    uint64_t key = form_cache_key(script);
+    char name[32];
+    std::snprintf(name, sizeof name, "/%016llx.forms", static_cast<unsigned long long>(key));
+    std::string file = dir + name;
+    std::unique_ptr<FormCache> cache;
+    try {
+        cache.reset(new FormCache(file.c_str(), key));
+    } catch (const RuntimeError &) {
+        // Missing or unusable: parse, and cache the forms before running them
+    }
+    if (cache) {
+        run([&cache, &file] {
+            try {
+                return cache->next();
+            } catch (const RuntimeError &e) {
+                std::cerr << file << ": " << e.message() << std::endl;
+                return Expr(nullptr);
+            }
+        }, scheme_out, global_env, use_vm, false, false);
+        return;
+    }
+    std::istringstream in(script);
+    Reader reader(in, false);
+    std::vector<Expr> forms;
+    GcRoot forms_root(forms);
+    std::string unreadable;
+    try {
+        for (Syntax stx = reader.read(); stx.get() != nullptr; stx = reader.read()) forms.push_back(stx->parse());
+    } catch (const RuntimeError &e) {
+        // Truncated input is run up to where it ends, but not cached
+        unreadable = e.message();
+    }
+    if (unreadable.empty()) {
+        try {
+            save_forms(file.c_str(), key, forms);
+        } catch (const RuntimeError &e) {
+            std::cerr << e.message() << std::endl;
+        }
+    }
+    size_t i = 0;
+    run([&forms, &i, &unreadable] {
+        // Evaluated forms need not stay alive
+        if (i == forms.size()) {
+            if (unreadable.empty()) return Expr(nullptr);
+            std::string message;
+            message.swap(unreadable);
+            throw(RuntimeError(message));
+        }
+        Expr form = forms[i];
+        forms[i++] = Expr(nullptr);
+        return form;
+    }, scheme_out, global_env, use_vm, false, false);
+}
+
+// A script given on the command line: a file, - for standard input, or the text of -e
+struct Script {
+    bool inline_text;
+    std::string text;
+};
+
+// Batch mode: each script in order in global_env, with forms parsed ahead on a
+// reader thread. 0 when all ran or one called (exit), 1 when a form raised an
+// error, 2 when a file could not be read
+static int runScripts(const std::vector<Script> &scripts, const EnvPtr &global_env, bool use_vm) {
+    for (const Script &script : scripts) {
+        std::ifstream file;
+        std::istringstream text;
+        std::istream *in = &std::cin;
+        std::string name = "-e";
+        if (script.inline_text) {
+            text.str(script.text);
+            in = &text;
+        } else if (script.text != "-") {
+            name = script.text;
+            file.open(name);
+            if (!file) {
+                output_flush();
+                std::cerr << "cannot read " << name << std::endl;
+                return 2;
+            }
+            in = &file;
+        }
+        FormPipeline forms(*in);
+        // A read error comes after the forms before it, and fails the run as theirs would
+        RunEnd end = run([&forms] { return forms.next(); }, scheme_out, global_env, use_vm, true, false, name.c_str());
+        if (end == FAILED) return 1;
+        if (end == EXITED) return 0;
+    }
     return 0;
 }
+
+// --max-heap=SIZE and --max-steps=N: a decimal count, for SIZE optionally
+// followed by K, M or G
+static bool parseCount(const char *text, bool suffix, size_t &n) {
+    char *end;
+    errno = 0;
+    unsigned long long v = std::strtoull(text, &end, 10);
+    if (end == text || *text == '-' || errno != 0) return false;
+    int shift = 0;
+    if (suffix && *end != '\0' && end[1] == '\0') {
+        const char *units = "KMG", *unit = std::strchr(units, *end);
+        if (unit == nullptr) return false;
+        shift = 10 * (unit - units + 1);
+        end++;
+    }
+    if (*end != '\0' || v == 0 || v > (SIZE_MAX >> shift)) return false;
+    n = static_cast<size_t>(v) << shift;
+    return true;
+}
+
+// --stats: one line of key=value counters on stderr when the session ends
+static void printStats() {
+    gc_flush_stats();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    std::cerr << "allocations=" << gc_stats.objects
+              << " allocated_bytes=" << gc_stats.bytes
+              << " collections=" << gc_stats.collections
+              << " live_bytes=" << gc_stats.live
+              << " payload_bytes=" << gc_stats.payload
+              << " segment_bytes=" << gc_stats.segments
+              << " peak_rss_kb=" << usage.ru_maxrss << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    gc_init(__builtin_frame_address(0));
+    bool use_vm = false, stats = false;
+    std::string profile_file, prelude_file, server_path, image_file, save_image_file, cache_dir;
+    std::vector<Script> scripts;
+    auto usage = [argv] {
+        std::cerr << "usage: " << argv[0] << " [--engine=tree|vm] [--stats] [--profile[=FILE]] [--prelude=FILE] [--server=SOCKET] [--image=FILE] [--save-image=FILE] [--cache=DIR] [--max-heap=SIZE[K|M|G]] [--max-steps=N] [-e EXPR | FILE | -]..." << std::endl;
+        return 1;
+    };
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            scripts.push_back({true, argv[++i]});
+        } else if (std::strcmp(argv[i], "-") == 0 || argv[i][0] != '-') {
+            scripts.push_back({false, argv[i]});
+        } else if (std::strcmp(argv[i], "--engine=vm") == 0) {
+            use_vm = true;
+        } else if (std::strcmp(argv[i], "--engine=tree") == 0) {
+            use_vm = false;
+        } else if (std::strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else if (std::strcmp(argv[i], "--profile") == 0) {
+            profile_file = "profile.folded";
+        } else if (std::strncmp(argv[i], "--profile=", 10) == 0 && argv[i][10] != '\0') {
+            profile_file = argv[i] + 10;
+        } else if (std::strncmp(argv[i], "--prelude=", 10) == 0 && argv[i][10] != '\0') {
+            prelude_file = argv[i] + 10;
+        } else if (std::strncmp(argv[i], "--server=", 9) == 0 && argv[i][9] != '\0') {
+            server_path = argv[i] + 9;
+        } else if (std::strncmp(argv[i], "--image=", 8) == 0 && argv[i][8] != '\0') {
+            image_file = argv[i] + 8;
+        } else if (std::strncmp(argv[i], "--save-image=", 13) == 0 && argv[i][13] != '\0') {
+            save_image_file = argv[i] + 13;
+        } else if (std::strncmp(argv[i], "--cache=", 8) == 0 && argv[i][8] != '\0') {
+            cache_dir = argv[i] + 8;
+        } else if (std::strncmp(argv[i], "--max-heap=", 11) == 0) {
+            if (!parseCount(argv[i] + 11, true, gc_max_heap)) return usage();
+        } else if (std::strncmp(argv[i], "--max-steps=", 12) == 0) {
+            if (!parseCount(argv[i] + 12, false, max_steps)) return usage();
+        } else {
+            return usage();
+        }
+    }
+    if (!server_path.empty() && (!save_image_file.empty() || !cache_dir.empty())) {
+        std::cerr << "--save-image and --cache cannot be used with --server" << std::endl;
+        return 1;
+    }
+    if (!scripts.empty() && (!server_path.empty() || !cache_dir.empty())) {
+        std::cerr << "--server and --cache cannot be used with scripts" << std::endl;
+        return 1;
+    }
+    profiling = !profile_file.empty();
+    // Sessions share the image and the prelude in a frame of their own; a
+    // single session loads the image into its top-level frame, where set! works
+    bool shared = !prelude_file.empty() || !server_path.empty();
+    EnvPtr prelude = nullptr, global_env = nullptr;
+    GcRoot prelude_root(prelude), env_root(global_env);
+    if (shared) prelude = new Env();
+    if (server_path.empty()) global_env = new Env(prelude);
+    if (!image_file.empty()) {
+        try {
+            load_image(image_file.c_str(), shared ? prelude : global_env);
+        } catch (const RuntimeError &e) {
+            std::cerr << image_file << ": " << e.message() << std::endl;
+            return 1;
+        }
+    }
+    if (!prelude_file.empty()) {
+        if (!load_prelude(prelude_file.c_str(), prelude, use_vm)) {
+            std::cerr << "cannot read " << prelude_file << std::endl;
+            return 1;
+        }
+        output_flush();
+    }
+    if (prelude != nullptr) prelude->top->frozen = true;
+    int status = 0;
+    if (!server_path.empty()) {
+        if (!serve(server_path.c_str(), prelude, use_vm)) return 1;
+    } else {
+        // A terminal is read as it is typed, never cached
+        if (!scripts.empty()) {
+            status = runScripts(scripts, global_env, use_vm);
+        } else if (!cache_dir.empty() && !isatty(STDIN_FILENO)) {
+            cachedREPL(cache_dir, global_env, use_vm);
+        } else {
+            REPL(std::cin, scheme_out, global_env, use_vm, false);
+        }
+        if (!save_image_file.empty()) {
+            future_shutdown();
+            output_flush();
+            try {
+                save_image(save_image_file.c_str(), global_env);
+            } catch (const RuntimeError &e) {
+                std::cerr << save_image_file << ": " << e.message() << std::endl;
+                if (status == 0) status = 1;
+            }
+        }
+    }
+    future_shutdown();
+    output_flush();
+    if (stats) printStats();
+    // SCHEME_STATS=1: the (runtime-stats) counters on stderr when the session ends, by (exit) or end of input
+    const char *dump = std::getenv("SCHEME_STATS");
+    if (dump && *dump && std::strcmp(dump, "0") != 0) print_runtime_stats(std::cerr);
+    if (profiling) {
+        // Collapsed stacks for flamegraph tools, and a summary for people
+        std::ofstream folded(profile_file);
+        profile_write_folded(folded);
+        if (!folded) std::cerr << "cannot write " << profile_file << std::endl;
+        profile_write_summary(std::cerr);
+    }
+    return status;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file output.cpp
+ * @brief Buffered standard output
+ */
+
+#include "output.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <streambuf>
+#include <unistd.h>
+
+namespace {
+
+class FdBuffer : public std::streambuf {
+public:
+    explicit FdBuffer(int fd) : fd(fd) {
+        setp(buf, buf + sizeof buf);
+    }
+    bool flush() {
+        const char *p = pbase();
+        while (p < pptr()) {
+            ssize_t n = ::write(fd, p, pptr() - p);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                setp(buf, buf + sizeof buf);
+                return false;
+            }
+            p += n;
+        }
+        setp(buf, buf + sizeof buf);
+        return true;
+    }
+protected:
+    virtual int_type overflow(int_type c) override {
+        if (!flush()) return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+    virtual std::streamsize xsputn(const char *s, std::streamsize n) override {
+        std::streamsize done = 0;
+        while (done < n) {
+            if (pptr() == epptr() && !flush()) break;
+            std::streamsize chunk = std::min<std::streamsize>(n - done, epptr() - pptr());
+            traits_type::copy(pptr(), s + done, chunk);
+            pbump(static_cast<int>(chunk));
+            done += chunk;
+        }
+        return done;
+    }
+    virtual int sync() override {
+        return flush() ? 0 : -1;
+    }
+private:
+    int fd;
+    char buf[1 << 16];
+};
+
+FdBuffer stdout_buffer(STDOUT_FILENO);
+
+} // namespace
+
+std::ostream scheme_out(&stdout_buffer);
+std::mutex output_lock;
+__thread std::ostream *current_output = &scheme_out;
+
+void output_flush() {
+    std::lock_guard<std::mutex> guard(output_lock);
+    scheme_out.flush();
+}
+
+FdStream::FdStream(int fd) : std::ostream(nullptr), buffer(new FdBuffer(fd)) {
+    rdbuf(buffer.get());
+}
+
+FdStream::~FdStream() {
+    flush();
+}
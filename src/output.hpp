@@ -0,0 +1,41 @@
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+/**
+ * @file output.hpp
+ * @brief Buffered standard output for the REPL and display
+ *
+ * Everything the interpreter prints goes through scheme_out, which collects
+ * it in a large buffer and writes to file descriptor 1 only when the buffer
+ * fills or output_flush() is called: before waiting for interactive input and
+ * when the session ends. Nothing else may write to std::cout or stdout, as
+ * their output would not be ordered with the buffer's.
+ *
+ * Futures may print from other threads, so whoever writes holds output_lock
+ * for as long as the text must stay in one piece.
+ *
+ * display writes to current_output, which is scheme_out but on threads
+ * running a server session or one of its futures, where it is the session's
+ * connection.
+ */
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+extern std::ostream scheme_out;
+extern std::mutex output_lock;
+extern __thread std::ostream *current_output;
+void output_flush();                       ///< Takes output_lock
+
+/// Buffered like scheme_out, to another file descriptor, which it leaves open.
+/// Flushes when destroyed.
+class FdStream : public std::ostream {
+public:
+    explicit FdStream(int fd);
+    ~FdStream();
+private:
+    std::unique_ptr<std::streambuf> buffer;
+};
+
+#endif
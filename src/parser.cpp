@@ -20,8 +20,8 @@ using std::string;
 using std::vector;
 using std::pair;
 
-extern std::unordered_map<std::string, ExprType> primitives;
-extern std::unordered_map<std::string, ExprType> reserved_words;
+extern std::unordered_map<Symbol, ExprType> primitives;
+extern std::unordered_map<Symbol, ExprType> reserved_words;
 
 Expr Syntax::parse() {
     return (*this)->parse();
@@ -31,12 +31,19 @@ Expr Number::parse() {
     return Expr(new Fixnum(n));
 }
 
+Expr BigNumber::parse() {
+    return Expr(new Bignum(n));
+}
+
 Expr RationalSyntax::parse() {
-    return Expr(new RationalNum(numerator, denominator));
+    Expr v = RationalE(numerator, denominator);
+    // An integral literal such as 4/2; immediates are values, not nodes
+    if (v.is_fixnum()) return Expr(new Fixnum(v.fixnum()));
+    return v;
 }
 
 Expr SymbolSyntax::parse() {
-    return Expr(new Var(s));
+    return Expr(new Var(Symbol(s)));
 }
 
 Expr StringSyntax::parse() {
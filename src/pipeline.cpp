@@ -0,0 +1,92 @@
+/**
+ * @file pipeline.cpp
+ * @brief The reader thread and queue behind FormPipeline
+ */
+
+#include "pipeline.hpp"
+#include "stats.hpp"
+#include <exception>
+
+FormPipeline::FormPipeline(std::istream &is) : in(is), root(*this) {
+    reader = std::thread(&FormPipeline::produce, this, gc_add_thread());
+}
+
+FormPipeline::~FormPipeline() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+    }
+    cv.notify_all();
+    // The reader may collect before it sees closed
+    gc_blocking([this] { reader.join(); });
+}
+
+void FormPipeline::trace() const {
+    for (const Expr &form : forms) gc_mark(form);
+}
+
+void FormPipeline::produce(GcThread *gc) {
+    gc_thread_start(gc, __builtin_frame_address(0));
+    Reader source(in, false);
+    std::string failure;
+    while (true) {
+        // This frame keeps form alive until it is queued
+        Expr form(nullptr);
+        try {
+            Syntax stx(nullptr);
+            gc_blocking([&] { stx = source.read(); });
+            if (stx.get() != nullptr) form = stx->parse();
+        } catch (const RuntimeError &RE) {
+            failure = RE.message();
+        } catch (const std::exception &e) {
+            failure = e.what();
+        }
+        // Only this thread pushes, so there is room once the wait ends
+        gc_blocking([this] {
+            std::unique_lock<std::mutex> guard(lock);
+            cv.wait(guard, [this] { return closed || forms.size() < PIPELINE_DEPTH; });
+        });
+        bool last = form.null();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (closed) {
+                last = true;
+            } else if (last) {
+                done = true;
+                error = failure;
+            } else {
+                forms.push_back(form);
+            }
+        }
+        cv.notify_all();
+        if (last) break;
+        gc_safepoint();
+    }
+    // Leave the collector only once the owner, blocked in the destructor,
+    // no longer allocates
+    gc_blocking([this] {
+        std::unique_lock<std::mutex> guard(lock);
+        cv.wait(guard, [this] { return closed; });
+    });
+    runtime_stats_merge();
+    gc_thread_exit();
+}
+
+Expr FormPipeline::next() {
+    gc_blocking([this] {
+        std::unique_lock<std::mutex> guard(lock);
+        cv.wait(guard, [this] { return done || !forms.empty(); });
+    });
+    Expr form(nullptr);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (forms.empty()) {
+            if (!error.empty()) throw(RuntimeError(error));
+            return form;
+        }
+        form = forms.front();
+        forms.pop_front();
+    }
+    cv.notify_all();
+    return form;
+}
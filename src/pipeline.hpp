@@ -0,0 +1,58 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+/**
+ * @file pipeline.hpp
+ * @brief Reading and parsing a script's forms on a thread of their own
+ *
+ * A FormPipeline starts a thread that reads the top-level forms of a stream
+ * and parses them, ahead of whoever runs them, into a queue of up to
+ * PIPELINE_DEPTH forms. Parsing the next forms of a long script then overlaps
+ * with evaluating the current one. The thread is a mutator like a future's
+ * worker: collections stop it, and queued forms are roots.
+ *
+ * The stream is read in blocks, not a line at a time, so a pipeline is for
+ * files and pipes rather than a terminal. The thread stays registered with
+ * the collector after the last form, until the pipeline is destroyed, which
+ * waits for it to finish the form it is reading, if any, and end.
+ */
+
+#include "expr.hpp"
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+const size_t PIPELINE_DEPTH = 64;
+
+/**
+ * Lives outside the heap, on its owner's stack, and is a GC root while it
+ * does, so queued forms stay alive. As for the future pool, the collector
+ * reads forms while every thread is stopped, and no thread stops while
+ * holding lock: waits are made inside gc_blocking() and the lock is taken
+ * again to push or pop.
+ */
+class FormPipeline : public GcObject {
+public:
+    explicit FormPipeline(std::istream &);
+    ~FormPipeline();
+    Expr next();                                   ///< The next form, or null after the last; throws RuntimeError
+    FormPipeline(const FormPipeline &) = delete;
+    FormPipeline &operator=(const FormPipeline &) = delete;
+private:
+    std::istream &in;
+    std::mutex lock;
+    std::condition_variable cv;            ///< A form was queued or taken, or the pipeline closes
+    std::deque<Expr> forms;
+    bool done = false;                     ///< The reader has queued its last form
+    bool closed = false;                   ///< Nobody takes more forms
+    std::string error;                     ///< Why the reader stopped early, if it did
+    GcRoot root;
+    std::thread reader;
+    void produce(GcThread *);
+    virtual void trace() const override;
+};
+
+#endif
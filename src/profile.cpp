@@ -0,0 +1,117 @@
+/**
+ * @file profile.cpp
+ * @brief Per-procedure profiler
+ */
+
+#include "profile.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+__thread bool profiling = false;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct ProcStats {
+    uint64_t calls;
+    uint64_t inclusive_ns;                 ///< Outermost activations only, so recursion is not counted twice
+    uint64_t exclusive_ns;
+    int active;                            ///< Open activations
+};
+
+// One call path: the procedures active from the outermost call down to name
+struct Node {
+    Symbol name;
+    ProcStats *stats;
+    uint64_t self_ns;
+    size_t depth;
+    std::unordered_map<Symbol, std::unique_ptr<Node>> children;
+    Node(const Symbol &n, ProcStats *s, size_t d) : name(n), stats(s), self_ns(0), depth(d) {}
+};
+
+struct Activation {
+    Node *node;                            ///< Path the time is charged to
+    ProcStats *stats;
+    Clock::time_point start;
+    uint64_t child_ns;                     ///< Time spent in callees so far
+};
+
+std::unordered_map<Symbol, ProcStats> stats;
+Node root(Symbol(""), nullptr, 0);
+std::vector<Activation> activations;
+
+void writePaths(std::ostream &os, const Node &node, std::string &path) {
+    size_t length = path.size();
+    if (&node != &root) {
+        if (!path.empty()) path += ';';
+        path += node.name.str();
+        if (node.self_ns >= 1000) os << path << ' ' << node.self_ns / 1000 << '\n';
+    }
+    for (const auto &child : node.children) writePaths(os, *child.second, path);
+    path.resize(length);
+}
+
+} // namespace
+
+void profile_enter(const Symbol &name) {
+    Node *parent = activations.empty() ? &root : activations.back().node;
+    Node *node = parent;
+    if (parent->name != name && parent->depth < PROFILE_MAX_DEPTH) {
+        std::unique_ptr<Node> &child = parent->children[name];
+        if (!child) child.reset(new Node(name, &stats[name], parent->depth + 1));
+        node = child.get();
+    }
+    ProcStats *s = node == parent && parent->name != name ? &stats[name] : node->stats;
+    s->calls++;
+    s->active++;
+    activations.push_back(Activation{node, s, Clock::now(), 0});
+}
+
+void profile_exit() {
+    Activation a = activations.back();
+    activations.pop_back();
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - a.start).count();
+    uint64_t self = ns - std::min(ns, a.child_ns);
+    a.node->self_ns += self;
+    ProcStats *s = a.stats;
+    s->exclusive_ns += self;
+    if (--s->active == 0) s->inclusive_ns += ns;
+    if (!activations.empty()) activations.back().child_ns += ns;
+}
+
+size_t profile_depth() {
+    return activations.size();
+}
+
+void profile_unwind(size_t depth) {
+    while (activations.size() > depth) profile_exit();
+}
+
+void profile_write_folded(std::ostream &os) {
+    profile_unwind(0);
+    std::string path;
+    writePaths(os, root, path);
+}
+
+void profile_write_summary(std::ostream &os) {
+    profile_unwind(0);
+    std::vector<std::pair<Symbol, ProcStats>> rows(stats.begin(), stats.end());
+    std::sort(rows.begin(), rows.end(), [](const std::pair<Symbol, ProcStats> &a, const std::pair<Symbol, ProcStats> &b) {
+        return a.second.exclusive_ns > b.second.exclusive_ns;
+    });
+    char line[128];
+    std::snprintf(line, sizeof line, "%12s %14s %14s  %s\n", "calls", "inclusive_ms", "exclusive_ms", "procedure");
+    os << line;
+    for (const auto &row : rows) {
+        std::snprintf(line, sizeof line, "%12llu %14.3f %14.3f  ", static_cast<unsigned long long>(row.second.calls),
+                      row.second.inclusive_ns / 1e6, row.second.exclusive_ns / 1e6);
+        os << line << row.first.str() << '\n';
+    }
+}
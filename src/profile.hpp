@@ -0,0 +1,54 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+/**
+ * @file profile.hpp
+ * @brief Per-procedure profiler behind --profile
+ *
+ * Both engines report each procedure activation: profile_enter() when a call
+ * starts running the body, profile_exit() when the body returns. A tail call
+ * ends the caller's activation and starts the callee's, as it does on the
+ * stack. The profiler keeps a tree of call paths with the time spent in each,
+ * plus call counts and inclusive and exclusive time per procedure name.
+ * Direct recursion is folded into one path element, and paths stop growing
+ * at PROFILE_MAX_DEPTH, deeper calls being charged to the path at the limit,
+ * so deep recursion does not make the output quadratic in the depth.
+ *
+ * Everything is guarded by the profiling flag, so with profiling off a call
+ * costs one predictable branch.
+ */
+
+#include "Def.hpp"
+#include <cstddef>
+#include <iostream>
+
+extern __thread bool profiling;            ///< Set once at startup by --profile, on the main thread: futures run unprofiled
+const std::size_t PROFILE_MAX_DEPTH = 256;
+
+void profile_enter(const Symbol &);
+void profile_exit();
+std::size_t profile_depth();               ///< Number of open activations
+void profile_unwind(std::size_t depth);    ///< Exit activations down to depth, for exceptions
+
+/// Collapsed stacks, one "outer;inner microseconds" line per call path, as
+/// flamegraph.pl and speedscope read them
+void profile_write_folded(std::ostream &);
+/// Table of calls, inclusive and exclusive time per procedure, most exclusive time first
+void profile_write_summary(std::ostream &);
+
+/**
+ * @brief Closes the activations opened in a scope if it is left by an exception
+ */
+class ProfileScope {
+public:
+    ProfileScope() : depth(profiling ? profile_depth() : 0) {}
+    ~ProfileScope() {
+        if (profiling) profile_unwind(depth);
+    }
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+private:
+    std::size_t depth;
+};
+
+#endif
@@ -0,0 +1,165 @@
+/**
+ * @file server.cpp
+ * @brief Session threads and the accept loop of --server mode
+ */
+
+#include "server.hpp"
+#include "future.hpp"
+#include "output.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// Connections accepted and not yet taken by a session thread
+std::mutex lock;
+std::condition_variable cv;
+std::deque<int> connections;
+bool stopping = false;
+
+int listener = -1;
+volatile std::sig_atomic_t stop_requested = 0;
+
+// Wakes the accept loop, whichever thread the signal arrives on
+extern "C" void on_stop(int) {
+    stop_requested = 1;
+    ::shutdown(listener, SHUT_RDWR);
+}
+
+std::string read_all(int fd) {
+    std::string script;
+    char buf[1 << 16];
+    while (true) {
+        ssize_t n = ::read(fd, buf, sizeof buf);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        script.append(buf, n);
+    }
+    return script;
+}
+
+void run_session(int fd, const EnvPtr &prelude, bool use_vm) {
+    std::string script;
+    gc_blocking([&] { script = read_all(fd); });
+    std::istringstream in(script);
+    FdStream out(fd);
+    FutureGroup group{&out, 0, false};
+    future_group = &group;
+    current_output = &out;
+    EnvPtr global_env = new Env(prelude);
+    GcRoot env_root(global_env);
+    try {
+        REPL(in, out, global_env, use_vm, true);
+    } catch (const std::exception &e) {
+        std::lock_guard<std::mutex> guard(output_lock);
+        out << "Error: " << e.what() << '\n';
+    }
+    future_group_close(&group);
+    future_group = nullptr;
+    current_output = &scheme_out;
+}
+
+void work(GcThread *gc, EnvPtr prelude, bool use_vm) {
+    gc_thread_start(gc, __builtin_frame_address(0));
+    GcRoot prelude_root(prelude);
+    while (true) {
+        int fd = -1;
+        gc_blocking([&fd] {
+            std::unique_lock<std::mutex> guard(lock);
+            cv.wait(guard, [] { return stopping || !connections.empty(); });
+            if (connections.empty()) return;
+            fd = connections.front();
+            connections.pop_front();
+        });
+        if (fd < 0) break;
+        run_session(fd, prelude, use_vm);
+        ::close(fd);
+        runtime_stats_merge();
+    }
+    runtime_stats_merge();
+    gc_thread_exit();
+}
+
+} // namespace
+
+bool load_prelude(const char *file, const EnvPtr &prelude, bool use_vm) {
+    std::ifstream in(file);
+    if (!in) return false;
+    REPL(in, scheme_out, prelude, use_vm, true);
+    return true;
+}
+
+bool serve(const char *path, const EnvPtr &prelude, bool use_vm) {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (std::strlen(path) >= sizeof addr.sun_path) {
+        std::cerr << "socket path too long: " << path << std::endl;
+        return false;
+    }
+    std::strcpy(addr.sun_path, path);
+    listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    ::unlink(path);
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0 || ::listen(listener, 128) < 0) {
+        std::cerr << "cannot listen on " << path << ": " << std::strerror(errno) << std::endl;
+        if (listener >= 0) ::close(listener);
+        return false;
+    }
+
+    // A client gone before its output is written must not end the server
+    std::signal(SIGPIPE, SIG_IGN);
+    struct sigaction action;
+    std::memset(&action, 0, sizeof action);
+    action.sa_handler = on_stop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    size_t n = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<std::thread> sessions;
+    for (size_t i = 0; i < n; i++) sessions.emplace_back(work, gc_add_thread(), prelude, use_vm);
+
+    while (!stop_requested) {
+        int fd = -1, error = 0;
+        gc_blocking([&fd, &error] {
+            fd = ::accept(listener, nullptr, nullptr);
+            error = errno;
+        });
+        if (fd < 0) {
+            if (error == EINTR || error == ECONNABORTED) continue;
+            if (!stop_requested) std::cerr << "accept: " << std::strerror(error) << std::endl;
+            break;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            connections.push_back(fd);
+        }
+        cv.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    cv.notify_all();
+    gc_blocking([&sessions] {
+        for (std::thread &t : sessions) t.join();
+    });
+    ::close(listener);
+    ::unlink(path);
+    return true;
+}
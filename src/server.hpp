@@ -0,0 +1,38 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+/**
+ * @file server.hpp
+ * @brief --server mode: many short scripts in one process, over a socket
+ *
+ * serve() listens on a Unix domain socket. A client connects, writes a whole
+ * script and shuts down its side for writing; the script then runs as a
+ * session on one of a fixed set of session threads, one per hardware thread,
+ * and everything it prints, including its REPL output, is sent back before
+ * the server closes the connection. Sessions run concurrently, like futures,
+ * and collections stop them all.
+ *
+ * Each session has a top-level frame of its own on the prelude, the frame
+ * filled from --image=FILE and load_prelude() from --prelude=FILE, then
+ * frozen. A session sees
+ * the prelude's definitions but defines into its own frame, so no session
+ * sees another's names, and starting one copies nothing. set! of a prelude
+ * name is an error in every session. The prelude's data, such as a list or a
+ * hash table a prelude name is bound to, is shared as it is: sessions must not
+ * mutate it.
+ *
+ * SIGINT or SIGTERM stop the server: sessions already accepted are finished
+ * and the socket is removed.
+ */
+
+#include "expr.hpp"
+#include <iostream>
+
+/// Evaluate all of in, printing to out. A session gets no prompts and its
+/// output is not flushed while it reads input. In main.cpp
+void REPL(std::istream &in, std::ostream &out, const EnvPtr &global_env, bool use_vm, bool session);
+
+bool load_prelude(const char *file, const EnvPtr &prelude, bool use_vm);  ///< Evaluate file in the frame, to freeze after; false if it cannot be read
+bool serve(const char *path, const EnvPtr &prelude, bool use_vm);   ///< Until stopped; false if the socket cannot be set up
+
+#endif
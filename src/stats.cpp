@@ -0,0 +1,110 @@
+/**
+ * @file stats.cpp
+ * @brief Interpreter counters
+ */
+
+#include "stats.hpp"
+#include "expr.hpp"
+#include "gc.hpp"
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+__thread RuntimeStats runtime_stats;
+
+namespace {
+
+std::mutex merged_lock;
+RuntimeStats merged;                       ///< Counts other threads have merged
+
+void add(RuntimeStats &to, const RuntimeStats &from) {
+    for (int t = 0; t < E_TYPE_COUNT; t++) to.allocations[t] += from.allocations[t];
+    to.env_frames += from.env_frames;
+    to.env_frames_reclaimed += from.env_frames_reclaimed;
+    to.max_depth = std::max(to.max_depth, from.max_depth);
+    for (std::size_t d = 0; d <= STATS_MAX_DEPTH; d++) to.lookups[d] += from.lookups[d];
+    to.global_lookups += from.global_lookups;
+}
+
+// This thread's counters and the merged ones
+RuntimeStats totals() {
+    std::lock_guard<std::mutex> guard(merged_lock);
+    RuntimeStats all = merged;
+    add(all, runtime_stats);
+    return all;
+}
+
+Expr entry(const char *name, const Expr &value) {
+    return PairE(Expr(new Var(Symbol(name))), value);
+}
+
+Expr count(std::size_t n) {
+    return IntegerE(static_cast<int64_t>(n));
+}
+
+std::size_t totalAllocations(const RuntimeStats &stats) {
+    std::size_t total = 0;
+    for (std::size_t n : stats.allocations) total += n;
+    return total;
+}
+
+} // namespace
+
+void runtime_stats_merge() {
+    std::lock_guard<std::mutex> guard(merged_lock);
+    add(merged, runtime_stats);
+    std::size_t depth = runtime_stats.depth;
+    runtime_stats = RuntimeStats();
+    runtime_stats.depth = depth;
+}
+
+Expr runtime_stats_list() {
+    RuntimeStats stats = totals();
+    GcStats memory = gc_flush_stats();
+    std::vector<Expr> by_type;
+    for (int t = 0; t < E_TYPE_COUNT; t++) {
+        std::size_t n = stats.allocations[t];
+        if (n != 0) by_type.push_back(entry(type_name(static_cast<ExprType>(t)), count(n)));
+    }
+    std::vector<Expr> by_depth;
+    for (std::size_t d = 0; d <= STATS_MAX_DEPTH; d++) by_depth.push_back(PairE(count(d), count(stats.lookups[d])));
+
+    std::vector<Expr> entries = {
+        entry("allocations", count(totalAllocations(stats))),
+        entry("allocations-by-type", ListE(by_type, NullExprE())),
+        entry("env-frames", count(stats.env_frames)),
+        entry("env-frames-reclaimed", count(stats.env_frames_reclaimed)),
+        entry("max-depth", count(stats.max_depth)),
+        entry("lookups-by-depth", ListE(by_depth, NullExprE())),
+        entry("global-lookups", count(stats.global_lookups)),
+        entry("live-bytes", count(memory.live)),
+        entry("payload-bytes", count(memory.payload)),
+        entry("segment-bytes", count(memory.segments)),
+        entry("allocated-bytes", count(memory.bytes)),
+        entry("collections", count(memory.collections)),
+    };
+    return ListE(entries, NullExprE());
+}
+
+void print_runtime_stats(std::ostream &os) {
+    RuntimeStats stats = totals();
+    GcStats memory = gc_flush_stats();
+    os << "allocations " << totalAllocations(stats) << '\n';
+    for (int t = 0; t < E_TYPE_COUNT; t++) {
+        std::size_t n = stats.allocations[t];
+        if (n != 0) os << "allocations." << type_name(static_cast<ExprType>(t)) << ' ' << n << '\n';
+    }
+    os << "env-frames " << stats.env_frames << '\n'
+       << "env-frames-reclaimed " << stats.env_frames_reclaimed << '\n'
+       << "max-depth " << stats.max_depth << '\n';
+    for (std::size_t d = 0; d <= STATS_MAX_DEPTH; d++) {
+        os << "lookups.depth" << d << (d == STATS_MAX_DEPTH ? "+ " : " ") << stats.lookups[d] << '\n';
+    }
+    os << "global-lookups " << stats.global_lookups << '\n'
+       << "live-bytes " << memory.live << '\n'
+       << "payload-bytes " << memory.payload << '\n'
+       << "segment-bytes " << memory.segments << '\n'
+       << "allocated-bytes " << memory.bytes << '\n'
+       << "collections " << memory.collections << std::endl;
+}
@@ -0,0 +1,70 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+/**
+ * @file stats.hpp
+ * @brief Interpreter counters behind (runtime-stats) and SCHEME_STATS
+ *
+ * The counters are always on and cost an increment each: objects created per
+ * ExprType, environment frames created and those freed when their activation
+ * ended, the current and deepest evaluation
+ * depth, and variable lookups by how many frames they walk up. Evaluation
+ * depth counts nested evaluations that return to their caller, trampolined
+ * nodes in the tree walker and frames in the VM, so tail calls do not add to
+ * it. Memory figures come from the collector's gc_stats.
+ *
+ * Each thread counts into its own runtime_stats; threads running futures
+ * add theirs to the reported totals after each task, with
+ * runtime_stats_merge().
+ */
+
+#include "Def.hpp"
+#include <cstddef>
+#include <iostream>
+
+struct Expr;
+
+const std::size_t STATS_MAX_DEPTH = 8;     ///< Lookups walking further are counted at this depth
+
+struct RuntimeStats {
+    std::size_t allocations[E_TYPE_COUNT];
+    std::size_t env_frames;
+    std::size_t env_frames_reclaimed;     ///< Frames freed when their activation ended, see Env::reclaim()
+    std::size_t depth;
+    std::size_t max_depth;
+    std::size_t lookups[STATS_MAX_DEPTH + 1];
+    std::size_t global_lookups;            ///< Top-level and builtin names
+};
+
+extern __thread RuntimeStats runtime_stats;   ///< This thread's counters
+void runtime_stats_merge();                ///< Move this thread's counts into the totals, but for its depth
+
+inline void stats_enter() {
+    if (++runtime_stats.depth > runtime_stats.max_depth) runtime_stats.max_depth = runtime_stats.depth;
+}
+inline void stats_exit() {
+    runtime_stats.depth--;
+}
+inline void stats_lookup(int depth) {
+    runtime_stats.lookups[static_cast<std::size_t>(depth) < STATS_MAX_DEPTH ? depth : STATS_MAX_DEPTH]++;
+}
+
+/// Association list of the counters, as (runtime-stats) returns it
+Expr runtime_stats_list();
+/// The same counters, one "name value" line each
+void print_runtime_stats(std::ostream &);
+
+/**
+ * @brief Restores the evaluation depth if a scope is left by an exception
+ */
+class StatsDepthScope {
+public:
+    StatsDepthScope() : depth(runtime_stats.depth) {}
+    ~StatsDepthScope() { runtime_stats.depth = depth; }
+    StatsDepthScope(const StatsDepthScope &) = delete;
+    StatsDepthScope &operator=(const StatsDepthScope &) = delete;
+private:
+    std::size_t depth;
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "syntax.hpp"
+#include "RE.hpp"
 #include <cstring>
 #include <vector>
 
@@ -7,15 +8,20 @@ SyntaxBase* Syntax::operator->() const { return ptr.get(); }
 SyntaxBase& Syntax::operator*() { return *ptr; }
 SyntaxBase* Syntax::get() const { return ptr.get(); }
 
-Number::Number(int n) : n(n) {}
+Number::Number(int64_t n) : n(n) {}
 void Number::show(std::ostream &os) {
   //os << "the-number-" << n;
   os << n;
 }
 
-RationalSyntax::RationalSyntax(int num, int den) : numerator(num), denominator(den) {}
+BigNumber::BigNumber(const BigInt &n) : n(n) {}
+void BigNumber::show(std::ostream &os) {
+  os << n.toString();
+}
+
+RationalSyntax::RationalSyntax(const BigInt &num, const BigInt &den) : numerator(num), denominator(den) {}
 void RationalSyntax::show(std::ostream &os) {
-  os << numerator << "/" << denominator;
+  os << numerator.toString() << "/" << denominator.toString();
 }
 
 void TrueSyntax::show(std::ostream &os) {
@@ -46,180 +52,236 @@ void List::show(std::ostream &os) {
     os << ')';
 }
 
-std::istream &readSpace(std::istream &is) {
+Reader::Reader(std::istream &in, bool line_at_a_time)
+    : is(in), interactive(line_at_a_time), pos(0) {}
+
+// Appends more input to buf; false at end of input
+bool Reader::fill() {
+  if (interactive) {
+    // Don't wait for more than the line being typed
+    std::string line;
+    if (!std::getline(is, line)) return false;
+    buf += line;
+    buf += '\n';
+    return true;
+  }
+  const size_t BLOCK = 64 << 10;
+  size_t old = buf.size();
+  buf.resize(old + BLOCK);
+  is.read(&buf[old], BLOCK);
+  buf.resize(old + is.gcount());
+  return is.gcount() > 0;
+}
+
+int Reader::peek() {
+  if (pos == buf.size() && !fill()) return EOF;
+  return static_cast<unsigned char>(buf[pos]);
+}
+
+static bool isDelimiter(char c) {
+  return c == '(' || c == ')' || c == '[' || c == ']' || c == ';' ||
+         isspace(static_cast<unsigned char>(c));
+}
+
+void Reader::skipSpace() {
+  bool comment = false;
   while (true) {
-    // 跳过空白字符
-    while (isspace(is.peek()))
-      is.get();
-    
-    // 检查是否是注释
-    if (is.peek() == ';') {
-      // 跳过注释直到行末
-      while (is.peek() != '\n' && is.peek() != EOF)
-        is.get();
-      // 继续循环以跳过注释后的空白字符
-    } else {
-      // 没有更多空白字符或注释，退出循环
-      break;
+    const char *p = buf.data() + pos, *end = buf.data() + buf.size();
+    while (p != end) {
+      if (comment) {
+        // 跳过注释直到行末
+        comment = *p != '\n';
+      } else if (*p == ';') {
+        comment = true;
+      } else if (!isspace(static_cast<unsigned char>(*p))) {
+        break;
+      }
+      p++;
     }
+    pos = p - buf.data();
+    if (p != end || !fill()) return;
   }
-  return is;
 }
 
-Syntax readList(std::istream &is);
-
-// Helper function to try parsing as integer or rational
-bool tryParseNumber(const std::string &s, int &result) {
+// Helper function to try parsing [b, e) as an integer; false also if it
+// does not fit 64 bits
+static bool tryParseNumber(const char *b, const char *e, int64_t &result) {
   bool neg = false;
-  int n = 0;
-  int i = 0;
-  
+  uint64_t n = 0;
+  const char *p = b;
+
   // Single '+' or '-' are not numbers
-  if (s.size() == 1 && (s[0] == '+' || s[0] == '-'))
+  if (e - b == 1 && (*b == '+' || *b == '-'))
     return false;
-  
+
   // Handle sign
-  if (s[0] == '-') {
-    i += 1;
+  if (*p == '-') {
+    p++;
     neg = true;
-  } else if (s[0] == '+') {
-    i += 1;
+  } else if (*p == '+') {
+    p++;
   }
-  
+
   // Check if all remaining characters are digits
-  for (; i < s.size(); i++) {
-    if ('0' <= s[i] && s[i] <= '9') {
-      n = n * 10 + s[i] - '0';
+  for (; p != e; p++) {
+    if ('0' <= *p && *p <= '9') {
+      if (__builtin_mul_overflow(n, 10, &n) || __builtin_add_overflow(n, static_cast<uint64_t>(*p - '0'), &n))
+        return false;
     } else {
       return false;  // Not a valid number
     }
   }
-  
-  result = neg ? -n : n;
+
+  if (n > static_cast<uint64_t>(INT64_MAX) + neg)
+    return false;
+  result = neg ? static_cast<int64_t>(~n + 1) : static_cast<int64_t>(n);
   return true;
 }
 
-// Helper function to try parsing as rational number
-bool tryParseRational(const std::string &s, int &numerator, int &denominator) {
-  size_t slash_pos = s.find('/');
-  if (slash_pos == std::string::npos || slash_pos == 0 || slash_pos == s.size() - 1) {
+// Helper function to try parsing [b, e) as a rational number
+static bool tryParseRational(const char *b, const char *e, BigInt &numerator, BigInt &denominator) {
+  const char *slash = static_cast<const char *>(memchr(b, '/', e - b));
+  if (slash == nullptr || slash == b || slash == e - 1) {
     return false; // No slash or slash at beginning/end
   }
-  
-  std::string num_str = s.substr(0, slash_pos);
-  std::string den_str = s.substr(slash_pos + 1);
-  
+
   // Parse numerator (can be negative)
-  if (!tryParseNumber(num_str, numerator)) {
+  if (!BigInt::parse(b, slash, numerator)) {
     return false;
   }
-  
+
   // Parse denominator (must be positive)
-  if (!tryParseNumber(den_str, denominator) || denominator <= 0) {
+  if (!BigInt::parse(slash + 1, e, denominator) || compare(denominator, BigInt(0)) <= 0) {
     return false;
   }
-  
+
   return true;
 }
 
 // Helper function to create identifier/symbol syntax
-Syntax createIdentifierSyntax(const std::string &s) {
-  if (s == "#t")
-    return Syntax(new TrueSyntax());
-  if (s == "#f")
-    return Syntax(new FalseSyntax());
-  return Syntax(new SymbolSyntax(s));
+static Syntax createIdentifierSyntax(const char *b, const char *e) {
+  if (e - b == 2 && b[0] == '#' && (b[1] == 't' || b[1] == 'f'))
+    return b[1] == 't' ? Syntax(new TrueSyntax()) : Syntax(new FalseSyntax());
+  return Syntax(new SymbolSyntax(std::string(b, e)));
+}
+
+Syntax Reader::readString() {
+  // The opening quote has been consumed
+  std::string str;
+  while (true) {
+    const char *p = buf.data() + pos, *end = buf.data() + buf.size();
+    const char *run = p;
+    while (p != end && *p != '"' && *p != '\\') p++;
+    str.append(run, p);
+    pos = p - buf.data();
+    if (p == end) {
+      if (!fill()) throw(RuntimeError("Unexpected end of input in a string"));
+      continue;
+    }
+    pos++;
+    if (*p == '"') break;
+    // 处理转义字符
+    int next = peek();
+    if (next == EOF) throw(RuntimeError("Unexpected end of input in a string"));
+    pos++;
+    switch (next) {
+      case 'n': str.push_back('\n'); break;
+      case 't': str.push_back('\t'); break;
+      case 'r': str.push_back('\r'); break;
+      case '\\': str.push_back('\\'); break;
+      case '"': str.push_back('"'); break;
+      default: str.push_back(next); break;
+    }
+  }
+  return Syntax(new StringSyntax(str));
+}
+
+Syntax Reader::readList() {
+  List *stx = new List();
+  Syntax res(stx);
+  while (true) {
+    skipSpace();
+    int c = peek();
+    // A truncated form is an error rather than closed here
+    if (c == EOF) throw(RuntimeError("Unexpected end of input in a list"));
+    if (c == ')' || c == ']') {
+      pos++;
+      break;
+    }
+    stx->stxs.push_back(readItem());
+  }
+  return res;
 }
 
 // no leading space
-Syntax readItem(std::istream &is) {
-  if (is.peek() == '(' || is.peek() == '[') {
-    is.get();
-    return readList(is);
-  }
-  if (is.peek() == '\'')
-  {
-    is.get();
+Syntax Reader::readItem() {
+  int c = peek();
+  if (c == EOF) return Syntax(nullptr);
+  if (c == '(' || c == '[') {
+    pos++;
+    return readList();
+  }
+  if (c == '\'') {
+    pos++;
+    skipSpace();
     // 读取单引号后的语法元素
-    Syntax quoted_syntax = readItem(is);
-    
+    Syntax quoted_syntax = readItem();
+    if (quoted_syntax.get() == nullptr) throw(RuntimeError("Unexpected end of input after a quote"));
+
     // 创建 (quote <syntax>) 的列表结构
     List *quote_list = new List();
     quote_list->stxs.push_back(Syntax(new SymbolSyntax("quote")));
     quote_list->stxs.push_back(quoted_syntax);
-    
     return Syntax(quote_list);
   }
   // 处理字符串字面量
-  if (is.peek() == '"') {
-    is.get(); // 消费开始的双引号
-    std::string str;
-    while (is.peek() != '"' && is.peek() != EOF) {
-      char c = is.get();
-      if (c == '\\') {
-        // 处理转义字符
-        char next = is.get();
-        switch (next) {
-          case 'n': str.push_back('\n'); break;
-          case 't': str.push_back('\t'); break;
-          case 'r': str.push_back('\r'); break;
-          case '\\': str.push_back('\\'); break;
-          case '"': str.push_back('"'); break;
-          default: str.push_back(next); break;
-        }
-      } else {
-        str.push_back(c);
-      }
-    }
-    if (is.peek() == '"') {
-      is.get(); // 消费结束的双引号
-    }
-    return Syntax(new StringSyntax(str));
-  }
-  
-  // Read token
-  std::string s;
-  do {
-    int c = is.peek();
-    if (c == '(' || c == ')' ||
-        c == '[' || c == ']' || 
-        c == ';' ||  // 添加分号作为分隔符
-        isspace(c) ||
-        c == EOF)
-      break;
-    is.get();
-    s.push_back(c);
-  } while (true);
-  
+  if (c == '"') {
+    pos++;
+    return readString();
+  }
+
+  // Scan a token in place, refilling if it runs into the end of the buffer
+  size_t start = pos;
+  while (true) {
+    const char *p = buf.data() + pos, *end = buf.data() + buf.size();
+    while (p != end && !isDelimiter(*p)) p++;
+    pos = p - buf.data();
+    if (p != end || !fill()) break;
+  }
+  if (pos == start) {
+    // A stray ')' or ']'
+    pos++;
+    skipSpace();
+    return readItem();
+  }
+  const char *b = buf.data() + start, *e = buf.data() + pos;
+
   // Try parsing as rational first
-  int numerator, denominator;
-  if (tryParseRational(s, numerator, denominator)) {
+  BigInt numerator, denominator;
+  if (tryParseRational(b, e, numerator, denominator)) {
     return Syntax(new RationalSyntax(numerator, denominator));
   }
-  
+
   // Try parsing as integer
-  int number_value;
-  if (tryParseNumber(s, number_value)) {
+  int64_t number_value;
+  if (tryParseNumber(b, e, number_value)) {
     return Syntax(new Number(number_value));
   }
-  
-  // Not a number, treat as identifier/symbol
-  return createIdentifierSyntax(s);
-}
-
-Syntax readList(std::istream &is) {
-    List *stx = new List();
-    while (readSpace(is).peek() != ')' && readSpace(is).peek() != ')')
-        stx->stxs.push_back(readItem(is));
-    is.get(); // ')'
-    return Syntax(stx);
-}
+  BigInt big_value;
+  if (BigInt::parse(b, e, big_value)) {
+    return Syntax(new BigNumber(big_value));
+  }
 
-Syntax readSyntax(std::istream &is) {
-  return readItem(readSpace(is));
+  // Not a number, treat as identifier/symbol
+  return createIdentifierSyntax(b, e);
 }
 
-std::istream &operator>>(std::istream &is, Syntax &stx) {
-  stx = readSyntax(is);
-  return is;
+Syntax Reader::read() {
+  // Drop what earlier data used, keeping the buffer about one block long
+  if (pos >= (64 << 10)) {
+    buf.erase(0, pos);
+    pos = 0;
+  }
+  skipSpace();
+  return readItem();
 }
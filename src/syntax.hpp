@@ -5,6 +5,7 @@
 #include <memory>
 #include <vector>
 #include "Def.hpp"
+#include "bigint.hpp"
 
 struct SyntaxBase {
     virtual Expr parse() = 0;
@@ -22,16 +23,24 @@ struct Syntax {
 };
 
 struct Number : SyntaxBase {
-    int n;
-    Number(int);
+    int64_t n;
+    Number(int64_t);
+    virtual Expr parse() override;
+    virtual void show(std::ostream &) override;
+};
+
+// Integer literal too large for 64 bits
+struct BigNumber : SyntaxBase {
+    BigInt n;
+    BigNumber(const BigInt &);
     virtual Expr parse() override;
     virtual void show(std::ostream &) override;
 };
 
 struct RationalSyntax : SyntaxBase {
-    int numerator;
-    int denominator;
-    RationalSyntax(int num, int den);
+    BigInt numerator;
+    BigInt denominator;
+    RationalSyntax(const BigInt &num, const BigInt &den);
     virtual Expr parse() override;
     virtual void show(std::ostream &) override;
 };
@@ -69,7 +78,26 @@ struct List : SyntaxBase {
     virtual void show(std::ostream &) override;
 };
 
-Syntax readSyntax(std::istream &);
-
-std::istream &operator>>(std::istream &, Syntax &);
+/**
+ * @brief Reader for a stream of data
+ * Input is read in 64KB blocks, or a line at a time when interactive, into a
+ * buffer that tokens are scanned in place; only symbols and string literals
+ * are copied out of it.
+ */
+class Reader {
+public:
+    Reader(std::istream &, bool interactive);
+    Syntax read();                         ///< Next datum, or a null Syntax at end of input; throws RuntimeError if it ends inside one
+private:
+    std::istream &is;
+    bool interactive;
+    std::string buf;
+    size_t pos;                            ///< Next unread character in buf
+    bool fill();
+    int peek();
+    void skipSpace();
+    Syntax readItem();
+    Syntax readList();
+    Syntax readString();
+};
 #endif
\ No newline at end of file
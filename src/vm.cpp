@@ -0,0 +1,600 @@
+/**
+ * @file vm.cpp
+ * @brief Bytecode compiler and virtual machine
+ */
+
+#include "vm.hpp"
+#include "RE.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
+#include "budget.hpp"
+#include <algorithm>
+
+void Code::trace() const {
+    gc_mark(consts);
+    for (const auto &t : closures) {
+        gc_mark(t.body);
+        gc_mark(t.code);
+        gc_mark(t.origin);
+    }
+    for (const Code *c : bodies) gc_mark(c);
+}
+
+namespace {
+
+class Compiler {
+public:
+    explicit Compiler(Code *c) : code(c) {}
+    void expr(const Expr &, bool tail);
+    void op(int x) { code->ops.push_back(x); }
+private:
+    Code *code;
+
+    int constant(const Expr &e) {
+        code->consts.push_back(e);
+        return code->consts.size() - 1;
+    }
+    // Emits a jump and returns where its target goes
+    size_t jump(OpCode o) {
+        op(o);
+        op(0);
+        return code->ops.size() - 1;
+    }
+    void patch(size_t at) {
+        code->ops[at] = code->ops.size();
+    }
+    void sequence(const std::vector<Expr> &, bool tail);
+    void var(const Var *, const Expr &);
+    void cond(const Cond *, const Expr &, bool tail);
+    void closure(const std::vector<Symbol> &, const Expr &body, size_t frame_size, const ExprBase *origin);
+    void apply(const Apply *, const Expr &, bool tail);
+};
+
+void Compiler::sequence(const std::vector<Expr> &es, bool tail) {
+    for (size_t i = 0; i + 1 < es.size(); i++) {
+        expr(es[i], false);
+        op(OP_POP);
+    }
+    expr(es.back(), tail);
+}
+
+void Compiler::var(const Var *v, const Expr &e) {
+    if (v->slot < 0) {
+        op(OP_GLOBAL);
+        op(constant(e));
+    } else if (v->depth == 0) {
+        op(OP_LOCAL0);
+        op(v->slot);
+    } else {
+        op(OP_LOCAL);
+        op(v->depth);
+        op(v->slot);
+    }
+}
+
+void Compiler::cond(const Cond *c, const Expr &e, bool tail) {
+    if (c->clauses.empty()) {
+        op(OP_NODE);                       // raises the error
+        op(constant(e));
+        return;
+    }
+    std::vector<size_t> ends;
+    bool returned = false;
+    for (const auto &clause : c->clauses) {
+        if (clause.test.null()) {          // else
+            expr(clause.body, tail);
+            returned = true;
+            break;
+        }
+        expr(clause.test, false);
+        if (clause.body.null()) {          // the test's value is the result
+            returned = true;
+            break;
+        }
+        size_t next = jump(OP_JUMP_IF_FALSE);
+        expr(clause.body, tail);
+        ends.push_back(jump(OP_JUMP));
+        patch(next);
+    }
+    if (!returned) {
+        op(OP_CONST);
+        op(constant(EmptyE()));
+    }
+    for (size_t at : ends) patch(at);
+}
+
+void Compiler::closure(const std::vector<Symbol> &parameters, const Expr &body, size_t frame_size, const ExprBase *origin) {
+    code->closures.push_back(ProcTemplate{&parameters, body, frame_size, compile(body), origin});
+    op(OP_CLOSURE);
+    op(code->closures.size() - 1);
+}
+
+void Compiler::apply(const Apply *a, const Expr &e, bool tail) {
+    expr(a->rator, false);
+    op(OP_CHECK);
+    op(constant(e));
+    op(0);
+    size_t end = code->ops.size() - 1;
+    for (const auto &r : a->rand) expr(r, false);
+    op(tail ? OP_TAIL_CALL : OP_CALL);
+    op(a->rand.size());
+    patch(end);
+}
+
+void Compiler::expr(const Expr &e, bool tail) {
+    ExprBase *node = e.get();
+    if (node == nullptr) {                 // an immediate
+        op(OP_CONST);
+        op(constant(e));
+        return;
+    }
+    switch (node->e_type) {
+        case E_FIXNUM:
+        case E_BIGNUM:
+        case E_BOOLEAN:
+        case E_RATIONAL:
+        case E_STRING:
+        case E_QUOTE:
+            op(OP_CONST);
+            op(constant(node->eval(nullptr)));
+            return;
+        case E_VAR:
+            var(static_cast<Var*>(node), e);
+            return;
+        case E_BEGIN:
+        {
+            const auto &es = static_cast<Begin*>(node)->es;
+            if (es.empty()) {
+                op(OP_CONST);
+                op(constant(EmptyE()));
+            } else {
+                sequence(es, tail);
+            }
+            return;
+        }
+        case E_IF:
+        {
+            auto i = static_cast<If*>(node);
+            expr(i->cond, false);
+            size_t alter = jump(OP_JUMP_IF_FALSE);
+            expr(i->conseq, tail);
+            size_t end = jump(OP_JUMP);
+            patch(alter);
+            expr(i->alter, tail);
+            patch(end);
+            return;
+        }
+        case E_COND:
+            cond(static_cast<Cond*>(node), e, tail);
+            return;
+        case E_AND:
+        case E_OR:
+        {
+            bool is_and = node->e_type == E_AND;
+            const auto &rands = is_and ? static_cast<AndVar*>(node)->rands : static_cast<OrVar*>(node)->rands;
+            if (rands.empty()) {
+                op(OP_CONST);
+                op(constant(BooleanE(is_and)));
+                return;
+            }
+            std::vector<size_t> ends;
+            for (size_t i = 0; i + 1 < rands.size(); i++) {
+                expr(rands[i], false);
+                ends.push_back(jump(is_and ? OP_AND_JUMP : OP_OR_JUMP));
+            }
+            expr(rands.back(), tail);
+            for (size_t at : ends) patch(at);
+            return;
+        }
+        case E_LAMBDA:
+        {
+            auto l = static_cast<Lambda*>(node);
+            closure(l->x, l->e, l->frame_size, l);
+            return;
+        }
+        case E_DEFINE:
+        {
+            int slot;
+            if (auto d = dynamic_cast<Define*>(node)) {
+                expr(d->e, false);
+                code->names.push_back(d->var);
+                slot = d->slot;
+            } else {
+                auto f = static_cast<Define_f*>(node);
+                closure(f->x, f->e, f->frame_size, f);
+                code->names.push_back(f->var);
+                slot = f->slot;
+            }
+            op(OP_DEFINE);
+            op(code->names.size() - 1);
+            op(slot);
+            return;
+        }
+        case E_SET:
+            expr(static_cast<Set*>(node)->e, false);
+            op(OP_SET);
+            op(constant(e));
+            return;
+        case E_LET:
+        {
+            auto l = static_cast<Let*>(node);
+            for (const auto &b : l->bind) expr(b.second, false);
+            code->bodies.push_back(compile(l->body));
+            op(tail ? OP_TAIL_LET : OP_LET);
+            op(constant(e));
+            op(code->bodies.size() - 1);
+            return;
+        }
+        case E_LETREC:
+        {
+            // The inits run in the new frame, ahead of the body
+            auto l = static_cast<Letrec*>(node);
+            Code *body = new Code();
+            Compiler inner(body);
+            for (const auto &b : l->bind) {
+                inner.expr(b.second, false);
+                inner.op(OP_STORE0);
+                inner.op(b.first);
+            }
+            inner.expr(l->body, true);
+            inner.op(OP_RETURN);
+            code->bodies.push_back(body);
+            op(tail ? OP_TAIL_LETREC : OP_LETREC);
+            op(constant(e));
+            op(code->bodies.size() - 1);
+            return;
+        }
+        case E_APPLY:
+            apply(static_cast<Apply*>(node), e, tail);
+            return;
+        case E_GUARD:
+        {
+            op(OP_GUARD);
+            op(constant(e));
+            op(0);
+            size_t end = code->ops.size() - 1;
+            expr(static_cast<Guard*>(node)->fast, tail);
+            patch(end);
+            return;
+        }
+        default:
+            break;
+    }
+    if (auto u = dynamic_cast<Unary*>(node)) {
+        expr(u->rand, false);
+        op(OP_PRIM1);
+        op(constant(e));
+    } else if (auto b = dynamic_cast<Binary*>(node)) {
+        expr(b->rand1, false);
+        expr(b->rand2, false);
+        op(dynamic_cast<NumericBinary*>(node) ? OP_NUMERIC2 : OP_PRIM2);
+        op(constant(e));
+    } else if (auto v = dynamic_cast<Variadic*>(node)) {
+        for (const auto &r : v->rands) expr(r, false);
+        op(OP_PRIMN);
+        op(constant(e));
+        op(v->rands.size());
+    } else {
+        op(OP_NODE);
+        op(constant(e));
+    }
+}
+
+struct Frame {
+    Code *code;
+    const int *pc;                         ///< Return address while a callee runs
+    Env *env;
+    size_t base;                           ///< Value stack height on entry
+    bool profiled;                         ///< Running a procedure body as a profiled activation
+};
+
+// Nested activations one run keeps at most, each a Frame and at least an Env:
+// as much memory as the tree walker's native stack may take
+const size_t MAX_FRAMES = gc_stack_budget() / (sizeof(Frame) + sizeof(Env) + sizeof(Expr));
+
+/**
+ * @brief State of one vm_eval()
+ * Lives on the native stack and is registered as a GC root.
+ */
+struct Machine : GcObject {
+    std::vector<Expr> stack;
+    std::vector<Frame> frames;
+    virtual void trace() const override;
+    Expr run();
+    void truncate(size_t height) { stack.erase(stack.begin() + height, stack.end()); }
+};
+
+void Machine::trace() const {
+    gc_mark_payload(stack.capacity() * sizeof(Expr) + frames.capacity() * sizeof(Frame));
+    gc_mark(stack);
+    for (const Frame &f : frames) {
+        gc_mark(f.code);
+        gc_mark(f.env);
+    }
+}
+
+const Expr &local(const Env *frame, int slot) {
+    const Expr &v = frame->slots[slot];
+    if (v.null()) throw(RuntimeError("undefined variable"));
+    return v;
+}
+
+Expr Machine::run() {
+    Code *code = frames.back().code;
+    const int *pc = frames.back().pc;
+    Env *env = frames.back().env;
+    Env *const outer = env;
+
+    // The env of the frame below the current one, which a frame the current
+    // one is done with may sit on
+    auto below = [&]() {
+        return frames.size() > 1 ? frames[frames.size() - 2].env : outer;
+    };
+
+    // Enters body in frame, as a call or in place of the current frame. A let
+    // body in tail position stays part of the procedure activation it replaces.
+    auto enter = [&](Code *body, Env *frame, bool tail, bool profiled) {
+        if (tail) {
+            Env *old = frames.back().env;
+            frames.back() = Frame{body, nullptr, frame, frames.back().base, profiled || frames.back().profiled};
+            if (frame->parent != old) Env::reclaim(old, below());
+        } else {
+            if (frames.size() >= MAX_FRAMES) throw(RuntimeError("Recursion too deep"));
+            frames.back().pc = pc;
+            frames.push_back(Frame{body, nullptr, frame, stack.size(), profiled});
+            stats_enter();
+        }
+        code = body;
+        pc = body->ops.data();
+        env = frame;
+    };
+
+    for (;;) {
+        switch (*pc++) {
+            case OP_CONST:
+                stack.push_back(code->consts[*pc++]);
+                break;
+            case OP_LOCAL0:
+                stats_lookup(0);
+                stack.push_back(local(env, *pc++));
+                break;
+            case OP_LOCAL:
+            {
+                Env *frame = env;
+                for (int i = pc[0]; i > 0; i--) frame = frame->parent;
+                stats_lookup(pc[0]);
+                stack.push_back(local(frame, pc[1]));
+                pc += 2;
+                break;
+            }
+            case OP_GLOBAL:
+            {
+                Expr v = static_cast<Var*>(code->consts[*pc++].get())->Var::eval(env);
+                stack.push_back(v);
+                break;
+            }
+            case OP_NODE:
+            {
+                Expr v = code->consts[*pc++]->eval(env);
+                stack.push_back(v);
+                break;
+            }
+            case OP_POP:
+                stack.pop_back();
+                break;
+            case OP_JUMP:
+                pc = code->ops.data() + *pc;
+                break;
+            case OP_JUMP_IF_FALSE:
+            {
+                bool f = stack.back().same(BooleanE(false));
+                stack.pop_back();
+                pc = f ? code->ops.data() + *pc : pc + 1;
+                break;
+            }
+            case OP_AND_JUMP:
+            case OP_OR_JUMP:
+            {
+                bool f = stack.back().same(BooleanE(false));
+                if (f == (pc[-1] == OP_AND_JUMP)) {
+                    pc = code->ops.data() + *pc;
+                } else {
+                    stack.pop_back();
+                    pc++;
+                }
+                break;
+            }
+            case OP_PRIM1:
+            {
+                Expr v = static_cast<Unary*>(code->consts[*pc++].get())->evalRator(stack.back());
+                stack.back() = v;
+                break;
+            }
+            case OP_PRIM2:
+            {
+                size_t n = stack.size();
+                Expr v = static_cast<Binary*>(code->consts[*pc++].get())->evalRator(stack[n - 2], stack[n - 1]);
+                stack.pop_back();
+                stack.back() = v;
+                break;
+            }
+            case OP_NUMERIC2:
+            {
+                size_t n = stack.size();
+                auto node = static_cast<NumericBinary*>(code->consts[*pc++].get());
+                Expr v(nullptr);
+                if (!node->fixnumKernel(stack[n - 2], stack[n - 1], v)) v = node->evalRator(stack[n - 2], stack[n - 1]);
+                stack.pop_back();
+                stack.back() = v;
+                break;
+            }
+            case OP_PRIMN:
+            {
+                auto node = static_cast<Variadic*>(code->consts[pc[0]].get());
+                size_t n = pc[1];
+                pc += 2;
+                std::vector<Expr> args(stack.end() - n, stack.end());
+                Expr v = node->evalRator(args);
+                truncate(stack.size() - n);
+                stack.push_back(v);
+                break;
+            }
+            case OP_CLOSURE:
+            {
+                const ProcTemplate &t = code->closures[*pc++];
+                env->escape();
+                auto p = new Procedure(t.parameters, t.body, env, t.frame_size, t.origin);
+                p->code.store(t.code, std::memory_order_relaxed);
+                stack.push_back(Expr(p));
+                break;
+            }
+            case OP_DEFINE:
+                define_var(code->names[pc[0]], pc[1], stack.back(), env);
+                stack.back() = EmptyE();
+                pc += 2;
+                break;
+            case OP_SET:
+                static_cast<Set*>(code->consts[*pc++].get())->assign(env, stack.back());
+                stack.back() = EmptyE();
+                break;
+            case OP_STORE0:
+                env->slots[*pc++] = stack.back();
+                stack.pop_back();
+                break;
+            case OP_CHECK:
+            {
+                const Expr &f = stack.back();
+                if (f.type() == E_SPECIALFORM) {
+                    // A variable bound to a special form: analyze the raw combination as that form
+                    auto a = static_cast<Apply*>(code->consts[pc[0]].get());
+                    Expr node = analyzeSpecialForm(static_cast<SpecialForm*>(f.get())->type, a->form, a->scope, env);
+                    GcRoot root(node);
+                    Expr v = node->eval(env);
+                    stack.back() = v;
+                    pc = code->ops.data() + pc[1];
+                } else if (f.type() != E_PROC && f.type() != E_PRIMITIVE) {
+                    throw RuntimeError("Attempt to apply a non-procedure");
+                } else {
+                    pc += 2;
+                }
+                break;
+            }
+            case OP_CALL:
+            case OP_TAIL_CALL:
+            {
+                bool tail = pc[-1] == OP_TAIL_CALL;
+                size_t n = *pc++;
+                size_t f_at = stack.size() - n - 1;
+                Expr f = stack[f_at];
+                if (f.type() == E_PROC) {
+                    auto p = static_cast<Procedure*>(f.get());
+                    if (n == p->parameters->size()) {
+                        eval_safepoint();
+                        Env *frame = Env::make(p->env, p->frame_size, p->reclaimable());
+                        std::copy(stack.begin() + f_at + 1, stack.end(), frame->slots);
+                        truncate(f_at);
+                        Code *body = p->code.load(std::memory_order_acquire);
+                        if (body == nullptr) {
+                            // Sessions calling a prelude procedure may both compile it; either result will do.
+                            // A body from a heap image is analyzed first
+                            Expr e = p->e;
+                            if (e->e_type == E_DEFERRED) e = static_cast<DeferredBody*>(e.get())->body(frame);
+                            body = compile(e);
+                            p->code.store(body, std::memory_order_release);
+                        }
+                        if (tail) truncate(frames.back().base);
+                        if (profiling) {
+                            // A tail call ends the activation it replaces
+                            if (tail && frames.back().profiled) profile_exit();
+                            profile_enter(p->name());
+                        }
+                        enter(body, frame, tail, profiling);
+                        break;
+                    }
+                }
+                std::vector<Expr> args(stack.begin() + f_at + 1, stack.end());
+                if (f.type() != E_PRIMITIVE) throw RuntimeError("Wrong number of arguments");
+                Expr v = applyPrimitive(static_cast<Primitive*>(f.get())->type, args);
+                truncate(f_at);
+                stack.push_back(v);
+                break;
+            }
+            case OP_LET:
+            case OP_TAIL_LET:
+            {
+                bool tail = pc[-1] == OP_TAIL_LET;
+                auto l = static_cast<Let*>(code->consts[pc[0]].get());
+                Code *body = code->bodies[pc[1]];
+                pc += 2;
+                eval_safepoint();
+                Env *frame = Env::make(env, l->frame_size, l->reclaimable);
+                size_t first = stack.size() - l->bind.size();
+                for (size_t i = 0; i < l->bind.size(); i++) frame->slots[l->bind[i].first] = stack[first + i];
+                truncate(tail ? frames.back().base : first);
+                enter(body, frame, tail, false);
+                break;
+            }
+            case OP_LETREC:
+            case OP_TAIL_LETREC:
+            {
+                bool tail = pc[-1] == OP_TAIL_LETREC;
+                auto l = static_cast<Letrec*>(code->consts[pc[0]].get());
+                Code *body = code->bodies[pc[1]];
+                pc += 2;
+                eval_safepoint();
+                Env *frame = Env::make(env, l->frame_size, l->reclaimable);
+                if (tail) truncate(frames.back().base);
+                enter(body, frame, tail, false);
+                break;
+            }
+            case OP_GUARD:
+            {
+                auto g = static_cast<Guard*>(code->consts[pc[0]].get());
+                if (g->fastApplies(env)) {
+                    pc += 2;
+                } else {
+                    Expr v = g->eval(env);
+                    stack.push_back(v);
+                    pc = code->ops.data() + pc[1];
+                }
+                break;
+            }
+            case OP_RETURN:
+            {
+                Expr v = stack.back();
+                truncate(frames.back().base);
+                if (frames.back().profiled) profile_exit();
+                Env::reclaim(env, below());
+                frames.pop_back();
+                stats_exit();
+                if (frames.empty()) return v;
+                stack.push_back(v);
+                code = frames.back().code;
+                pc = frames.back().pc;
+                env = frames.back().env;
+                break;
+            }
+        }
+    }
+}
+
+} // namespace
+
+Code *compile(const Expr &e) {
+    Code *code = new Code();
+    Compiler c(code);
+    c.expr(e, true);
+    c.op(OP_RETURN);
+    return code;
+}
+
+Expr vm_eval(const Expr &e, const EnvPtr &env) {
+    Code *code = compile(e);
+    Machine m;
+    GcRoot root(m);
+    ProfileScope profile;
+    StatsDepthScope depth;
+    m.frames.push_back(Frame{code, code->ops.data(), env, 0, false});
+    stats_enter();
+    return m.run();
+}
@@ -0,0 +1,79 @@
+#ifndef VM_HPP
+#define VM_HPP
+
+/**
+ * @file vm.hpp
+ * @brief Bytecode compiler and virtual machine, selected with --engine=vm
+ *
+ * compile() turns an analyzed expression into a Code object: a flat array of
+ * instructions for a stack machine plus the constants and nested bodies they
+ * refer to. vm_eval() runs it with an explicit value stack and call stack, so
+ * calls and returns never recurse on the native stack.
+ *
+ * The VM shares frames, values and Procedure objects with the tree walker,
+ * which stays the reference implementation. Forms without an instruction of
+ * their own compile to OP_NODE, which calls their eval(); a Procedure created
+ * that way gets its body compiled the first time the VM calls it.
+ */
+
+#include "expr.hpp"
+#include <vector>
+
+/**
+ * @brief Instructions
+ * Operands follow the opcode in Code::ops. Jump targets are indices into ops.
+ */
+enum OpCode {
+    OP_CONST,                  ///< k: push consts[k]
+    OP_LOCAL0,                 ///< slot: push a slot of the current frame
+    OP_LOCAL,                  ///< depth slot: push a slot of an enclosing frame
+    OP_GLOBAL,                 ///< k: push the top-level binding of the Var consts[k]
+    OP_NODE,                   ///< k: push consts[k]->eval()
+    OP_POP,
+    OP_JUMP,                   ///< target
+    OP_JUMP_IF_FALSE,          ///< target: pop, jump if it was #f
+    OP_AND_JUMP,               ///< target: jump keeping the top if it is #f, else pop
+    OP_OR_JUMP,                ///< target: jump keeping the top unless it is #f, else pop
+    OP_PRIM1,                  ///< k: apply the Unary consts[k] to the top
+    OP_PRIM2,                  ///< k: apply the Binary consts[k] to the top two
+    OP_NUMERIC2,               ///< k: as OP_PRIM2 for a NumericBinary, fixnums computed inline
+    OP_PRIMN,                  ///< k n: apply the Variadic consts[k] to the top n
+    OP_CLOSURE,                ///< t: push a Procedure made from closures[t]
+    OP_DEFINE,                 ///< name slot: define names[name] as the top, replaced by the empty value
+    OP_SET,                    ///< k: assign the top with the Set consts[k], replaced by the empty value
+    OP_STORE0,                 ///< slot: pop into a slot of the current frame
+    OP_CHECK,                  ///< k target: check the operator on top before the operands of the Apply consts[k]
+    OP_CALL,                   ///< n: call the operator below the top n values
+    OP_TAIL_CALL,              ///< n: as OP_CALL, replacing the current frame
+    OP_LET,                    ///< k body: bind the top values as the Let consts[k] does and run bodies[body]
+    OP_TAIL_LET,
+    OP_LETREC,                 ///< k body: run bodies[body] in a new frame for the Letrec consts[k]
+    OP_TAIL_LETREC,
+    OP_GUARD,                  ///< k target: unless the Guard consts[k] may use its fast node, push its value and jump
+    OP_RETURN,
+};
+
+/**
+ * @brief Lambda or define'd procedure, as OP_CLOSURE instantiates it
+ */
+struct ProcTemplate {
+    const std::vector<Symbol> *parameters; ///< Held by origin
+    Expr body;
+    size_t frame_size;
+    Code *code;                            ///< Compiled body
+    const ExprBase *origin;                ///< The Lambda or Define_f, for Procedure::origin
+};
+
+struct Code : GcObject {
+    std::vector<int> ops;
+    std::vector<Expr> consts;              ///< Constants and the nodes instructions consult
+    std::vector<Symbol> names;
+    std::vector<ProcTemplate> closures;
+    std::vector<Code *> bodies;            ///< let and letrec bodies
+    virtual void trace() const override;
+};
+
+Code *compile(const Expr &);               ///< Code returning the value of an analyzed expression
+Expr vm_eval(const Expr &, const EnvPtr &);
+
+#endif